@@ -73,6 +73,7 @@ void AstarteDeviceSDK::initImpl()
         }
     });
     connect(m_astarteTransport, &Hyperdrive::AstarteTransport::connectionStatusChanged, this, &AstarteDeviceSDK::connectionStatusChanged);
+    connect(m_astarteTransport, &Hyperdrive::AstarteTransport::sendWindowAvailable, this, &AstarteDeviceSDK::sendWindowAvailable);
 
     QFile schemaFile(QStringLiteral("%1/interface.json").arg(
                 QLatin1String(Hyperdrive::StaticConfig::transportAstarteDataDir())));
@@ -310,6 +311,27 @@ Hyperspace::Reliability AstarteDeviceSDK::reliabilityStringToReliability(const Q
 }
 
 bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QVariant &value, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    return sendData(interface, path, value, timestamp, Hyperspace::EncodedMetadata(metadata));
+}
+
+bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QVariant &value, const QVariantHash &metadata)
+{
+    return sendData(interface, path, value, QDateTime(), metadata);
+}
+
+bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QVariantHash &value, const QVariantHash &metadata)
+{
+    return sendData(interface, value, QDateTime(), metadata);
+}
+
+bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QVariantHash &value, const QDateTime &timestamp,
+                                const QVariantHash &metadata)
+{
+    return sendData(interface, value, timestamp, Hyperspace::EncodedMetadata(metadata));
+}
+
+bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QVariant &value, const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata)
 {
     if (!m_producers.contains(interface)) {
         qCWarning(astarteDeviceSDKDC) << "No producers for interface " << interface;
@@ -319,18 +341,18 @@ bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &p
     return m_producers.value(interface)->sendData(value, path, timestamp, metadata);
 }
 
-bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QVariant &value, const QVariantHash &metadata)
+bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QVariant &value, const Hyperspace::EncodedMetadata &metadata)
 {
     return sendData(interface, path, value, QDateTime(), metadata);
 }
 
-bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QVariantHash &value, const QVariantHash &metadata)
+bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QVariantHash &value, const Hyperspace::EncodedMetadata &metadata)
 {
     return sendData(interface, value, QDateTime(), metadata);
 }
 
 bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QVariantHash &value, const QDateTime &timestamp,
-                                const QVariantHash &metadata)
+                                const Hyperspace::EncodedMetadata &metadata)
 {
     if (!m_producers.contains(interface)) {
         qCWarning(astarteDeviceSDKDC) << "No producers for interface " << interface;
@@ -425,6 +447,15 @@ AstarteDeviceSDK::ConnectionStatus AstarteDeviceSDK::connectionStatus() const
     return static_cast<AstarteDeviceSDK::ConnectionStatus>(m_astarteTransport->connectionStatus());
 }
 
+bool AstarteDeviceSDK::canSend() const
+{
+    if (!m_astarteTransport) {
+        return true;
+    }
+
+    return m_astarteTransport->canSend();
+}
+
 bool AstarteDeviceSDK::connectToAstarte()
 {
   if (!m_astarteTransport) {
@@ -447,6 +478,12 @@ bool AstarteDeviceSDK::disconnectFromAstarte()
 
 template <typename T> bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path,
                                                       const QList<T> &valueList, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    return sendData(interface, path, valueList, timestamp, Hyperspace::EncodedMetadata(metadata));
+}
+
+template <typename T> bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path,
+                                                      const QList<T> &valueList, const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata)
 {
     if (!m_producers.contains(interface)) {
         qCWarning(astarteDeviceSDKDC) << "No producers for interface " << interface;
@@ -463,6 +500,13 @@ template <typename T> bool AstarteDeviceSDK::sendData(const QByteArray &interfac
     return m_producers.value(interface)->sendData(QVariant(variantValue), path, timestamp, metadata);
 }
 
+template bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QList<QByteArray> &value, const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata);
+template bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QList<int> &value, const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata);
+template bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QList<qlonglong> &value, const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata);
+template bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QList<double> &value, const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata);
+template bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QList<bool> &value, const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata);
+template bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QList<QDateTime> &value, const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata);
+template bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QList<QString> &value, const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata);
 template bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QList<QByteArray> &value, const QDateTime &timestamp, const QVariantHash &metadata);
 template bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QList<int> &value, const QDateTime &timestamp, const QVariantHash &metadata);
 template bool AstarteDeviceSDK::sendData(const QByteArray &interface, const QByteArray &path, const QList<qlonglong> &value, const QDateTime &timestamp, const QVariantHash &metadata);
@@ -68,10 +68,29 @@ public:
     template <typename T> bool sendData(const QByteArray &interface, const QByteArray &path, const QList<T> &value,
             const QDateTime &timestamp = QDateTime(), const QVariantHash &metadata = QVariantHash());
 
+    // Metadata encoded once, for samples sent with the same metadata
+    bool sendData(const QByteArray &interface, const QByteArray &path, const QVariant &value,
+            const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata);
+
+    bool sendData(const QByteArray &interface, const QByteArray &path, const QVariant &value,
+            const Hyperspace::EncodedMetadata &metadata);
+
+    bool sendData(const QByteArray &interface, const QVariantHash &value, const QDateTime &timestamp,
+            const Hyperspace::EncodedMetadata &metadata);
+
+    bool sendData(const QByteArray &interface, const QVariantHash &value, const Hyperspace::EncodedMetadata &metadata);
+
+    template <typename T> bool sendData(const QByteArray &interface, const QByteArray &path, const QList<T> &value,
+            const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata);
+
     bool sendUnset(const QByteArray &interface, const QByteArray &path);
 
     ConnectionStatus connectionStatus() const;
 
+    // False while the transport holds messages because its in-flight window is full, producers should
+    // then wait for sendWindowAvailable
+    bool canSend() const;
+
     bool connectToAstarte();
     bool disconnectFromAstarte();
 
@@ -79,6 +98,7 @@ Q_SIGNALS:
     void unsetReceived(const QByteArray &interface, const QByteArray &path);
     void dataReceived(const QByteArray &interface, const QByteArray &path, const QVariant &value);
     void connectionStatusChanged();
+    void sendWindowAvailable();
 
 protected Q_SLOTS:
 
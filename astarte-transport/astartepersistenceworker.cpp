@@ -0,0 +1,385 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "astartepersistenceworker.h"
+
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QTimer>
+
+#include <hyperdriveinterface.h>
+
+#define PERSISTENT_ENTRIES_PAGE_SIZE 500
+#define CACHE_MESSAGES_PAGE_SIZE 500
+
+Q_LOGGING_CATEGORY(astartePersistenceWorkerDC, "hyperdrive.transport.astarte.persistenceworker", DEBUG_MESSAGES_DEFAULT_LEVEL)
+
+// Same accounting as the quota of AstarteTransportCache
+static bool isEvictable(const Hyperdrive::CacheMessage &message)
+{
+    return message.interfaceType() != Hyperdrive::Interface::Type::Properties;
+}
+
+static qint64 messageSize(const Hyperdrive::CacheMessage &message)
+{
+    return message.target().size() + message.payload().size();
+}
+
+AstartePersistenceWorker::AstartePersistenceWorker(CacheStorage *storage, int flushIntervalMs, int flushOperations, QObject *parent)
+    : QObject(parent)
+    , m_storage(storage)
+    , m_opened(false)
+    , m_closed(false)
+    , m_flushIntervalMs(flushIntervalMs)
+    , m_flushOperations(qMax(1, flushOperations))
+    , m_flushTimer(new QTimer(this))
+    , m_loadedMaxCacheMessageId(0)
+    , m_loadedEvictableMessages(0)
+    , m_loadedEvictableBytes(0)
+    , m_evictedMessages(0)
+    , m_evictedBytes(0)
+    , m_lastLoadedCacheMessageId(0)
+{
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(qMax(0, m_flushIntervalMs));
+    connect(m_flushTimer, &QTimer::timeout, this, &AstartePersistenceWorker::commitPending);
+}
+
+AstartePersistenceWorker::~AstartePersistenceWorker()
+{
+    delete m_storage;
+}
+
+bool AstartePersistenceWorker::open()
+{
+    if (m_opened) {
+        return true;
+    }
+    if (m_closed) {
+        // The storage is never reopened once it has been shut down
+        return false;
+    }
+
+    m_opened = m_storage->open();
+    if (m_opened) {
+        // Only hashes are kept in memory, payloads are read back when needed
+        QByteArray targetCursor;
+        Q_FOREVER {
+            CacheStorage::PersistentEntryList page = m_storage->persistentEntriesPage(targetCursor, PERSISTENT_ENTRIES_PAGE_SIZE);
+            if (page.isEmpty()) {
+                break;
+            }
+            for (const QPair<QByteArray, QByteArray> &entry : page) {
+                m_loadedPersistentEntryHashes.insert(entry.first, CacheStorage::payloadHash(entry.second));
+            }
+            targetCursor = page.last().first;
+        }
+        // Housekeeping: expired messages are never replayed
+        m_storage->deleteExpiredCacheMessages();
+        m_loadedMaxCacheMessageId = m_storage->maxCacheMessageId();
+
+        // Stored messages are only replayed a page at a time, but all of them count against the quota
+        int idCursor = 0;
+        Q_FOREVER {
+            QList<Hyperdrive::CacheMessage> page = m_storage->cacheMessagesPage(idCursor, m_loadedMaxCacheMessageId, CACHE_MESSAGES_PAGE_SIZE);
+            if (page.isEmpty()) {
+                break;
+            }
+            for (const Hyperdrive::CacheMessage &message : page) {
+                if (isEvictable(message)) {
+                    ++m_loadedEvictableMessages;
+                    m_loadedEvictableBytes += messageSize(message);
+                }
+            }
+            idCursor = page.last().attribute("dbId").toInt();
+        }
+    }
+
+    return m_opened;
+}
+
+void AstartePersistenceWorker::close()
+{
+    commitPending();
+    {
+        QMutexLocker locker(&m_mutex);
+        m_closed = true;
+    }
+    if (m_opened) {
+        m_storage->close();
+        m_opened = false;
+    }
+}
+
+QHash<QByteArray, quint64> AstartePersistenceWorker::takeLoadedPersistentEntryHashes()
+{
+    QHash<QByteArray, quint64> ret;
+    ret.swap(m_loadedPersistentEntryHashes);
+    return ret;
+}
+
+int AstartePersistenceWorker::loadedMaxCacheMessageId() const
+{
+    return m_loadedMaxCacheMessageId;
+}
+
+int AstartePersistenceWorker::loadedEvictableMessages() const
+{
+    return m_loadedEvictableMessages;
+}
+
+qint64 AstartePersistenceWorker::loadedEvictableBytes() const
+{
+    return m_loadedEvictableBytes;
+}
+
+int AstartePersistenceWorker::evictedMessages() const
+{
+    return m_evictedMessages;
+}
+
+qint64 AstartePersistenceWorker::evictedBytes() const
+{
+    return m_evictedBytes;
+}
+
+bool AstartePersistenceWorker::saveSnapshot()
+{
+    commitPending();
+    return open() && m_storage->saveSnapshot();
+}
+
+QByteArray AstartePersistenceWorker::loadPersistentEntry(const QByteArray &target)
+{
+    commitPending();
+    return open() ? m_storage->persistentEntry(target) : QByteArray();
+}
+
+CacheStorage::PersistentEntryList AstartePersistenceWorker::loadPersistentEntriesPage(const QByteArray &afterTarget, int limit)
+{
+    commitPending();
+    return open() ? m_storage->persistentEntriesPage(afterTarget, limit) : CacheStorage::PersistentEntryList();
+}
+
+void AstartePersistenceWorker::loadCacheMessagesPage(int afterId, int maxId, int limit)
+{
+    QList<Hyperdrive::CacheMessage> messages;
+    if (open()) {
+        messages = m_storage->cacheMessagesPage(afterId, maxId, limit);
+    }
+    if (!messages.isEmpty()) {
+        m_lastLoadedCacheMessageId = qMax(m_lastLoadedCacheMessageId, messages.last().attribute("dbId").toInt());
+    }
+
+    Q_EMIT cacheMessagesPageLoaded(messages);
+}
+
+void AstartePersistenceWorker::evictCacheMessages(int afterId, int maxId, int messages, qint64 bytes)
+{
+    commitPending();
+    m_evictedMessages = 0;
+    m_evictedBytes = 0;
+    if (!open()) {
+        return;
+    }
+
+    QVector<int> ids;
+    int idCursor = qMax(afterId, m_lastLoadedCacheMessageId);
+    while ((m_evictedMessages < messages || m_evictedBytes < bytes) && idCursor < maxId) {
+        QList<Hyperdrive::CacheMessage> page = m_storage->cacheMessagesPage(idCursor, maxId, CACHE_MESSAGES_PAGE_SIZE);
+        if (page.isEmpty()) {
+            break;
+        }
+        for (const Hyperdrive::CacheMessage &message : page) {
+            idCursor = message.attribute("dbId").toInt();
+            if (!isEvictable(message)) {
+                continue;
+            }
+            ids.append(idCursor);
+            ++m_evictedMessages;
+            m_evictedBytes += messageSize(message);
+            if (m_evictedMessages >= messages && m_evictedBytes >= bytes) {
+                break;
+            }
+        }
+    }
+
+    if (!ids.isEmpty()) {
+        m_storage->beginBatch(false);
+        m_storage->deleteCacheMessages(ids);
+        m_storage->commitBatch();
+    }
+}
+
+void AstartePersistenceWorker::insertCacheMessage(int id, const Hyperdrive::CacheMessage &message, const QDateTime &expiry, bool durable)
+{
+    Operation operation;
+    operation.type = OperationType::InsertCacheMessage;
+    operation.durable = durable;
+    operation.id = id;
+    operation.message = message;
+    operation.expiry = expiry;
+    enqueue(operation);
+}
+
+void AstartePersistenceWorker::deleteCacheMessage(int id)
+{
+    Operation operation;
+    operation.type = OperationType::DeleteCacheMessage;
+    operation.durable = false;
+    operation.id = id;
+    enqueue(operation);
+}
+
+void AstartePersistenceWorker::deleteCacheMessages(const QVector<int> &ids)
+{
+    if (ids.isEmpty()) {
+        return;
+    }
+
+    Operation operation;
+    operation.type = OperationType::DeleteCacheMessages;
+    operation.durable = false;
+    operation.ids = ids;
+    enqueue(operation);
+}
+
+void AstartePersistenceWorker::insertPersistentEntry(const QByteArray &target, const QByteArray &payload)
+{
+    Operation operation;
+    operation.type = OperationType::InsertPersistentEntry;
+    operation.durable = false;
+    operation.target = target;
+    operation.payload = payload;
+    enqueue(operation);
+}
+
+void AstartePersistenceWorker::updatePersistentEntry(const QByteArray &target, const QByteArray &payload)
+{
+    Operation operation;
+    operation.type = OperationType::UpdatePersistentEntry;
+    operation.durable = false;
+    operation.target = target;
+    operation.payload = payload;
+    enqueue(operation);
+}
+
+void AstartePersistenceWorker::deletePersistentEntry(const QByteArray &target)
+{
+    Operation operation;
+    operation.type = OperationType::DeletePersistentEntry;
+    operation.durable = false;
+    operation.target = target;
+    enqueue(operation);
+}
+
+void AstartePersistenceWorker::enqueue(const Operation &operation)
+{
+    bool wakeUp;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_closed) {
+            qCWarning(astartePersistenceWorkerDC) << "Cache storage closed, dropping operation";
+            return;
+        }
+        m_pending.append(operation);
+        // Wake the worker up for the first pending operation, and again as soon as a whole group is ready
+        wakeUp = m_pending.count() == 1 || m_pending.count() == m_flushOperations;
+    }
+
+    if (wakeUp) {
+        QMetaObject::invokeMethod(this, "scheduleCommit", Qt::QueuedConnection);
+    }
+}
+
+void AstartePersistenceWorker::scheduleCommit()
+{
+    int pendingCount;
+    {
+        QMutexLocker locker(&m_mutex);
+        pendingCount = m_pending.count();
+    }
+
+    if (pendingCount >= m_flushOperations || m_flushIntervalMs <= 0) {
+        commitPending();
+    } else if (pendingCount > 0 && !m_flushTimer->isActive()) {
+        m_flushTimer->start();
+    }
+}
+
+void AstartePersistenceWorker::commitPending()
+{
+    m_flushTimer->stop();
+
+    QVector<Operation> operations;
+    bool closed;
+    {
+        QMutexLocker locker(&m_mutex);
+        operations.swap(m_pending);
+        closed = m_closed;
+    }
+
+    if (operations.isEmpty()) {
+        return;
+    }
+
+    if (closed) {
+        // A flush queued before the shutdown must not reopen the storage
+        qCWarning(astartePersistenceWorkerDC) << "Cache storage closed, dropping" << operations.count() << "operations";
+        return;
+    }
+
+    // Operations might be queued before the cache is initialized
+    if (!open()) {
+        qCWarning(astartePersistenceWorkerDC) << "Could not open the cache storage, dropping" << operations.count() << "operations";
+        return;
+    }
+
+    qCDebug(astartePersistenceWorkerDC) << "Committing" << operations.count() << "operations";
+
+    bool durable = false;
+    for (const Operation &operation : operations) {
+        durable = durable || operation.durable;
+    }
+
+    m_storage->beginBatch(durable);
+    for (const Operation &operation : operations) {
+        switch (operation.type) {
+            case OperationType::InsertCacheMessage:
+                m_storage->insertCacheMessage(operation.id, operation.message, operation.expiry);
+                break;
+            case OperationType::DeleteCacheMessage:
+                m_storage->deleteCacheMessage(operation.id);
+                break;
+            case OperationType::DeleteCacheMessages:
+                m_storage->deleteCacheMessages(operation.ids);
+                break;
+            case OperationType::InsertPersistentEntry:
+                m_storage->insertPersistentEntry(operation.target, operation.payload);
+                break;
+            case OperationType::UpdatePersistentEntry:
+                m_storage->updatePersistentEntry(operation.target, operation.payload);
+                break;
+            case OperationType::DeletePersistentEntry:
+                m_storage->deletePersistentEntry(operation.target);
+                break;
+        }
+    }
+
+    m_storage->commitBatch();
+}
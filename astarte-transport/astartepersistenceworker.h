@@ -0,0 +1,138 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ASTARTE_PERSISTENCE_WORKER_H
+#define ASTARTE_PERSISTENCE_WORKER_H
+
+#include "cachestorage.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QVector>
+
+#include <cachemessage.h>
+
+class QTimer;
+
+/**
+ * Applies writes to a CacheStorage from its own thread.
+ *
+ * Operations are queued from any thread and committed in groups, either when flushOperations operations
+ * are pending or flushIntervalMs after the first pending one. The caller keeps the authoritative state in
+ * memory, the worker only mirrors it on disk.
+ */
+class AstartePersistenceWorker : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(AstartePersistenceWorker)
+
+public:
+    // Takes ownership of storage
+    explicit AstartePersistenceWorker(CacheStorage *storage, int flushIntervalMs, int flushOperations, QObject *parent = nullptr);
+    virtual ~AstartePersistenceWorker();
+
+    // Thread safe
+    // A durable insert makes its whole group commit synced to disk
+    void insertCacheMessage(int id, const Hyperdrive::CacheMessage &message, const QDateTime &expiry, bool durable = false);
+    void deleteCacheMessage(int id);
+    void deleteCacheMessages(const QVector<int> &ids);
+    void insertPersistentEntry(const QByteArray &target, const QByteArray &payload);
+    void updatePersistentEntry(const QByteArray &target, const QByteArray &payload);
+    void deletePersistentEntry(const QByteArray &target);
+
+    // State loaded by open(), to be taken once open() has returned: the payload hash of every persistent entry
+    QHash<QByteArray, quint64> takeLoadedPersistentEntryHashes();
+    int loadedMaxCacheMessageId() const;
+    // Count and bytes of the stored cache messages which are not properties, which are the ones under quota
+    int loadedEvictableMessages() const;
+    qint64 loadedEvictableBytes() const;
+
+    // Outcome of the last evictCacheMessages, to be read once it has returned
+    int evictedMessages() const;
+    qint64 evictedBytes() const;
+
+public Q_SLOTS:
+    // These have to run in the worker thread
+    bool open();
+    void close();
+    void commitPending();
+    void loadCacheMessagesPage(int afterId, int maxId, int limit);
+    // Deletes the messages with afterId < id <= maxId in id order, skipping properties and the pages already
+    // loaded, until at least the given count and bytes are gone. Pending writes are committed first.
+    void evictCacheMessages(int afterId, int maxId, int messages, qint64 bytes);
+    // Commits what is pending, then writes a snapshot of the storage
+    bool saveSnapshot();
+    // Reads are served after committing what is pending, so they see every write queued before them
+    QByteArray loadPersistentEntry(const QByteArray &target);
+    CacheStorage::PersistentEntryList loadPersistentEntriesPage(const QByteArray &afterTarget, int limit);
+
+Q_SIGNALS:
+    void cacheMessagesPageLoaded(const QList<Hyperdrive::CacheMessage> &messages);
+
+private Q_SLOTS:
+    void scheduleCommit();
+
+private:
+    enum class OperationType {
+        InsertCacheMessage,
+        DeleteCacheMessage,
+        DeleteCacheMessages,
+        InsertPersistentEntry,
+        UpdatePersistentEntry,
+        DeletePersistentEntry
+    };
+
+    struct Operation {
+        OperationType type;
+        int id;
+        QVector<int> ids;
+        Hyperdrive::CacheMessage message;
+        QDateTime expiry;
+        QByteArray target;
+        QByteArray payload;
+        // The operation has to be synced to disk when its group is committed
+        bool durable;
+    };
+
+    void enqueue(const Operation &operation);
+
+    CacheStorage *m_storage;
+    bool m_opened;
+    // Set by close(), under m_mutex: from then on operations are dropped and the storage is not reopened
+    bool m_closed;
+    int m_flushIntervalMs;
+    int m_flushOperations;
+    QTimer *m_flushTimer;
+
+    QMutex m_mutex;
+    QVector<Operation> m_pending;
+
+    QHash<QByteArray, quint64> m_loadedPersistentEntryHashes;
+    int m_loadedMaxCacheMessageId;
+    int m_loadedEvictableMessages;
+    qint64 m_loadedEvictableBytes;
+    int m_evictedMessages;
+    qint64 m_evictedBytes;
+    // Last id handed out by loadCacheMessagesPage, the page might not have reached the cache yet
+    int m_lastLoadedCacheMessageId;
+};
+
+#endif // ASTARTE_PERSISTENCE_WORKER_H
@@ -49,6 +49,11 @@
 #include <hyperdriveutils.h>
 
 #include <astartehttpendpoint.h>
+#include <hyperdrivemqttclientwrapper.h>
+#ifdef ENABLE_TEST_CODEPATHS
+#include <hyperdriveloopbackmqttclientwrapper.h>
+#endif
+#include <transportdatabasemanager.h>
 
 #include <HyperspaceCore/Fluctuation>
 #include <HyperspaceCore/Rebound>
@@ -65,11 +70,32 @@
 
 #define CERTIFICATE_RENEWAL_DAYS 8
 
+// Properties are streamed from the cache storage in pages of this size
+#define PROPERTIES_PAGE_SIZE 200
+
+// Held ids left behind by evicted or expired entries are pruned once there are this many, or twice the live ones
+#define HELD_RETRY_IDS_PRUNE_THRESHOLD 256
+
 Q_LOGGING_CATEGORY(astarteTransportDC, "hyperdrive.transport.astarte", DEBUG_MESSAGES_DEFAULT_LEVEL)
 
 namespace Hyperdrive
 {
 
+static AstarteTransportCache::Durability parseDurability(const QString &value, AstarteTransportCache::Durability defaultDurability)
+{
+    QString durability = value.trimmed().toLower();
+    if (durability == QStringLiteral("volatile")) {
+        return AstarteTransportCache::Durability::Volatile;
+    } else if (durability == QStringLiteral("batched")) {
+        return AstarteTransportCache::Durability::Batched;
+    } else if (durability == QStringLiteral("strict")) {
+        return AstarteTransportCache::Durability::Strict;
+    }
+
+    qCWarning(astarteTransportDC) << "Unknown durability value" << value << ", using the default";
+    return defaultDurability;
+}
+
 AstarteTransport::AstarteTransport(const QString &configurationPath, QObject* parent)
     : AsyncInitObject(parent)
     , m_configurationPath(configurationPath)
@@ -77,9 +103,16 @@ AstarteTransport::AstarteTransport(const QString &configurationPath, QObject* pa
     , m_rebootWhenConnectionFails(false)
     , m_rebootDelayMinutes(600)
     , m_keepAliveSeconds(DEFAULT_KEEPALIVE_SECONDS)
+    , m_mqttEventLoopIO(false)
+    , m_loopbackMqttBackend(false)
+    , m_mqttProtocolVersion(AbstractMQTTClientWrapper::MQTT311ProtocolVersion)
     , m_inFlightIntrospectionMessageId(-1)
+    , m_maxInFlightMessages{0, 0, 0}
+    , m_inFlightMessages{0, 0, 0}
+    , m_sendWindowFull(false)
+    , m_heldRetryIdsPruneThreshold(HELD_RETRY_IDS_PRUNE_THRESHOLD)
 {
-    qRegisterMetaType<MQTTClientWrapper::Status>();
+    qRegisterMetaType<AbstractMQTTClientWrapper::Status>();
     connect(this, &AstarteTransport::introspectionChanged, this, [this] {
             publishIntrospection();
             setupClientSubscriptions();
@@ -125,7 +158,112 @@ void AstarteTransport::initImpl()
         m_synced = syncSettings.value(QStringLiteral("isSynced"), false).toBool();
         m_lastSentIntrospection = syncSettings.value(QStringLiteral("lastSentIntrospection"), QByteArray()).toByteArray();
 
+        QString databaseSynchronous = settings.value(QStringLiteral("databaseSynchronous"), QStringLiteral("normal")).toString().toLower();
+        if (databaseSynchronous == QStringLiteral("off")) {
+            TransportDatabaseManager::setSynchronousMode(TransportDatabaseManager::SynchronousMode::Off);
+        } else if (databaseSynchronous == QStringLiteral("full")) {
+            TransportDatabaseManager::setSynchronousMode(TransportDatabaseManager::SynchronousMode::Full);
+        } else if (databaseSynchronous == QStringLiteral("extra")) {
+            TransportDatabaseManager::setSynchronousMode(TransportDatabaseManager::SynchronousMode::Extra);
+        } else {
+            if (databaseSynchronous != QStringLiteral("normal")) {
+                qCWarning(astarteTransportDC) << "Unknown databaseSynchronous value" << databaseSynchronous << ", using normal";
+            }
+            TransportDatabaseManager::setSynchronousMode(TransportDatabaseManager::SynchronousMode::Normal);
+        }
+
+        QString integrityRecovery = settings.value(QStringLiteral("integrityRecovery"), QStringLiteral("rebuild")).toString().toLower();
+        if (integrityRecovery == QStringLiteral("delete")) {
+            TransportDatabaseManager::setIntegrityRecovery(TransportDatabaseManager::IntegrityRecovery::Delete);
+        } else {
+            if (integrityRecovery != QStringLiteral("rebuild")) {
+                qCWarning(astarteTransportDC) << "Unknown integrityRecovery value" << integrityRecovery << ", using rebuild";
+            }
+            TransportDatabaseManager::setIntegrityRecovery(TransportDatabaseManager::IntegrityRecovery::Rebuild);
+        }
+
         AstarteTransportCache::setPersistencyDir(m_persistencyDir);
+        if (settings.contains(QStringLiteral("persistenceFlushIntervalMs"))) {
+            AstarteTransportCache::setPersistenceFlushInterval(settings.value(QStringLiteral("persistenceFlushIntervalMs")).toInt());
+        }
+        if (settings.contains(QStringLiteral("persistenceFlushOperations"))) {
+            AstarteTransportCache::setPersistenceFlushOperations(settings.value(QStringLiteral("persistenceFlushOperations")).toInt());
+        }
+        QString cacheStorage = settings.value(QStringLiteral("cacheStorage"), QStringLiteral("sqlite")).toString().toLower();
+        if (cacheStorage == QStringLiteral("log")) {
+            AstarteTransportCache::setStorageBackend(AstarteTransportCache::StorageBackend::SegmentedLog);
+        } else if (cacheStorage == QStringLiteral("memory")) {
+            AstarteTransportCache::setStorageBackend(AstarteTransportCache::StorageBackend::Memory);
+            AstarteTransportCache::setSnapshotPath(settings.value(QStringLiteral("cacheSnapshotPath")).toString());
+        } else {
+            if (cacheStorage != QStringLiteral("sqlite")) {
+                qCWarning(astarteTransportDC) << "Unknown cacheStorage value" << cacheStorage << ", using sqlite";
+            }
+            AstarteTransportCache::setStorageBackend(AstarteTransportCache::StorageBackend::SQLite);
+        }
+
+        AstarteTransportCache::setStorageQuota(settings.value(QStringLiteral("maxStoredMessages"), 0).toInt(),
+                                               settings.value(QStringLiteral("maxStoredBytes"), 0).toLongLong());
+        QString evictionPolicy = settings.value(QStringLiteral("evictionPolicy"), QStringLiteral("drop-oldest")).toString().toLower();
+        if (evictionPolicy == QStringLiteral("drop-newest")) {
+            AstarteTransportCache::setEvictionPolicy(AstarteTransportCache::EvictionPolicy::DropNewest);
+        } else if (evictionPolicy == QStringLiteral("lowest-priority")) {
+            AstarteTransportCache::setEvictionPolicy(AstarteTransportCache::EvictionPolicy::DropLowestPriority);
+        } else if (evictionPolicy == QStringLiteral("expire-early")) {
+            AstarteTransportCache::setEvictionPolicy(AstarteTransportCache::EvictionPolicy::ExpireEarly);
+        } else {
+            if (evictionPolicy != QStringLiteral("drop-oldest")) {
+                qCWarning(astarteTransportDC) << "Unknown evictionPolicy value" << evictionPolicy << ", using drop-oldest";
+            }
+            AstarteTransportCache::setEvictionPolicy(AstarteTransportCache::EvictionPolicy::DropOldest);
+        }
+        // interfacePriorities=com.example.High:10,com.example.Low:-5
+        QHash<QByteArray, int> interfacePriorities;
+        for (const QString &entry : settings.value(QStringLiteral("interfacePriorities")).toStringList()) {
+            int separator = entry.lastIndexOf(QLatin1Char(':'));
+            bool ok = false;
+            int priority = separator > 0 ? entry.mid(separator + 1).trimmed().toInt(&ok) : 0;
+            if (!ok) {
+                qCWarning(astarteTransportDC) << "Invalid interfacePriorities entry" << entry;
+                continue;
+            }
+            interfacePriorities.insert(entry.left(separator).trimmed().toLatin1(), priority);
+        }
+        AstarteTransportCache::setInterfacePriorities(interfacePriorities);
+
+        AstarteTransportCache::setDurability(parseDurability(settings.value(QStringLiteral("durability"), QStringLiteral("batched")).toString(),
+                                                             AstarteTransportCache::Durability::Batched));
+        // interfaceDurability=com.example.Critical:strict,com.example.Telemetry:volatile
+        QHash<QByteArray, AstarteTransportCache::Durability> interfaceDurabilities;
+        for (const QString &entry : settings.value(QStringLiteral("interfaceDurability")).toStringList()) {
+            int separator = entry.lastIndexOf(QLatin1Char(':'));
+            if (separator <= 0) {
+                qCWarning(astarteTransportDC) << "Invalid interfaceDurability entry" << entry;
+                continue;
+            }
+            interfaceDurabilities.insert(entry.left(separator).trimmed().toLatin1(),
+                                         parseDurability(entry.mid(separator + 1), AstarteTransportCache::Durability::Batched));
+        }
+        AstarteTransportCache::setInterfaceDurabilities(interfaceDurabilities);
+
+        QString cacheCompression = settings.value(QStringLiteral("cacheCompression"), QStringLiteral("none")).toString().toLower();
+        if (cacheCompression == QStringLiteral("zlib")) {
+            AstarteTransportCache::setCompressionLevel(qBound(1, settings.value(QStringLiteral("cacheCompressionLevel"), 6).toInt(), 9));
+        } else {
+            if (cacheCompression != QStringLiteral("none")) {
+                qCWarning(astarteTransportDC) << "Unsupported cacheCompression value" << cacheCompression << ", using none";
+            }
+            AstarteTransportCache::setCompressionLevel(0);
+        }
+        if (settings.contains(QStringLiteral("persistentEntriesCacheSize"))) {
+            AstarteTransportCache::setPersistentEntriesCacheSize(settings.value(QStringLiteral("persistentEntriesCacheSize")).toInt());
+        }
+        AstarteTransportCache::setStatisticsLogInterval(settings.value(QStringLiteral("storageStatsLogIntervalSeconds"), 0).toInt());
+        connect(AstarteTransportCache::instance(), &AstarteTransportCache::storedMessagesReplayed, this, [this] {
+            if (!m_mqttBroker.isNull() && m_mqttBroker->status() == AbstractMQTTClientWrapper::ConnectedStatus) {
+                resendFailedMessages();
+            }
+        });
         connect(AstarteTransportCache::instance()->init(), &Hemera::Operation::finished, this, [this] (Hemera::Operation *op) {
             if (op->isError()) {
                 setInitError(op->errorName(), op->errorMessage());
@@ -157,6 +295,26 @@ void AstarteTransport::initImpl()
         m_rebootTimer->setInterval(randomizedRebootDelayms);
 
         m_keepAliveSeconds = settings.value(QStringLiteral("keepAliveSeconds"), DEFAULT_KEEPALIVE_SECONDS).toInt();
+        m_mqttEventLoopIO = settings.value(QStringLiteral("mqttEventLoopIO"), false).toBool();
+        QString mqttProtocolVersion = settings.value(QStringLiteral("mqttProtocolVersion"), QStringLiteral("3.1.1")).toString();
+        if (mqttProtocolVersion == QStringLiteral("5")) {
+            m_mqttProtocolVersion = AbstractMQTTClientWrapper::MQTT5ProtocolVersion;
+        } else {
+            if (mqttProtocolVersion != QStringLiteral("3.1.1")) {
+                qCWarning(astarteTransportDC) << "Unknown mqttProtocolVersion value" << mqttProtocolVersion << ", using 3.1.1";
+            }
+            m_mqttProtocolVersion = AbstractMQTTClientWrapper::MQTT311ProtocolVersion;
+        }
+        for (int qos = 0; qos < 3; ++qos) {
+            m_maxInFlightMessages[qos] = qMax(0, settings.value(QStringLiteral("maxInFlightMessagesQoS%1").arg(qos), 0).toInt());
+        }
+#ifdef ENABLE_TEST_CODEPATHS
+        QString mqttBackend = settings.value(QStringLiteral("mqttBackend"), QStringLiteral("mosquitto")).toString().toLower();
+        m_loopbackMqttBackend = mqttBackend == QStringLiteral("loopback");
+        if (!m_loopbackMqttBackend && mqttBackend != QStringLiteral("mosquitto")) {
+            qCWarning(astarteTransportDC) << "Unknown mqttBackend value" << mqttBackend << ", using mosquitto";
+        }
+#endif
 
         if (m_rebootWhenConnectionFails) {
             qCDebug(astarteTransportDC) << "Activating the reboot timer with delay " << (randomizedRebootDelayms / (60 * 1000)) << " minutes";
@@ -164,6 +322,13 @@ void AstarteTransport::initImpl()
         }
         connect(m_rebootTimer, &QTimer::timeout, this, &AstarteTransport::handleRebootTimerTimeout);
 
+        if (m_loopbackMqttBackend) {
+            // There is nobody to pair with
+            setOnePartIsReady();
+            settings.endGroup();
+            return;
+        }
+
         connect(m_astarteEndpoint->init(), &Hemera::Operation::finished, this, [this] (Hemera::Operation *op) {
             if (op->isError()) {
                 //TODO: further handling?
@@ -208,7 +373,10 @@ void AstarteTransport::startPairing(bool forcedPairing) {
 void AstarteTransport::setupMqtt()
 {
     // Good. Let's set up our MQTT broker.
-    m_mqttBroker = m_astarteEndpoint->createMqttClientWrapper();
+    m_mqttBroker = createMqttClient();
+    m_subscriptions.clear();
+    // Message ids restart with the new client
+    resetInFlightMessages();
 
     if (m_mqttBroker.isNull()) {
         qCWarning(astarteTransportDC) << "Could not create the MQTT client!!";
@@ -221,15 +389,41 @@ void AstarteTransport::setupMqtt()
         return;
     }
 
+    m_mqttBroker->setProtocolVersion(m_mqttProtocolVersion);
     connect(m_mqttBroker->init(), &Hemera::Operation::finished, this, [this] {
         m_mqttBroker->setKeepAlive(m_keepAliveSeconds);
+        m_mqttBroker->setEventLoopIO(m_mqttEventLoopIO);
+        // Our windows keep mosquitto below its own limit, which is then only a safety net. Without a window
+        // mosquitto keeps its default limit.
+        if (m_maxInFlightMessages[1] > 0 || m_maxInFlightMessages[2] > 0) {
+            m_mqttBroker->setMaxInFlightMessages(m_maxInFlightMessages[1] + m_maxInFlightMessages[2]);
+        }
         m_mqttBroker->connectToBroker();
     });
-    connect(m_mqttBroker, &MQTTClientWrapper::statusChanged, this, &AstarteTransport::onStatusChanged);
-    connect(m_mqttBroker, &MQTTClientWrapper::messageReceived, this, &AstarteTransport::onMQTTMessageReceived);
-    connect(m_mqttBroker, &MQTTClientWrapper::publishConfirmed, this, &AstarteTransport::onPublishConfirmed);
-    connect(m_mqttBroker, &MQTTClientWrapper::connackTimeout, this, &AstarteTransport::handleConnackTimeout);
-    connect(m_mqttBroker, &MQTTClientWrapper::connectionFailed, this, &AstarteTransport::handleConnectionFailed);
+    connect(m_mqttBroker, &AbstractMQTTClientWrapper::statusChanged, this, &AstarteTransport::onStatusChanged);
+    connect(m_mqttBroker, &AbstractMQTTClientWrapper::messageReceived, this, &AstarteTransport::onMQTTMessageReceived);
+    connect(m_mqttBroker, &AbstractMQTTClientWrapper::publishesConfirmed, this, &AstarteTransport::onPublishesConfirmed);
+    connect(m_mqttBroker, &AbstractMQTTClientWrapper::connackTimeout, this, &AstarteTransport::handleConnackTimeout);
+    connect(m_mqttBroker, &AbstractMQTTClientWrapper::connectionFailed, this, &AstarteTransport::handleConnectionFailed);
+}
+
+AbstractMQTTClientWrapper *AstarteTransport::createMqttClient()
+{
+#ifdef ENABLE_TEST_CODEPATHS
+    if (m_loopbackMqttBackend) {
+        QSettings settings(m_configurationPath, QSettings::IniFormat);
+        settings.beginGroup(QStringLiteral("AstarteTransport"));
+        QByteArray clientId = settings.value(QStringLiteral("loopbackClientId"), QStringLiteral("loopback/device")).toString().toLatin1();
+        LoopbackMQTTClientWrapper *c = new LoopbackMQTTClientWrapper(clientId, this);
+        c->setLatency(settings.value(QStringLiteral("loopbackLatencyMs"), 0).toInt());
+        c->setLossRate(settings.value(QStringLiteral("loopbackLossRate"), 0).toDouble());
+        c->setDisconnectInterval(settings.value(QStringLiteral("loopbackDisconnectIntervalMs"), 0).toInt());
+        c->setSeed(settings.value(QStringLiteral("loopbackSeed"), 1).toUInt());
+        return c;
+    }
+#endif
+
+    return m_astarteEndpoint->createMqttClientWrapper();
 }
 
 void AstarteTransport::onMQTTMessageReceived(const QByteArray& topic, const QByteArray& payload)
@@ -240,17 +434,27 @@ void AstarteTransport::onMQTTMessageReceived(const QByteArray& topic, const QByt
         return;
     }
 
-    QByteArray relativeTopic = topic;
-    relativeTopic.remove(0, m_mqttBroker->rootClientTopic().length());
+    // The topic is /interface/path past the root: both are sliced out by offset, without copying the whole topic.
+    // Received waves are not kept for rebounds, which are not handled: that would pin every received payload.
+    int interfaceOffset = m_mqttBroker->rootClientTopic().length() + 1;
+    int pathOffset = topic.indexOf('/', interfaceOffset);
+    if (pathOffset < 0) {
+        qCWarning(astarteTransportDC) << "Received MQTT message on topic" << topic << ", which has no path!";
+        return;
+    }
+
+    QByteArray interface = topic.mid(interfaceOffset, pathOffset - interfaceOffset);
+    if (interface == "control") {
+        qCDebug(astarteTransportDC) << "Received control wave, not implemented in SDK";
+        return;
+    }
 
-    // Prepare a write wave
     Hyperspace::Wave w;
-    w.setMethod(METHOD_WRITE);
-    w.setTarget(relativeTopic);
+    w.setTarget(topic.mid(pathOffset));
+    // Shared with the receive buffer, not copied
     w.setPayload(payload);
-    m_waveStorage.insert(w.id(), w);
-    qCDebug(astarteTransportDC) << "Sending wave" << w.method() << w.target();
-    routeWave(w, -1);
+    qCDebug(astarteTransportDC) << "Sending wave for" << interface << w.target();
+    Q_EMIT waveReceived(interface, w);
 }
 
 void AstarteTransport::setupClientSubscriptions()
@@ -259,42 +463,63 @@ void AstarteTransport::setupClientSubscriptions()
         qCWarning(astarteTransportDC) << "Can't publish subscriptions, broker is null";
         return;
     }
+    QSet< QByteArray > subscriptions;
     // Setup subscriptions to control interface
-    m_mqttBroker->subscribe(m_mqttBroker->rootClientTopic() + "/control/consumer/properties", MQTTClientWrapper::ExactlyOnceQoS);
+    subscriptions.insert(m_mqttBroker->rootClientTopic() + "/control/consumer/properties");
     // Setup subscriptions to interfaces where we can receive data
     for (QHash< QByteArray, Hyperdrive::Interface >::const_iterator i = introspection().constBegin(); i != introspection().constEnd(); ++i) {
         if (i.value().interfaceQuality() == Interface::Quality::Consumer) {
             // Subscribe to the interface properties
-            m_mqttBroker->subscribe(m_mqttBroker->rootClientTopic() + "/" + i.value().interface() + "/#", MQTTClientWrapper::ExactlyOnceQoS);
+            subscriptions.insert(m_mqttBroker->rootClientTopic() + "/" + i.value().interface() + "/#");
+        }
+    }
+
+    // Only the difference with what the session already has, each in a single packet
+    QList< QByteArray > removed = (m_subscriptions - subscriptions).values();
+    if (!removed.isEmpty()) {
+        if (m_mqttBroker->unsubscribe(removed)) {
+            for (const QByteArray &topic : removed) {
+                m_subscriptions.remove(topic);
+            }
+        }
+    }
+
+    QList< QByteArray > added = (subscriptions - m_subscriptions).values();
+    if (!added.isEmpty()) {
+        qCDebug(astarteTransportDC) << "Subscribing to" << added.size() << "topics";
+        if (m_mqttBroker->subscribe(added, AbstractMQTTClientWrapper::ExactlyOnceQoS)) {
+            for (const QByteArray &topic : added) {
+                m_subscriptions.insert(topic);
+            }
         }
     }
 }
 
 void AstarteTransport::sendProperties()
 {
-    for (QHash< QByteArray, QByteArray >::const_iterator i = AstarteTransportCache::instance()->allPersistentEntries().constBegin();
-         i != AstarteTransportCache::instance()->allPersistentEntries().constEnd();
-         ++i) {
-
-        // Recreate the cacheMessage
-        CacheMessage c;
-        c.setTarget(i.key());
-        c.setPayload(i.value());
-        c.setInterfaceType(Hyperdrive::Interface::Type::Properties);
-
-        if (m_mqttBroker.isNull()) {
-            handleFailedPublish(c);
-            continue;
+    // Streamed from the storage a page at a time
+    QByteArray targetCursor;
+    Q_FOREVER {
+        QList< QPair< QByteArray, QByteArray > > page = AstarteTransportCache::instance()->persistentEntriesPage(targetCursor, PROPERTIES_PAGE_SIZE);
+        if (page.isEmpty()) {
+            break;
         }
+        targetCursor = page.last().first;
+
+        for (const QPair< QByteArray, QByteArray > &entry : page) {
+            // Recreate the cacheMessage
+            CacheMessage c;
+            c.setTarget(entry.first);
+            c.setPayload(entry.second);
+            c.setInterfaceType(Hyperdrive::Interface::Type::Properties);
+
+            if (m_mqttBroker.isNull()) {
+                handleFailedPublish(c);
+                continue;
+            }
 
-        int rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic() + i.key(), i.value(), MQTTClientWrapper::ExactlyOnceQoS);
-        if (rc < 0) {
-            // If it's < 0, it's an error
-            handleFailedPublish(c);
-        } else {
-            // Otherwise, it's the messageId
-            qCInfo(astarteTransportDC) << "Inserting in-flight message id " << rc;
-            AstarteTransportCache::instance()->addInFlightEntry(rc, c);
+            // Part of the synchronization, it is not held by the window but it is accounted
+            publishCacheMessage(c, AbstractMQTTClientWrapper::ExactlyOnceQoS);
         }
     }
 }
@@ -303,10 +528,25 @@ void AstarteTransport::resendFailedMessages()
 {
     QList<int> ids = AstarteTransportCache::instance()->allRetryIds();
     for (int id: ids) {
+        if (m_heldRetryIds.contains(id)) {
+            // Already waiting for its window
+            continue;
+        }
+
+        int qos = m_mqttBroker.isNull() ? -1 : publishQoS(AstarteTransportCache::instance()->retryEntry(id));
+        if (qos >= 0 && (!m_sendQueues[qos].isEmpty() || !hasSendWindow(qos))) {
+            // Left in the retry entries instead of taking it just to store it again
+            holdRetryEntry(id, qos);
+            continue;
+        }
+
         CacheMessage failedMessage = AstarteTransportCache::instance()->takeRetryEntry(id);
         // Call cache message function with the failed message
         cacheMessage(failedMessage);
     }
+
+    // Pull in the next page of messages stored by a previous run, if any
+    AstarteTransportCache::instance()->replayStoredMessages();
 }
 
 void AstarteTransport::rebound(const Hyperspace::Rebound& r, int fd)
@@ -356,46 +596,97 @@ void AstarteTransport::cacheMessage(const CacheMessage &cacheMessage)
         return;
     }
 
-    int rc;
+    if (cacheMessage.interfaceType() == Hyperdrive::Interface::Type::Properties
+        && AstarteTransportCache::instance()->isPersistentEntryUnchanged(cacheMessage.target(), cacheMessage.payload())) {
 
-    switch (cacheMessage.interfaceType()) {
-        case Hyperdrive::Interface::Type::Properties: {
-            if (AstarteTransportCache::instance()->isCached(cacheMessage.target())
-                    && AstarteTransportCache::instance()->persistentEntry(cacheMessage.target()) == cacheMessage.payload()) {
+        qCDebug(astarteTransportDC) << cacheMessage.target() << "is not changed, not publishing it again";
+        // We consider it delivered, so remove it from the DB
+        AstarteTransportCache::instance()->removeFromDatabase(cacheMessage);
+        return;
+    }
 
-                qCDebug(astarteTransportDC) << cacheMessage.target() << "is not changed, not publishing it again";
-                // We consider it delivered, so remove it from the DB
-                AstarteTransportCache::instance()->removeFromDatabase(cacheMessage);
-                return;
-            }
+    int qos = publishQoS(cacheMessage);
+    if (qos < 0) {
+        qCDebug(astarteTransportDC) << "Unsupported interfaceType";
+        return;
+    }
 
-            rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic() + cacheMessage.target(), cacheMessage.payload(), MQTTClientWrapper::ExactlyOnceQoS);
-            break;
-        }
+    // Held messages go first, to keep the order within a QoS
+    if (!m_sendQueues[qos].isEmpty() || !hasSendWindow(qos)) {
+        holdCacheMessage(cacheMessage, qos);
+        return;
+    }
+
+    publishCacheMessage(cacheMessage, qos);
+}
+
+void AstarteTransport::holdCacheMessage(const CacheMessage &cacheMessage, int qos)
+{
+    if (cacheMessage.attributes().value("retention").toInt() == static_cast<int>(Hyperspace::Retention::Discard)) {
+        // Not worth storing, it fails as if the transport was disconnected
+        qCDebug(astarteTransportDC) << "QoS" << qos << "in-flight window is full, discarding message for" << cacheMessage.target();
+        handleFailedPublish(cacheMessage);
+        m_sendWindowFull = true;
+        return;
+    }
+
+    // Stored with its durability before it is held, the quota might evict it right away
+    int id = AstarteTransportCache::instance()->addRetryEntry(cacheMessage);
+    if (id < 0) {
+        qCWarning(astarteTransportDC) << "QoS" << qos << "in-flight window is full and the store is full, dropping message for"
+                                      << cacheMessage.target();
+        m_sendWindowFull = true;
+        return;
+    }
+
+    qCDebug(astarteTransportDC) << "QoS" << qos << "in-flight window is full, holding message for" << cacheMessage.target();
+    holdRetryEntry(id, qos);
+}
+
+void AstarteTransport::holdRetryEntry(int id, int qos)
+{
+    if (m_heldRetryIds.count() >= m_heldRetryIdsPruneThreshold) {
+        pruneSendQueues();
+    }
+
+    m_sendQueues[qos].enqueue(id);
+    m_heldRetryIds.insert(id);
+    m_sendWindowFull = true;
+}
+
+int AstarteTransport::publishQoS(const CacheMessage &cacheMessage) const
+{
+    switch (cacheMessage.interfaceType()) {
+        case Hyperdrive::Interface::Type::Properties:
+            return AbstractMQTTClientWrapper::ExactlyOnceQoS;
 
         case Hyperdrive::Interface::Type::DataStream: {
             Hyperspace::Reliability reliability = static_cast<Hyperspace::Reliability>(cacheMessage.attributes().value("reliability").toInt());
             switch (reliability) {
                 case (Hyperspace::Reliability::Guaranteed):
-                    rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic() + cacheMessage.target(), cacheMessage.payload(), MQTTClientWrapper::AtLeastOnceQoS);
-                    break;
+                    return AbstractMQTTClientWrapper::AtLeastOnceQoS;
                 case (Hyperspace::Reliability::Unique):
-                    rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic() + cacheMessage.target(), cacheMessage.payload(), MQTTClientWrapper::ExactlyOnceQoS);
-                    break;
+                    return AbstractMQTTClientWrapper::ExactlyOnceQoS;
                 default:
                     // Default Unreliable
-                    rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic() + cacheMessage.target(), cacheMessage.payload(), MQTTClientWrapper::AtMostOnceQoS);
-                    break;
+                    return AbstractMQTTClientWrapper::AtMostOnceQoS;
             }
-            break;
         }
 
-        default: {
-            qCDebug(astarteTransportDC) << "Unsupported interfaceType";
-            break;
-        }
+        default:
+            return -1;
     }
+}
+
+bool AstarteTransport::hasSendWindow(int qos) const
+{
+    return m_maxInFlightMessages[qos] == 0 || m_inFlightMessages[qos] < m_maxInFlightMessages[qos];
+}
 
+void AstarteTransport::publishCacheMessage(const CacheMessage &cacheMessage, int qos)
+{
+    int rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic() + cacheMessage.target(), cacheMessage.payload(),
+                                   static_cast<AbstractMQTTClientWrapper::MQTTQoS>(qos));
     if (rc < 0) {
         // If it's < 0, it's an error
         handleFailedPublish(cacheMessage);
@@ -403,7 +694,53 @@ void AstarteTransport::cacheMessage(const CacheMessage &cacheMessage)
         // Otherwise, it's the messageId
         qCInfo(astarteTransportDC) << "Inserting in-flight message id " << rc;
         AstarteTransportCache::instance()->addInFlightEntry(rc, cacheMessage);
+        // mosquitto confirms QoS 0 messages too, once they are written
+        m_inFlightMessageQoS.insert(rc, qos);
+        ++m_inFlightMessages[qos];
+    }
+}
+
+void AstarteTransport::drainSendQueues()
+{
+    for (int qos = 0; qos < 3; ++qos) {
+        while (!m_sendQueues[qos].isEmpty() && (m_mqttBroker.isNull() || hasSendWindow(qos))) {
+            int id = m_sendQueues[qos].dequeue();
+            m_heldRetryIds.remove(id);
+            // Without a broker it just stays a retry entry. It might also have been evicted or expired meanwhile
+            if (m_mqttBroker.isNull() || !AstarteTransportCache::instance()->hasRetryEntry(id)) {
+                continue;
+            }
+            publishCacheMessage(AstarteTransportCache::instance()->takeRetryEntry(id), qos);
+        }
+    }
+
+    if (m_sendWindowFull && canSend()) {
+        m_sendWindowFull = false;
+        Q_EMIT sendWindowAvailable();
+    }
+}
+
+void AstarteTransport::pruneSendQueues()
+{
+    // Evicted and expired entries are otherwise only skipped once they are dequeued
+    for (int qos = 0; qos < 3; ++qos) {
+        QQueue< int > liveIds;
+        for (int id : m_sendQueues[qos]) {
+            if (AstarteTransportCache::instance()->hasRetryEntry(id)) {
+                liveIds.enqueue(id);
+            } else {
+                m_heldRetryIds.remove(id);
+            }
+        }
+        m_sendQueues[qos].swap(liveIds);
     }
+
+    m_heldRetryIdsPruneThreshold = qMax(HELD_RETRY_IDS_PRUNE_THRESHOLD, 2 * m_heldRetryIds.count());
+}
+
+bool AstarteTransport::canSend() const
+{
+    return m_sendQueues[0].isEmpty() && m_sendQueues[1].isEmpty() && m_sendQueues[2].isEmpty();
 }
 
 void AstarteTransport::forceNewPairing()
@@ -416,17 +753,57 @@ void AstarteTransport::forceNewPairing()
         m_mqttBroker->deleteLater();
     }
     // Reset the cache
-    AstarteTransportCache::instance()->resetInFlightEntries();
+    resetInFlightMessages();
 
     startPairing(true);
 }
 
-void AstarteTransport::onStatusChanged(MQTTClientWrapper::Status status)
+void AstarteTransport::resetInFlightMessages()
+{
+    // They will never be confirmed, they are published again from the retry entries
+    AstarteTransportCache::instance()->resetInFlightEntries();
+    m_inFlightMessageQoS.clear();
+    for (int qos = 0; qos < 3; ++qos) {
+        m_inFlightMessages[qos] = 0;
+    }
+    m_inFlightIntrospectionMessageId = -1;
+
+    if (m_sendWindowFull && canSend()) {
+        m_sendWindowFull = false;
+        Q_EMIT sendWindowAvailable();
+    }
+}
+
+void AstarteTransport::resetInFlightQoS0Messages()
+{
+    // mosquitto resends QoS 1 and 2 messages on a resumed session, but QoS 0 ones are lost with the connection
+    QVector< int > messageIds;
+    for (QHash< int, int >::iterator it = m_inFlightMessageQoS.begin(); it != m_inFlightMessageQoS.end();) {
+        if (it.value() == AbstractMQTTClientWrapper::AtMostOnceQoS) {
+            messageIds.append(it.key());
+            it = m_inFlightMessageQoS.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    AstarteTransportCache::instance()->resetInFlightEntries(messageIds);
+    m_inFlightMessages[AbstractMQTTClientWrapper::AtMostOnceQoS] = 0;
+}
+
+void AstarteTransport::onStatusChanged(AbstractMQTTClientWrapper::Status status)
 {
-    if (status == MQTTClientWrapper::ConnectedStatus) {
+    if (status == AbstractMQTTClientWrapper::ConnectedStatus) {
         // We're connected, stop the reboot timer
         qCDebug(astarteTransportDC) << "Connected, stopping the reboot timer";
         m_rebootTimer->stop();
+        if (m_mqttBroker->sessionPresent()) {
+            resetInFlightQoS0Messages();
+        } else {
+            // Clean session, the broker knows nothing of what was in flight
+            resetInFlightMessages();
+        }
+        // Startup is over, the full check of the storage can run alongside the connection
+        AstarteTransportCache::instance()->checkStorageIntegrity();
         if (!m_mqttBroker->sessionPresent() || !m_synced) {
             // We're desynced
             bigBang();
@@ -438,6 +815,7 @@ void AstarteTransport::onStatusChanged(MQTTClientWrapper::Status status)
 
         // Resend the messages that failed to be published
         resendFailedMessages();
+        drainSendQueues();
     } else {
         // If we are in every other state, we start the reboot timer (if needed)
         if (m_rebootWhenConnectionFails && !m_rebootTimer->isActive()) {
@@ -462,7 +840,7 @@ void AstarteTransport::handleConnectionFailed()
 {
     int retryInterval = Hyperdrive::Utils::randomizedInterval(CONNECTION_RETRY_INTERVAL, 1.0);
     qCInfo(astarteTransportDC) << "Connection failed, trying to reconnect to the broker in " << (retryInterval / 1000) << " seconds";
-    QTimer::singleShot(retryInterval, m_mqttBroker, &MQTTClientWrapper::connectToBroker);
+    QTimer::singleShot(retryInterval, m_mqttBroker, &AbstractMQTTClientWrapper::connectToBroker);
 }
 
 void AstarteTransport::handleConnackTimeout()
@@ -515,11 +893,12 @@ void AstarteTransport::bigBang()
     }
 
     // We need to setup again the subscriptions, unless we have a persistent session on the other end.
+    m_subscriptions.clear();
     setupClientSubscriptions();
     // And publish the introspection.
     publishIntrospection();
 
-    int rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic() + "/control/emptyCache", "1", MQTTClientWrapper::ExactlyOnceQoS);
+    int rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic() + "/control/emptyCache", "1", AbstractMQTTClientWrapper::ExactlyOnceQoS);
     if (rc < 0) {
         // We leave m_synced to false and we retry when we're back online
         qCWarning(astarteTransportDC) << "Can't send emptyCache request, error " << rc;
@@ -527,7 +906,7 @@ void AstarteTransport::bigBang()
     }
 
     QByteArray payload;
-    for (const QByteArray &path : AstarteTransportCache::instance()->allPersistentEntries().keys()) {
+    for (const QByteArray &path : AstarteTransportCache::instance()->persistentEntryTargets()) {
         // Remove leading slash
         payload.append(path.mid(1));
         payload.append(';');
@@ -537,7 +916,7 @@ void AstarteTransport::bigBang()
 
     qCDebug(astarteTransportDC) << "Producer property paths are: " << payload;
 
-    rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic() + "/control/producer/properties", qCompress(payload), MQTTClientWrapper::ExactlyOnceQoS);
+    rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic() + "/control/producer/properties", qCompress(payload), AbstractMQTTClientWrapper::ExactlyOnceQoS);
     if (rc < 0) {
         // We leave m_synced to false and we retry when we're back online
         qCWarning(astarteTransportDC) << "Can't send producer properties list, error " << rc;
@@ -552,25 +931,40 @@ void AstarteTransport::bigBang()
     syncSettings.setValue(QStringLiteral("isSynced"), true);
 }
 
-void AstarteTransport::onPublishConfirmed(int messageId)
+void AstarteTransport::onPublishesConfirmed(const QVector<int> &messageIds)
 {
-    qCInfo(astarteTransportDC) << "Message with id" << messageId << ": publish confirmed";
-    CacheMessage cacheMessage = AstarteTransportCache::instance()->takeInFlightEntry(messageId);
+    qCInfo(astarteTransportDC) << messageIds.size() << "publishes confirmed, last message id" << messageIds.last();
+    QList< CacheMessage > cacheMessages = AstarteTransportCache::instance()->takeInFlightEntries(messageIds);
 
-    if (cacheMessage.interfaceType() == Hyperdrive::Interface::Type::Properties) {
-        if (cacheMessage.payload().isEmpty()) {
-            AstarteTransportCache::instance()->removePersistentEntry(cacheMessage.target());
-        } else {
-            AstarteTransportCache::instance()->insertOrUpdatePersistentEntry(cacheMessage.target(), cacheMessage.payload());
+    for (int i = 0; i < messageIds.size(); ++i) {
+        int messageId = messageIds.at(i);
+        const CacheMessage &cacheMessage = cacheMessages.at(i);
+
+        QHash< int, int >::iterator qosIt = m_inFlightMessageQoS.find(messageId);
+        if (qosIt != m_inFlightMessageQoS.end()) {
+            --m_inFlightMessages[qosIt.value()];
+            m_inFlightMessageQoS.erase(qosIt);
         }
-    } else if (messageId == m_inFlightIntrospectionMessageId) {
-        m_inFlightIntrospectionMessageId = -1;
-        m_lastSentIntrospection = m_inFlightIntrospection;
-        m_inFlightIntrospection = QByteArray();
 
-        QSettings syncSettings(QStringLiteral("%1/transportStatus.conf").arg(m_persistencyDir), QSettings::IniFormat);
-        syncSettings.setValue(QStringLiteral("lastSentIntrospection"), m_lastSentIntrospection);
+        if (cacheMessage.interfaceType() == Hyperdrive::Interface::Type::Properties) {
+            if (cacheMessage.payload().isEmpty()) {
+                AstarteTransportCache::instance()->removePersistentEntry(cacheMessage.target());
+            } else {
+                AstarteTransportCache::instance()->insertOrUpdatePersistentEntry(cacheMessage.target(), cacheMessage.payload());
+            }
+        } else if (messageId == m_inFlightIntrospectionMessageId) {
+            m_inFlightIntrospectionMessageId = -1;
+            m_lastSentIntrospection = m_inFlightIntrospection;
+            m_inFlightIntrospection = QByteArray();
+
+            QSettings syncSettings(QStringLiteral("%1/transportStatus.conf").arg(m_persistencyDir), QSettings::IniFormat);
+            syncSettings.setValue(QStringLiteral("lastSentIntrospection"), m_lastSentIntrospection);
+        }
     }
+
+    // An in-flight slot is free, publish what was held and keep replaying stored messages
+    drainSendQueues();
+    AstarteTransportCache::instance()->replayStoredMessages();
 }
 
 QByteArray AstarteTransport::introspectionString() const
@@ -609,7 +1003,7 @@ void AstarteTransport::publishIntrospection()
     QByteArray introspectionPayload = introspectionString();
     qCDebug(astarteTransportDC) << "Introspection is " << introspectionPayload;
 
-    int rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic(), introspectionPayload, Hyperdrive::MQTTClientWrapper::ExactlyOnceQoS);
+    int rc = m_mqttBroker->publish(m_mqttBroker->rootClientTopic(), introspectionPayload, Hyperdrive::AbstractMQTTClientWrapper::ExactlyOnceQoS);
     if (rc < 0) {
         qCWarning(astarteTransportDC) << "Can't send introspection, error " << rc;
     } else {
@@ -669,7 +1063,9 @@ bool AstarteTransport::disconnectFromBroker()
     return false;
   }
 
-  return m_mqttBroker->disconnectFromBroker();
+  bool disconnected = m_mqttBroker->disconnectFromBroker();
+  resetInFlightMessages();
+  return disconnected;
 }
 
 }
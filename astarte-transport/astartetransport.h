@@ -19,11 +19,13 @@
 #ifndef HYPERDRIVE_ASTARTETRANSPORT_H
 #define HYPERDRIVE_ASTARTETRANSPORT_H
 
-#include <hyperdrivemqttclientwrapper.h>
+#include <cachemessage.h>
+#include <hyperdriveabstractmqttclientwrapper.h>
 
 #include <HemeraCore/AsyncInitObject>
 
 #include <QtCore/QPointer>
+#include <QtCore/QQueue>
 #include <QtCore/QSet>
 
 class QTimer;
@@ -39,7 +41,7 @@ class Wave;
 }
 
 namespace Hyperdrive {
-class MQTTClientWrapper;
+class AbstractMQTTClientWrapper;
 class CacheMessage;
 class Interface;
 
@@ -49,12 +51,12 @@ class AstarteTransport : public Hemera::AsyncInitObject
 
 public:
     enum ConnectionStatus {
-        UnknownStatus = MQTTClientWrapper::UnknownStatus,
-        DisconnectedStatus = MQTTClientWrapper::DisconnectedStatus,
-        ConnectedStatus = MQTTClientWrapper::ConnectedStatus,
-        ConnectingStatus = MQTTClientWrapper::ConnectingStatus,
-        DisconnectingStatus = MQTTClientWrapper::DisconnectingStatus,
-        ReconnectingStatus = MQTTClientWrapper::ReconnectingStatus
+        UnknownStatus = AbstractMQTTClientWrapper::UnknownStatus,
+        DisconnectedStatus = AbstractMQTTClientWrapper::DisconnectedStatus,
+        ConnectedStatus = AbstractMQTTClientWrapper::ConnectedStatus,
+        ConnectingStatus = AbstractMQTTClientWrapper::ConnectingStatus,
+        DisconnectingStatus = AbstractMQTTClientWrapper::DisconnectingStatus,
+        ReconnectingStatus = AbstractMQTTClientWrapper::ReconnectingStatus
     };
     Q_ENUM(Hyperdrive::AstarteTransport::ConnectionStatus)
 
@@ -74,10 +76,15 @@ public:
     bool connectToBroker();
     bool disconnectFromBroker();
 
+    // False while messages are held because their QoS in-flight window is full
+    bool canSend() const;
+
 Q_SIGNALS:
     void introspectionChanged();
     void connectionStatusChanged();
     void waveReceived(const QByteArray &interface, const Hyperspace::Wave &wave);
+    // Every held message has been published, canSend is true again
+    void sendWindowAvailable();
 
 protected:
     virtual void initImpl();
@@ -91,9 +98,9 @@ private Q_SLOTS:
     void sendProperties();
     void resendFailedMessages();
     void publishIntrospection();
-    void onStatusChanged(MQTTClientWrapper::Status status);
+    void onStatusChanged(AbstractMQTTClientWrapper::Status status);
     void onMQTTMessageReceived(const QByteArray &topic, const QByteArray &payload);
-    void onPublishConfirmed(int messageId);
+    void onPublishesConfirmed(const QVector<int> &messageIds);
     void handleFailedPublish(const CacheMessage &cacheMessage);
     void handleConnectionFailed();
     void handleConnackTimeout();
@@ -102,11 +109,24 @@ private Q_SLOTS:
 
 private:
     QByteArray introspectionString() const;
+    AbstractMQTTClientWrapper *createMqttClient();
+
+    int publishQoS(const CacheMessage &cacheMessage) const;
+    bool hasSendWindow(int qos) const;
+    void publishCacheMessage(const CacheMessage &cacheMessage, int qos);
+    void holdCacheMessage(const CacheMessage &cacheMessage, int qos);
+    void holdRetryEntry(int id, int qos);
+    void pruneSendQueues();
+    void drainSendQueues();
+    void resetInFlightMessages();
+    void resetInFlightQoS0Messages();
 
     Astarte::Endpoint *m_astarteEndpoint;
-    QPointer<MQTTClientWrapper> m_mqttBroker;
+    QPointer<AbstractMQTTClientWrapper> m_mqttBroker;
     QHash< quint64, Hyperspace::Wave > m_waveStorage;
     QHash< quint64, QByteArray > m_commandTree;
+    // Topics the broker session is known to be subscribed to
+    QSet< QByteArray > m_subscriptions;
     QHash< QByteArray, Hyperdrive::Interface > m_introspection;
     QString m_configurationPath;
     QString m_persistencyDir;
@@ -117,7 +137,22 @@ private:
     bool m_rebootWhenConnectionFails;
     int m_rebootDelayMinutes;
     int m_keepAliveSeconds;
+    bool m_mqttEventLoopIO;
+    // The in-process broker replaces the endpoint, test codepaths only
+    bool m_loopbackMqttBackend;
+    AbstractMQTTClientWrapper::MQTTProtocolVersion m_mqttProtocolVersion;
     int m_inFlightIntrospectionMessageId;
+
+    // Per QoS in-flight windows, a limit of 0 disables the window
+    int m_maxInFlightMessages[3];
+    int m_inFlightMessages[3];
+    QHash< int, int > m_inFlightMessageQoS;
+    // Retry entry ids of the messages held by a full window, in publish order. Held messages stay retry entries,
+    // so they are stored, bounded by the quota and counted by the replay like any other message waiting to be sent.
+    QQueue< int > m_sendQueues[3];
+    QSet< int > m_heldRetryIds;
+    int m_heldRetryIdsPruneThreshold;
+    bool m_sendWindowFull;
 };
 }
 
@@ -19,9 +19,24 @@
 
 #include "astartetransportcache.h"
 
+#include "astartepersistenceworker.h"
+#include "memorycachestorage.h"
+#include "segmentedlogcachestorage.h"
+#include "sqlitecachestorage.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <QtCore/QCache>
+#include <QtCore/QCoreApplication>
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
-#include <QtCore/QTimerEvent>
+#include <QtCore/QFile>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMap>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
 
 #include <hyperdriveconfig.h>
 #include <hyperdriveinterface.h>
@@ -31,30 +46,160 @@
 
 #include <HyperspaceProducerConsumer/ProducerAbstractInterface>
 
+#define DEFAULT_PERSISTENCE_FLUSH_INTERVAL_MS 100
+#define DEFAULT_PERSISTENCE_FLUSH_OPERATIONS 50
+
+#define REPLAY_PAGE_SIZE 100
+
+#define DEFAULT_PERSISTENT_ENTRIES_CACHE_SIZE (1024 * 1024)
+#define PERSISTENT_ENTRIES_PAGE_SIZE 500
+
+// Expiries are serviced in batches, at most this late
+#define EXPIRY_TIMER_GRANULARITY_MS 1000
+
+Q_LOGGING_CATEGORY(astarteTransportCacheDC, "hyperdrive.transport.astarte.cache", DEBUG_MESSAGES_DEFAULT_LEVEL)
+
+// Eviction order of a retry entry: entries are evicted from the smallest key
+typedef QPair< qint64, int > EvictionKey;
+
 class AstarteTransportCache::Private
 {
 public:
-    QHash< QByteArray, QByteArray > persistentEntries;
+    // Every persistent entry is known by the hash of its payload, only the recently used payloads are kept
+    QHash< QByteArray, quint64 > persistentEntryHashes;
+    mutable QCache< QByteArray, QByteArray > persistentEntryPayloads;
     QHash< int, Hyperdrive::CacheMessage> inFlightEntries;
     QHash< int, Hyperdrive::CacheMessage > retryEntries;
-    QHash< int, int > retryTimerToId;
+    // Absolute expiry in msecs of the retry entries which expire, ordered by (expiry, retry id)
+    QMap< QPair< qint64, int >, int > expiryQueue;
+    QHash< int, qint64 > retryExpiries;
+    QTimer *expiryTimer;
+    qint64 expiryTimerDeadline;
     int retryIdCounter;
+    int nextDbId;
+
+    // Quota accounting of the retry entries, kept up to date on every change
+    QMap< EvictionKey, int > evictionIndex;
+    QHash< int, EvictionKey > retryEvictionKeys;
+    qint64 storedBytes;
+    // Stored messages under quota which the replay has not loaded yet
+    int unloadedMessages;
+    qint64 unloadedBytes;
+    quint64 evictedMessages;
+    quint64 evictedBytes;
+
+    // Storage statistics, as of the previous log line
+    QTimer *statisticsTimer;
+    quint64 logicalBytesStored;
+    quint64 lastLoggedLogicalBytes;
+    qint64 lastLoggedDeviceBytes;
+    Hyperdrive::TransportDatabaseManager::Statistics lastLoggedStatistics;
+
+    // Replay of the messages stored by a previous run, by storage id
+    int replayCursor;
+    int replayEndId;
+    bool replayRequested;
+    bool integrityCheckStarted;
+
+    QThread *persistenceThread;
+    AstartePersistenceWorker *persistenceWorker;
 
     Private()
     {
         retryIdCounter = 0;
+        nextDbId = 1;
+        storedBytes = 0;
+        unloadedMessages = 0;
+        unloadedBytes = 0;
+        evictedMessages = 0;
+        evictedBytes = 0;
+        statisticsTimer = nullptr;
+        logicalBytesStored = 0;
+        lastLoggedLogicalBytes = 0;
+        lastLoggedDeviceBytes = -1;
+        replayCursor = 0;
+        replayEndId = 0;
+        replayRequested = false;
+        expiryTimer = nullptr;
+        expiryTimerDeadline = 0;
+        integrityCheckStarted = false;
+        persistenceThread = nullptr;
+        persistenceWorker = nullptr;
     }
 };
 
 static AstarteTransportCache* s_instance;
 
 static QString s_persistencyDir;
+static int s_persistenceFlushIntervalMs = DEFAULT_PERSISTENCE_FLUSH_INTERVAL_MS;
+static int s_persistenceFlushOperations = DEFAULT_PERSISTENCE_FLUSH_OPERATIONS;
+static AstarteTransportCache::StorageBackend s_storageBackend = AstarteTransportCache::StorageBackend::SQLite;
+static QString s_snapshotPath;
+static int s_maxStoredMessages = 0;
+static qint64 s_maxStoredBytes = 0;
+static AstarteTransportCache::EvictionPolicy s_evictionPolicy = AstarteTransportCache::EvictionPolicy::DropOldest;
+static QHash< QByteArray, int > s_interfacePriorities;
+static AstarteTransportCache::Durability s_durability = AstarteTransportCache::Durability::Batched;
+static QHash< QByteArray, AstarteTransportCache::Durability > s_interfaceDurabilities;
+static int s_compressionLevel = 0;
+static int s_statisticsLogIntervalSeconds = 0;
+static int s_persistentEntriesCacheSize = DEFAULT_PERSISTENT_ENTRIES_CACHE_SIZE;
+
+static bool isEvictable(const Hyperdrive::CacheMessage &message)
+{
+    // Properties are bounded by the number of paths and they are resent anyway on a new session
+    return message.interfaceType() != Hyperdrive::Interface::Type::Properties;
+}
+
+static qint64 messageSize(const Hyperdrive::CacheMessage &message)
+{
+    return message.target().size() + message.payload().size();
+}
+
+// Bytes this process caused to be written to the block device, -1 where it is not known
+static qint64 deviceWriteBytes()
+{
+#ifdef Q_OS_LINUX
+    QFile io(QStringLiteral("/proc/self/io"));
+    if (!io.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+
+    for (const QByteArray &line : io.readAll().split('\n')) {
+        if (line.startsWith("write_bytes:")) {
+            return line.mid(qstrlen("write_bytes:")).trimmed().toLongLong();
+        }
+    }
+#endif
+    return -1;
+}
+
+static QByteArray interfaceName(const Hyperdrive::CacheMessage &message)
+{
+    // The target is /interface/path
+    int separator = message.target().indexOf('/', 1);
+    return separator < 0 ? message.target().mid(1) : message.target().mid(1, separator - 1);
+}
+
+static int interfacePriority(const Hyperdrive::CacheMessage &message)
+{
+    return s_interfacePriorities.value(interfaceName(message), 0);
+}
+
+static AstarteTransportCache::Durability messageDurability(const Hyperdrive::CacheMessage &message)
+{
+    return s_interfaceDurabilities.value(interfaceName(message), s_durability);
+}
 
 AstarteTransportCache::AstarteTransportCache(QObject *parent)
     : Hemera::AsyncInitObject(parent)
-    , m_dbOk(false)
     , d(new Private)
 {
+    // A single coarse timer services every expiring retry entry
+    d->expiryTimer = new QTimer(this);
+    d->expiryTimer->setSingleShot(true);
+    d->expiryTimer->setTimerType(Qt::CoarseTimer);
+    connect(d->expiryTimer, &QTimer::timeout, this, &AstarteTransportCache::removeExpiredRetryEntries);
 }
 
 AstarteTransportCache *AstarteTransportCache::instance()
@@ -73,17 +218,40 @@ AstarteTransportCache::~AstarteTransportCache()
 
 void AstarteTransportCache::initImpl()
 {
-    if (ensureDatabase()) {
+    // The storage is opened and loaded from the worker thread, which keeps it for its whole lifetime
+    bool workerOk = false;
+    QMetaObject::invokeMethod(persistenceWorker(), "open", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, workerOk));
+    if (!workerOk) {
+        setInitError(Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest()), QStringLiteral("Could not open the cache storage"));
+        return;
+    }
 
-        d->persistentEntries = Hyperdrive::TransportDatabaseManager::Transactions::allPersistentEntries();
-        QList<Hyperdrive::CacheMessage> dbMessages = Hyperdrive::TransportDatabaseManager::Transactions::allCacheMessages();
-        for (const Hyperdrive::CacheMessage &message : dbMessages) {
-           d->retryEntries.insert(d->retryIdCounter++, message);
-        }
-        setReady();
-    } else {
-        setInitError(Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest()), QStringLiteral("Could not open the persistence database"));
+    d->persistentEntryHashes = d->persistenceWorker->takeLoadedPersistentEntryHashes();
+    d->persistentEntryPayloads.setMaxCost(s_persistentEntriesCacheSize);
+    // Storage ids are assigned here, since inserts are applied asynchronously
+    d->replayEndId = d->persistenceWorker->loadedMaxCacheMessageId();
+    d->nextDbId = qMax(d->nextDbId, d->replayEndId + 1);
+    d->unloadedMessages = d->persistenceWorker->loadedEvictableMessages();
+    d->unloadedBytes = d->persistenceWorker->loadedEvictableBytes();
+
+    // Stored messages are not loaded here: they are replayed a page at a time, see replayStoredMessages
+    qRegisterMetaType< QList<Hyperdrive::CacheMessage> >("QList<Hyperdrive::CacheMessage>");
+    connect(d->persistenceWorker, &AstartePersistenceWorker::cacheMessagesPageLoaded, this, &AstarteTransportCache::onCacheMessagesPageLoaded);
+
+    if (QCoreApplication::instance()) {
+        connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &AstarteTransportCache::shutdownPersistence);
+    }
+
+    if (s_statisticsLogIntervalSeconds > 0) {
+        d->lastLoggedDeviceBytes = deviceWriteBytes();
+        d->lastLoggedStatistics = Hyperdrive::TransportDatabaseManager::statistics();
+        d->statisticsTimer = new QTimer(this);
+        d->statisticsTimer->setTimerType(Qt::VeryCoarseTimer);
+        connect(d->statisticsTimer, &QTimer::timeout, this, &AstarteTransportCache::logStorageStatistics);
+        d->statisticsTimer->start(s_statisticsLogIntervalSeconds * 1000);
     }
+
+    setReady();
 }
 
 void AstarteTransportCache::setPersistencyDir(const QString &persistencyDir)
@@ -91,46 +259,333 @@ void AstarteTransportCache::setPersistencyDir(const QString &persistencyDir)
     s_persistencyDir = persistencyDir;
 }
 
-bool AstarteTransportCache::ensureDatabase()
+void AstarteTransportCache::setPersistenceFlushInterval(int flushIntervalMs)
+{
+    s_persistenceFlushIntervalMs = flushIntervalMs;
+}
+
+void AstarteTransportCache::setPersistenceFlushOperations(int flushOperations)
+{
+    s_persistenceFlushOperations = flushOperations;
+}
+
+void AstarteTransportCache::setStorageBackend(StorageBackend backend)
+{
+    s_storageBackend = backend;
+}
+
+void AstarteTransportCache::setSnapshotPath(const QString &snapshotPath)
+{
+    s_snapshotPath = snapshotPath;
+}
+
+void AstarteTransportCache::setStorageQuota(int maxMessages, qint64 maxBytes)
+{
+    s_maxStoredMessages = qMax(0, maxMessages);
+    s_maxStoredBytes = qMax(Q_INT64_C(0), maxBytes);
+}
+
+void AstarteTransportCache::setEvictionPolicy(EvictionPolicy policy)
+{
+    s_evictionPolicy = policy;
+}
+
+void AstarteTransportCache::setInterfacePriorities(const QHash<QByteArray, int> &priorities)
+{
+    s_interfacePriorities = priorities;
+}
+
+void AstarteTransportCache::setDurability(Durability durability)
+{
+    s_durability = durability;
+}
+
+void AstarteTransportCache::setInterfaceDurabilities(const QHash<QByteArray, Durability> &durabilities)
+{
+    s_interfaceDurabilities = durabilities;
+}
+
+void AstarteTransportCache::setCompressionLevel(int level)
+{
+    s_compressionLevel = level;
+}
+
+void AstarteTransportCache::setPersistentEntriesCacheSize(int bytes)
+{
+    s_persistentEntriesCacheSize = qMax(0, bytes);
+}
+
+void AstarteTransportCache::setStatisticsLogInterval(int seconds)
+{
+    s_statisticsLogIntervalSeconds = qMax(0, seconds);
+}
+
+int AstarteTransportCache::storedMessagesCount() const
+{
+    return d->evictionIndex.count() + d->unloadedMessages;
+}
+
+qint64 AstarteTransportCache::storedBytes() const
+{
+    return d->storedBytes + d->unloadedBytes;
+}
+
+quint64 AstarteTransportCache::evictedMessagesCount() const
+{
+    return d->evictedMessages;
+}
+
+quint64 AstarteTransportCache::evictedBytesCount() const
+{
+    return d->evictedBytes;
+}
+
+bool AstarteTransportCache::isReplayingStoredMessages() const
+{
+    return d->replayCursor < d->replayEndId;
+}
+
+void AstarteTransportCache::checkStorageIntegrity()
+{
+    if (d->integrityCheckStarted || s_storageBackend == StorageBackend::Memory) {
+        return;
+    }
+    d->integrityCheckStarted = true;
+
+    // The worker opens, and if needed recovers, the database before it is checked
+    persistenceWorker();
+    Hyperdrive::TransportDatabaseManager::checkIntegrity(QStringLiteral("%1/persistence.db").arg(s_persistencyDir));
+}
+
+Hyperdrive::TransportDatabaseManager::Statistics AstarteTransportCache::storageStatistics() const
+{
+    return Hyperdrive::TransportDatabaseManager::statistics();
+}
+
+quint64 AstarteTransportCache::logicalBytesStored() const
+{
+    return d->logicalBytesStored;
+}
+
+void AstarteTransportCache::logStorageStatistics()
+{
+    Hyperdrive::TransportDatabaseManager::Statistics current = Hyperdrive::TransportDatabaseManager::statistics();
+    const Hyperdrive::TransportDatabaseManager::Statistics &last = d->lastLoggedStatistics;
+    quint64 logicalBytes = d->logicalBytesStored - d->lastLoggedLogicalBytes;
+    qint64 deviceBytes = deviceWriteBytes();
+    qint64 deviceBytesDelta = deviceBytes >= 0 && d->lastLoggedDeviceBytes >= 0 ? deviceBytes - d->lastLoggedDeviceBytes : -1;
+
+    // Write amplification: what reached the device for every byte the transport asked to store
+    double amplification = logicalBytes > 0 && deviceBytesDelta >= 0 ? static_cast<double>(deviceBytesDelta) / logicalBytes : 0;
+
+    qCInfo(astarteTransportCacheDC) << "Storage in the last" << s_statisticsLogIntervalSeconds << "s: logical bytes" << logicalBytes
+                                    << "storage bytes" << current.bytesWritten - last.bytesWritten
+                                    << "device bytes" << deviceBytesDelta
+                                    << "rows inserted" << current.rowsInserted - last.rowsInserted
+                                    << "updated" << current.rowsUpdated - last.rowsUpdated
+                                    << "deleted" << current.rowsDeleted - last.rowsDeleted
+                                    << "transactions" << current.transactions - last.transactions
+                                    << "syncs" << current.syncs - last.syncs
+                                    << "ms spent" << (current.nanosecondsSpent - last.nanosecondsSpent) / 1000000
+                                    << "write amplification" << amplification;
+
+    d->lastLoggedStatistics = current;
+    d->lastLoggedLogicalBytes = d->logicalBytesStored;
+    d->lastLoggedDeviceBytes = deviceBytes;
+}
+
+void AstarteTransportCache::replayStoredMessages()
+{
+    if (!isReplayingStoredMessages() || d->replayRequested || !d->persistenceWorker) {
+        return;
+    }
+
+    // Keep at most about a page of messages waiting to be sent
+    if (d->retryEntries.count() + d->inFlightEntries.count() >= REPLAY_PAGE_SIZE) {
+        return;
+    }
+
+    d->replayRequested = true;
+    QMetaObject::invokeMethod(d->persistenceWorker, "loadCacheMessagesPage", Qt::QueuedConnection,
+                              Q_ARG(int, d->replayCursor), Q_ARG(int, d->replayEndId), Q_ARG(int, REPLAY_PAGE_SIZE));
+}
+
+void AstarteTransportCache::onCacheMessagesPageLoaded(const QList<Hyperdrive::CacheMessage> &messages)
+{
+    d->replayRequested = false;
+
+    if (messages.isEmpty()) {
+        // Nothing left after the cursor, anything still accounted expired or was deleted meanwhile
+        d->replayCursor = d->replayEndId;
+        d->unloadedMessages = 0;
+        d->unloadedBytes = 0;
+        return;
+    }
+
+    for (const Hyperdrive::CacheMessage &message : messages) {
+        d->replayCursor = qMax(d->replayCursor, message.attribute("dbId").toInt());
+        if (isEvictable(message)) {
+            // Accounted by the retry entries from now on
+            d->unloadedMessages = qMax(0, d->unloadedMessages - 1);
+            d->unloadedBytes = qMax(Q_INT64_C(0), d->unloadedBytes - messageSize(message));
+        }
+        addRetryEntry(message);
+    }
+
+    Q_EMIT storedMessagesReplayed(messages.count());
+}
+
+AstartePersistenceWorker *AstarteTransportCache::persistenceWorker()
 {
-    if (!m_dbOk) {
-        m_dbOk = Hyperdrive::TransportDatabaseManager::ensureDatabase(QStringLiteral("%1/persistence.db").arg(s_persistencyDir),
-                                                                      QStringLiteral("%1/db/migrations").arg(QLatin1String(Hyperdrive::StaticConfig::transportAstarteDataDir())));
+    if (Q_UNLIKELY(!d->persistenceWorker)) {
+        QString dbPath = QStringLiteral("%1/persistence.db").arg(s_persistencyDir);
+        QString migrationsDirPath = QStringLiteral("%1/db/migrations").arg(QLatin1String(Hyperdrive::StaticConfig::transportAstarteDataDir()));
+
+        CacheStorage *storage;
+        switch (s_storageBackend) {
+            case StorageBackend::SegmentedLog:
+                storage = new SegmentedLogCacheStorage(dbPath, migrationsDirPath, QStringLiteral("%1/cachelog").arg(s_persistencyDir),
+                                                       s_compressionLevel);
+                break;
+            case StorageBackend::Memory:
+                storage = new MemoryCacheStorage(s_snapshotPath.isEmpty() ? QStringLiteral("%1/cache.snapshot").arg(s_persistencyDir) : s_snapshotPath,
+                                                 s_compressionLevel);
+                break;
+            case StorageBackend::SQLite:
+            default:
+                storage = new SQLiteCacheStorage(dbPath, migrationsDirPath);
+                break;
+        }
+
+        Hyperdrive::TransportDatabaseManager::setPayloadCompressionLevel(s_compressionLevel);
+
+        d->persistenceThread = new QThread(this);
+        d->persistenceWorker = new AstartePersistenceWorker(storage, s_persistenceFlushIntervalMs, s_persistenceFlushOperations);
+        d->persistenceWorker->moveToThread(d->persistenceThread);
+        connect(d->persistenceThread, &QThread::finished, d->persistenceWorker, &QObject::deleteLater);
+        d->persistenceThread->start();
+    }
+
+    return d->persistenceWorker;
+}
+
+void AstarteTransportCache::flush()
+{
+    if (d->persistenceWorker) {
+        QMetaObject::invokeMethod(d->persistenceWorker, "commitPending", Qt::BlockingQueuedConnection);
     }
-    return m_dbOk;
+}
+
+bool AstarteTransportCache::saveSnapshot()
+{
+    if (!d->persistenceWorker) {
+        return false;
+    }
+
+    bool ok = false;
+    QMetaObject::invokeMethod(d->persistenceWorker, "saveSnapshot", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, ok));
+    return ok;
+}
+
+void AstarteTransportCache::shutdownPersistence()
+{
+    if (!d->persistenceWorker) {
+        return;
+    }
+
+    // Commits what is still pending and closes the worker connection
+    QMetaObject::invokeMethod(d->persistenceWorker, "close", Qt::BlockingQueuedConnection);
+    d->persistenceThread->quit();
+    d->persistenceThread->wait();
+    d->persistenceWorker = nullptr;
+    d->persistenceThread = nullptr;
 }
 
 void AstarteTransportCache::insertOrUpdatePersistentEntry(const QByteArray &target, const QByteArray &payload)
 {
-    ensureDatabase();
-    if (d->persistentEntries.contains(target)) {
-        Hyperdrive::TransportDatabaseManager::Transactions::updatePersistentEntry(target, payload);
+    if (d->persistentEntryHashes.contains(target)) {
+        persistenceWorker()->updatePersistentEntry(target, payload);
     } else {
-        Hyperdrive::TransportDatabaseManager::Transactions::insertPersistentEntry(target, payload);
+        persistenceWorker()->insertPersistentEntry(target, payload);
     }
-    d->persistentEntries.insert(target, payload);
+    d->persistentEntryHashes.insert(target, CacheStorage::payloadHash(payload));
+    d->persistentEntryPayloads.insert(target, new QByteArray(payload), qMax(1, payload.size()));
+    d->logicalBytesStored += target.size() + payload.size();
 }
 
 void AstarteTransportCache::removePersistentEntry(const QByteArray &target)
 {
-    ensureDatabase();
-    Hyperdrive::TransportDatabaseManager::Transactions::deletePersistentEntry(target);
-    d->persistentEntries.remove(target);
+    persistenceWorker()->deletePersistentEntry(target);
+    d->persistentEntryHashes.remove(target);
+    d->persistentEntryPayloads.remove(target);
 }
 
 bool AstarteTransportCache::isCached(const QByteArray &target) const
 {
-    return d->persistentEntries.contains(target);
+    return d->persistentEntryHashes.contains(target);
+}
+
+bool AstarteTransportCache::isPersistentEntryUnchanged(const QByteArray &target, const QByteArray &payload) const
+{
+    QHash< QByteArray, quint64 >::const_iterator it = d->persistentEntryHashes.constFind(target);
+    return it != d->persistentEntryHashes.constEnd() && it.value() == CacheStorage::payloadHash(payload);
 }
 
 QByteArray AstarteTransportCache::persistentEntry(const QByteArray &target) const
 {
-    return d->persistentEntries.value(target);
+    if (!d->persistentEntryHashes.contains(target)) {
+        return QByteArray();
+    }
+
+    if (QByteArray *payload = d->persistentEntryPayloads.object(target)) {
+        return *payload;
+    }
+
+    if (!d->persistenceWorker) {
+        return QByteArray();
+    }
+
+    QByteArray payload;
+    QMetaObject::invokeMethod(d->persistenceWorker, "loadPersistentEntry", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QByteArray, payload), Q_ARG(QByteArray, target));
+    d->persistentEntryPayloads.insert(target, new QByteArray(payload), qMax(1, payload.size()));
+    return payload;
+}
+
+QList< QPair< QByteArray, QByteArray > > AstarteTransportCache::persistentEntriesPage(const QByteArray &afterTarget, int limit) const
+{
+    CacheStorage::PersistentEntryList page;
+    if (d->persistenceWorker) {
+        QMetaObject::invokeMethod(d->persistenceWorker, "loadPersistentEntriesPage", Qt::BlockingQueuedConnection,
+                                  Q_RETURN_ARG(CacheStorage::PersistentEntryList, page),
+                                  Q_ARG(QByteArray, afterTarget), Q_ARG(int, limit));
+    }
+    return page;
+}
+
+QList< QByteArray > AstarteTransportCache::persistentEntryTargets() const
+{
+    return d->persistentEntryHashes.keys();
 }
 
 QHash< QByteArray, QByteArray > AstarteTransportCache::allPersistentEntries() const
 {
-    return d->persistentEntries;
+    QHash< QByteArray, QByteArray > ret;
+    ret.reserve(d->persistentEntryHashes.count());
+
+    QByteArray targetCursor;
+    Q_FOREVER {
+        QList< QPair< QByteArray, QByteArray > > page = persistentEntriesPage(targetCursor, PERSISTENT_ENTRIES_PAGE_SIZE);
+        if (page.isEmpty()) {
+            break;
+        }
+        for (const QPair< QByteArray, QByteArray > &entry : page) {
+            ret.insert(entry.first, entry.second);
+        }
+        targetCursor = page.last().first;
+    }
+
+    return ret;
 }
 
 void AstarteTransportCache::addInFlightEntry(int messageId, Hyperdrive::CacheMessage message)
@@ -154,6 +609,28 @@ Hyperdrive::CacheMessage AstarteTransportCache::takeInFlightEntry(int messageId)
     return d->inFlightEntries.take(messageId);
 }
 
+QList< Hyperdrive::CacheMessage > AstarteTransportCache::takeInFlightEntries(const QVector<int> &messageIds)
+{
+    QList< Hyperdrive::CacheMessage > messages;
+    messages.reserve(messageIds.size());
+    QVector<int> dbIds;
+
+    for (int messageId : messageIds) {
+        Hyperdrive::CacheMessage message = d->inFlightEntries.take(messageId);
+        if (message.hasAttribute("dbId")) {
+            dbIds.append(message.attribute("dbId").toInt());
+        }
+        messages.append(message);
+    }
+
+    if (!dbIds.isEmpty()) {
+        // A single delete for the whole batch
+        persistenceWorker()->deleteCacheMessages(dbIds);
+    }
+
+    return messages;
+}
+
 void AstarteTransportCache::resetInFlightEntries()
 {
     for (Hyperdrive::CacheMessage c : d->inFlightEntries.values()) {
@@ -162,12 +639,28 @@ void AstarteTransportCache::resetInFlightEntries()
     d->inFlightEntries.clear();
 }
 
+void AstarteTransportCache::resetInFlightEntries(const QVector<int> &messageIds)
+{
+    for (int messageId : messageIds) {
+        if (d->inFlightEntries.contains(messageId)) {
+            addRetryEntry(d->inFlightEntries.take(messageId));
+        }
+    }
+}
+
 void AstarteTransportCache::insertIntoDatabaseIfNotPresent(Hyperdrive::CacheMessage &message)
 {
+    // Properties are always stored, durability only applies to stored retention
+    Durability durability = message.interfaceType() == Hyperdrive::Interface::Type::Properties ? Durability::Batched
+                                                                                                : messageDurability(message);
+    if (durability == Durability::Volatile) {
+        // Kept in memory only, it does not survive a restart
+        return;
+    }
+
     if (!message.hasAttribute("dbId")) {
         // We have to insert it in the db
 
-        ensureDatabase();
         QDateTime absoluteExpiry;
         // Check if we don't have an absolute expiry
         if (!message.hasAttribute("absoluteExpiry")) {
@@ -184,8 +677,16 @@ void AstarteTransportCache::insertIntoDatabaseIfNotPresent(Hyperdrive::CacheMess
             absoluteExpiry = QDateTime::fromMSecsSinceEpoch(message.attribute("absoluteExpiry").toLongLong());
         }
 
-        int dbId = Hyperdrive::TransportDatabaseManager::Transactions::insertCacheMessage(message, absoluteExpiry);
+        int dbId = d->nextDbId++;
+        persistenceWorker()->insertCacheMessage(dbId, message, absoluteExpiry, durability == Durability::Strict);
         message.addAttribute("dbId", QByteArray::number(dbId));
+        d->logicalBytesStored += messageSize(message);
+
+        if (durability == Durability::Strict) {
+            // Wait for the insert, together with anything pending before it, to be synced to disk.
+            // This blocks the calling thread, usually the main one, for a commit and a sync.
+            flush();
+        }
     }
 }
 
@@ -195,6 +696,21 @@ int AstarteTransportCache::addRetryEntry(Hyperdrive::CacheMessage message)
         // QoS 0, discard it
         return -1;
     }
+    if (isEvictable(message) && isOverQuota(1, messageSize(message))) {
+        // Room is made before the insert, so that the storage never goes over the quota. Drop newest only drops
+        // messages which were never stored: replayed and reset in flight ones are older than what is queued.
+        if (s_evictionPolicy != EvictionPolicy::DropNewest || message.hasAttribute("dbId")) {
+            enforceQuota(1, messageSize(message));
+        }
+        if (isOverQuota(1, messageSize(message))) {
+            // Either the store is full of newer messages, or the message alone does not fit
+            removeFromDatabase(message);
+            ++d->evictedMessages;
+            d->evictedBytes += messageSize(message);
+            Q_EMIT messagesEvicted(1, messageSize(message));
+            return -1;
+        }
+    }
     if (message.interfaceType() == Hyperdrive::Interface::Type::Properties ||
         message.attributes().value("retention").toInt() == static_cast<int>(Hyperspace::Retention::Stored)) {
 
@@ -202,17 +718,18 @@ int AstarteTransportCache::addRetryEntry(Hyperdrive::CacheMessage message)
     }
     int id = d->retryIdCounter++;
     d->retryEntries.insert(id, message);
+    trackRetryEntry(id, message);
 
-    int relativeExpiryms = 0;
+    qint64 absoluteExpiryms = 0;
     if (message.hasAttribute("absoluteExpiry")) {
-        QDateTime absoluteExpiry = QDateTime::fromMSecsSinceEpoch(message.attribute("absoluteExpiry").toLongLong());
-        relativeExpiryms = QDateTime::currentDateTime().msecsTo(absoluteExpiry);
-    } else if (message.hasAttribute("expiry")) {
-        relativeExpiryms = message.attribute("expiry").toInt() * 1000;
+        absoluteExpiryms = message.attribute("absoluteExpiry").toLongLong();
+    } else if (message.hasAttribute("expiry") && message.attribute("expiry").toInt() > 0) {
+        absoluteExpiryms = QDateTime::currentMSecsSinceEpoch() + message.attribute("expiry").toLongLong() * 1000;
     }
-    if (relativeExpiryms > 0) {
-        int timerId = startTimer(relativeExpiryms);
-        d->retryTimerToId.insert(timerId, id);
+    if (absoluteExpiryms > 0) {
+        d->expiryQueue.insert(qMakePair(absoluteExpiryms, id), id);
+        d->retryExpiries.insert(id, absoluteExpiryms);
+        scheduleExpiryTimer();
     }
 
     return id;
@@ -221,31 +738,210 @@ int AstarteTransportCache::addRetryEntry(Hyperdrive::CacheMessage message)
 void AstarteTransportCache::removeRetryEntry(int id)
 {
     removeFromDatabase(d->retryEntries.value(id));
-    d->retryEntries.remove(id);
+    takeRetryEntry(id);
 }
 
 Hyperdrive::CacheMessage AstarteTransportCache::takeRetryEntry(int id)
 {
-    return d->retryEntries.take(id);
+    QHash< int, qint64 >::iterator expiry = d->retryExpiries.find(id);
+    if (expiry != d->retryExpiries.end()) {
+        d->expiryQueue.remove(qMakePair(expiry.value(), id));
+        d->retryExpiries.erase(expiry);
+    }
+
+    Hyperdrive::CacheMessage message = d->retryEntries.take(id);
+    untrackRetryEntry(id, message);
+    return message;
+}
+
+bool AstarteTransportCache::hasRetryEntry(int id) const
+{
+    return d->retryEntries.contains(id);
+}
+
+Hyperdrive::CacheMessage AstarteTransportCache::retryEntry(int id) const
+{
+    return d->retryEntries.value(id);
 }
 
 QList< int > AstarteTransportCache::allRetryIds() const
 {
-    return d->retryEntries.keys();
+    QList< int > ids = d->retryEntries.keys();
+    // Retry in enqueue order
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+void AstarteTransportCache::trackRetryEntry(int id, const Hyperdrive::CacheMessage &message)
+{
+    if (!isEvictable(message)) {
+        return;
+    }
+
+    EvictionKey key;
+    switch (s_evictionPolicy) {
+        case EvictionPolicy::DropLowestPriority:
+            key = qMakePair(static_cast<qint64>(interfacePriority(message)), id);
+            break;
+        case EvictionPolicy::ExpireEarly:
+            // The soonest to expire goes first, messages which never expire go last
+            if (message.hasAttribute("absoluteExpiry")) {
+                key = qMakePair(message.attribute("absoluteExpiry").toLongLong(), id);
+            } else if (message.hasAttribute("expiry") && message.attribute("expiry").toInt() > 0) {
+                key = qMakePair(QDateTime::currentMSecsSinceEpoch() + message.attribute("expiry").toLongLong() * 1000, id);
+            } else {
+                key = qMakePair(std::numeric_limits<qint64>::max(), id);
+            }
+            break;
+        case EvictionPolicy::DropOldest:
+        case EvictionPolicy::DropNewest:
+        default:
+            key = qMakePair(Q_INT64_C(0), id);
+            break;
+    }
+
+    d->evictionIndex.insert(key, id);
+    d->retryEvictionKeys.insert(id, key);
+    d->storedBytes += messageSize(message);
+}
+
+void AstarteTransportCache::untrackRetryEntry(int id, const Hyperdrive::CacheMessage &message)
+{
+    QHash< int, EvictionKey >::iterator it = d->retryEvictionKeys.find(id);
+    if (it == d->retryEvictionKeys.end()) {
+        return;
+    }
+
+    d->evictionIndex.remove(it.value());
+    d->retryEvictionKeys.erase(it);
+    d->storedBytes -= messageSize(message);
+}
+
+bool AstarteTransportCache::isOverQuota(int additionalMessages, qint64 additionalBytes) const
+{
+    return (s_maxStoredMessages > 0 && storedMessagesCount() + additionalMessages > s_maxStoredMessages)
+        || (s_maxStoredBytes > 0 && storedBytes() + additionalBytes > s_maxStoredBytes);
+}
+
+bool AstarteTransportCache::evictsUnloadedFirst() const
+{
+    if (d->unloadedMessages <= 0) {
+        return false;
+    }
+    if (d->evictionIndex.isEmpty()) {
+        return true;
+    }
+
+    // Unloaded messages are newer than the replayed ones and older than anything enqueued since the start.
+    // Every other policy needs to know the messages, so it evicts them once the loaded ones are gone.
+    if (s_evictionPolicy == EvictionPolicy::DropOldest) {
+        const Hyperdrive::CacheMessage &oldest = d->retryEntries[d->evictionIndex.first()];
+        return !oldest.hasAttribute("dbId") || oldest.attribute("dbId").toInt() > d->replayCursor;
+    }
+
+    return false;
+}
+
+void AstarteTransportCache::evictUnloaded(int additionalMessages, qint64 additionalBytes, int *evictedCount, qint64 *evictedBytes)
+{
+    int messages = s_maxStoredMessages > 0 ? qMax(0, storedMessagesCount() + additionalMessages - s_maxStoredMessages) : 0;
+    qint64 bytes = s_maxStoredBytes > 0 ? qMax(Q_INT64_C(0), storedBytes() + additionalBytes - s_maxStoredBytes) : 0;
+
+    // Only the oldest unloaded rows are read, a page at a time, and deleted in the storage
+    QMetaObject::invokeMethod(persistenceWorker(), "evictCacheMessages", Qt::BlockingQueuedConnection,
+                              Q_ARG(int, d->replayCursor), Q_ARG(int, d->replayEndId), Q_ARG(int, messages), Q_ARG(qint64, bytes));
+    int count = d->persistenceWorker->evictedMessages();
+    qint64 size = d->persistenceWorker->evictedBytes();
+
+    if (count == 0) {
+        // The accounting was stale: what is left expired or was deleted meanwhile
+        d->unloadedMessages = 0;
+        d->unloadedBytes = 0;
+        return;
+    }
+
+    d->unloadedMessages = qMax(0, d->unloadedMessages - count);
+    d->unloadedBytes = qMax(Q_INT64_C(0), d->unloadedBytes - size);
+    *evictedCount += count;
+    *evictedBytes += size;
+}
+
+void AstarteTransportCache::enforceQuota(int additionalMessages, qint64 additionalBytes)
+{
+    int evictedCount = 0;
+    qint64 evictedBytes = 0;
+
+    while (isOverQuota(additionalMessages, additionalBytes)) {
+        if (evictsUnloadedFirst()) {
+            evictUnloaded(additionalMessages, additionalBytes, &evictedCount, &evictedBytes);
+            continue;
+        }
+        if (d->evictionIndex.isEmpty()) {
+            break;
+        }
+
+        // Drop newest evicts from the tail of the enqueue order, every other policy from the head of its own order
+        int id = s_evictionPolicy == EvictionPolicy::DropNewest ? d->evictionIndex.last() : d->evictionIndex.first();
+        Hyperdrive::CacheMessage message = d->retryEntries.value(id);
+        removeRetryEntry(id);
+
+        ++evictedCount;
+        evictedBytes += messageSize(message);
+    }
+
+    if (evictedCount > 0) {
+        d->evictedMessages += evictedCount;
+        d->evictedBytes += evictedBytes;
+        qCWarning(astarteTransportCacheDC) << "Store is full, evicted" << evictedCount << "messages," << evictedBytes << "bytes";
+        Q_EMIT messagesEvicted(evictedCount, evictedBytes);
+    }
 }
 
 void AstarteTransportCache::removeFromDatabase(const Hyperdrive::CacheMessage &message)
 {
     if (message.hasAttribute("dbId")) {
-        ensureDatabase();
-        Hyperdrive::TransportDatabaseManager::Transactions::deleteCacheMessage(message.attribute("dbId").toInt());
+        persistenceWorker()->deleteCacheMessage(message.attribute("dbId").toInt());
     }
 }
 
-void AstarteTransportCache::timerEvent(QTimerEvent *event)
+void AstarteTransportCache::scheduleExpiryTimer()
 {
-    if (d->retryTimerToId.contains(event->timerId())) {
-        int messageId = d->retryTimerToId.take(event->timerId());
-        removeRetryEntry(messageId);
+    if (d->expiryQueue.isEmpty()) {
+        d->expiryTimer->stop();
+        return;
+    }
+
+    // Round the next expiry up to the granularity, so that close expiries are removed together
+    qint64 nextExpiry = d->expiryQueue.firstKey().first;
+    qint64 deadline = ((nextExpiry + EXPIRY_TIMER_GRANULARITY_MS - 1) / EXPIRY_TIMER_GRANULARITY_MS) * EXPIRY_TIMER_GRANULARITY_MS;
+    if (d->expiryTimer->isActive() && d->expiryTimerDeadline <= deadline) {
+        return;
     }
+
+    d->expiryTimerDeadline = deadline;
+    d->expiryTimer->start(static_cast<int>(qBound(Q_INT64_C(0), deadline - QDateTime::currentMSecsSinceEpoch(),
+                                                  static_cast<qint64>(std::numeric_limits<int>::max()))));
+}
+
+void AstarteTransportCache::removeExpiredRetryEntries()
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QVector<int> expiredDbIds;
+    int expiredCount = 0;
+
+    while (!d->expiryQueue.isEmpty() && d->expiryQueue.firstKey().first <= now) {
+        Hyperdrive::CacheMessage message = takeRetryEntry(d->expiryQueue.first());
+        if (message.hasAttribute("dbId")) {
+            expiredDbIds.append(message.attribute("dbId").toInt());
+        }
+        ++expiredCount;
+    }
+
+    if (expiredCount > 0) {
+        qCDebug(astarteTransportCacheDC) << "Removed" << expiredCount << "expired retry entries";
+        // A single delete for the whole batch
+        persistenceWorker()->deleteCacheMessages(expiredDbIds);
+    }
+
+    scheduleExpiryTimer();
 }
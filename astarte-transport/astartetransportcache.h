@@ -21,7 +21,12 @@
 
 #include <HemeraCore/AsyncInitObject>
 
+#include <QtCore/QVector>
+
 #include <cachemessage.h>
+#include <transportdatabasemanager.h>
+
+class AstartePersistenceWorker;
 
 class AstarteTransportCache : public Hemera::AsyncInitObject
 {
@@ -29,46 +34,141 @@ class AstarteTransportCache : public Hemera::AsyncInitObject
     Q_DISABLE_COPY(AstarteTransportCache)
 
 public:
+    enum class StorageBackend {
+        SQLite,
+        SegmentedLog,
+        // Nothing is written to disk but the snapshots
+        Memory
+    };
+
+    enum class Durability {
+        // Stored messages are kept in memory only
+        Volatile,
+        // Stored messages are written by the group commit, with the configured synchronous mode
+        Batched,
+        // Every stored message is synced to disk as soon as it is stored. The caller, usually the main thread,
+        // blocks until the sync is done
+        Strict
+    };
+
+    enum class EvictionPolicy {
+        DropOldest,
+        DropNewest,
+        DropLowestPriority,
+        ExpireEarly
+    };
+
     static AstarteTransportCache *instance();
 
     static void setPersistencyDir(const QString &persistencyDir);
+    static void setPersistenceFlushInterval(int flushIntervalMs);
+    static void setPersistenceFlushOperations(int flushOperations);
+    static void setStorageBackend(StorageBackend backend);
+    // Snapshot file of the Memory backend, defaults to cache.snapshot in the persistency dir
+    static void setSnapshotPath(const QString &snapshotPath);
+    // A limit of 0 disables the corresponding quota
+    static void setStorageQuota(int maxMessages, qint64 maxBytes);
+    static void setEvictionPolicy(EvictionPolicy policy);
+    static void setInterfacePriorities(const QHash<QByteArray, int> &priorities);
+    static void setDurability(Durability durability);
+    static void setInterfaceDurabilities(const QHash<QByteArray, Durability> &durabilities);
+    // zlib level of stored messages, 0 disables compression
+    static void setCompressionLevel(int level);
+    // Memory budget of the persistent entry payloads kept in memory, the others are read from the storage
+    static void setPersistentEntriesCacheSize(int bytes);
+    // Period of the storage statistics log line, 0 disables it
+    static void setStatisticsLogInterval(int seconds);
 
     virtual ~AstarteTransportCache();
 
+    int storedMessagesCount() const;
+    qint64 storedBytes() const;
+    quint64 evictedMessagesCount() const;
+    quint64 evictedBytesCount() const;
+
+    bool isReplayingStoredMessages() const;
+
+    // Reads the whole database in the background, once per process. Damage is repaired at the next startup
+    void checkStorageIntegrity();
+
+    // Counters of the storage since the process started
+    Hyperdrive::TransportDatabaseManager::Statistics storageStatistics() const;
+    // Bytes of the messages and entries handed over to the storage
+    quint64 logicalBytesStored() const;
+
+Q_SIGNALS:
+    void messagesEvicted(int count, qint64 bytes);
+    // A page of stored messages has been added to the retry entries
+    void storedMessagesReplayed(int count);
+
 public Q_SLOTS:
     void insertOrUpdatePersistentEntry(const QByteArray &target, const QByteArray &payload);
     void removePersistentEntry(const QByteArray &target);
 
     QByteArray persistentEntry(const QByteArray &target) const;
+    // Copies every entry in memory, prefer persistentEntriesPage or persistentEntryTargets
     QHash< QByteArray, QByteArray > allPersistentEntries() const;
+    // Up to limit (target, payload) pairs with target > afterTarget, in target order
+    QList< QPair< QByteArray, QByteArray > > persistentEntriesPage(const QByteArray &afterTarget, int limit) const;
+    QList< QByteArray > persistentEntryTargets() const;
 
     bool isCached(const QByteArray &target) const;
+    // Compares payload hashes only, it never reads the storage
+    bool isPersistentEntryUnchanged(const QByteArray &target, const QByteArray &payload) const;
 
     void addInFlightEntry(int messageId, Hyperdrive::CacheMessage message);
     Hyperdrive::CacheMessage takeInFlightEntry(int messageId);
+    // Same order as messageIds, unknown ids give an invalid message. Stored messages are deleted together
+    QList< Hyperdrive::CacheMessage > takeInFlightEntries(const QVector<int> &messageIds);
     void resetInFlightEntries();
+    // Only the given entries go back to the retry entries
+    void resetInFlightEntries(const QVector<int> &messageIds);
 
     int addRetryEntry(Hyperdrive::CacheMessage message);
     void removeRetryEntry(int messageId);
 
     Hyperdrive::CacheMessage takeRetryEntry(int id);
+    // False once the entry has been taken, evicted or expired
+    bool hasRetryEntry(int id) const;
+    Hyperdrive::CacheMessage retryEntry(int id) const;
     QList<int> allRetryIds() const;
 
     void removeFromDatabase(const Hyperdrive::CacheMessage &message);
 
+    // Blocks until every pending database write is committed
+    void flush();
+
+    // Loads the next page of messages stored by a previous run, if there is room for it
+    void replayStoredMessages();
+
+    // Blocks until the storage has written a snapshot of its content, if it keeps it in memory only
+    bool saveSnapshot();
 
 protected:
     virtual void initImpl() override final;
-    virtual void timerEvent(QTimerEvent *event) override final;
+
+private Q_SLOTS:
+    void onCacheMessagesPageLoaded(const QList<Hyperdrive::CacheMessage> &messages);
+    void removeExpiredRetryEntries();
+    void logStorageStatistics();
 
 private:
     explicit AstarteTransportCache(QObject *parent = nullptr);
 
     void insertIntoDatabaseIfNotPresent(Hyperdrive::CacheMessage &message);
 
-    bool ensureDatabase();
-
-    bool m_dbOk;
+    void trackRetryEntry(int id, const Hyperdrive::CacheMessage &message);
+    void untrackRetryEntry(int id, const Hyperdrive::CacheMessage &message);
+    bool isOverQuota(int additionalMessages = 0, qint64 additionalBytes = 0) const;
+    // Evicts until the given messages fit in the quota
+    void enforceQuota(int additionalMessages, qint64 additionalBytes);
+    bool evictsUnloadedFirst() const;
+    // Evicts stored messages the replay has not loaded yet, directly in the storage
+    void evictUnloaded(int additionalMessages, qint64 additionalBytes, int *evictedCount, qint64 *evictedBytes);
+    void scheduleExpiryTimer();
+
+    AstartePersistenceWorker *persistenceWorker();
+    void shutdownPersistence();
 
     class Private;
     Private * const d;
@@ -0,0 +1,69 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cachestorage.h"
+
+namespace {
+
+struct Crc32Table
+{
+    Crc32Table()
+    {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+            }
+            entries[i] = c;
+        }
+    }
+
+    quint32 entries[256];
+};
+
+}
+
+CacheStorage::~CacheStorage()
+{
+}
+
+bool CacheStorage::saveSnapshot()
+{
+    return true;
+}
+
+quint64 CacheStorage::payloadHash(const QByteArray &payload)
+{
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    for (int i = 0; i < payload.size(); ++i) {
+        hash ^= static_cast<uchar>(payload.at(i));
+        hash *= Q_UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+quint32 CacheStorage::crc32(quint32 crc, const char *data, qint64 size)
+{
+    static const Crc32Table table;
+
+    crc = ~crc;
+    for (qint64 i = 0; i < size; ++i) {
+        crc = table.entries[(crc ^ static_cast<uchar>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
@@ -0,0 +1,76 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CACHE_STORAGE_H
+#define CACHE_STORAGE_H
+
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+
+#include <cachemessage.h>
+
+/**
+ * Storage backend of AstarteTransportCache.
+ *
+ * A CacheStorage is owned by AstartePersistenceWorker and it is used only from the worker thread.
+ * Writes issued between beginBatch and commitBatch are committed together. A durable batch is synced
+ * to disk before commitBatch returns.
+ */
+class CacheStorage
+{
+public:
+    // (target, payload) pairs
+    typedef QList<QPair<QByteArray, QByteArray> > PersistentEntryList;
+
+    virtual ~CacheStorage();
+
+    virtual bool open() = 0;
+    virtual void close() = 0;
+
+    virtual void beginBatch(bool durable) = 0;
+    virtual void commitBatch() = 0;
+
+    virtual bool insertCacheMessage(int id, const Hyperdrive::CacheMessage &message, const QDateTime &expiry) = 0;
+    virtual bool deleteCacheMessage(int id) = 0;
+    virtual bool deleteCacheMessages(const QVector<int> &ids) = 0;
+    virtual int maxCacheMessageId() = 0;
+    // Up to limit messages with afterId < id <= maxId in id order, each one with its dbId attribute
+    virtual QList<Hyperdrive::CacheMessage> cacheMessagesPage(int afterId, int maxId, int limit) = 0;
+    virtual bool deleteExpiredCacheMessages() = 0;
+
+    virtual bool insertPersistentEntry(const QByteArray &target, const QByteArray &payload) = 0;
+    virtual bool updatePersistentEntry(const QByteArray &target, const QByteArray &payload) = 0;
+    virtual bool deletePersistentEntry(const QByteArray &target) = 0;
+    // A null QByteArray if there is no entry for target
+    virtual QByteArray persistentEntry(const QByteArray &target) = 0;
+    // Up to limit entries with target > afterTarget, in target order
+    virtual PersistentEntryList persistentEntriesPage(const QByteArray &afterTarget, int limit) = 0;
+
+    // Writes a point in time copy of the storage, for storages which do not persist by themselves
+    virtual bool saveSnapshot();
+
+    // Checksum of the records written by the storages
+    static quint32 crc32(quint32 crc, const char *data, qint64 size);
+    // 64 bit FNV-1a, compact enough to keep in memory for every persistent entry
+    static quint64 payloadHash(const QByteArray &payload);
+};
+
+#endif // CACHE_STORAGE_H
@@ -0,0 +1,18 @@
+CREATE TABLE cachemessages_normalized (
+    id integer primary key,
+    cachemessage blob,
+    target varchar,
+    interface varchar,
+    interface_type integer,
+    reliability integer,
+    retention integer,
+    enqueue_time integer,
+    expiry timestamp,
+    payload blob,
+    attributes blob
+);
+INSERT INTO cachemessages_normalized (id, cachemessage, expiry, payload)
+    SELECT id, cachemessage, expiry, payload FROM cachemessages;
+DROP TABLE cachemessages;
+ALTER TABLE cachemessages_normalized RENAME TO cachemessages;
+CREATE INDEX cachemessages_expiry_index ON cachemessages (expiry)
@@ -0,0 +1 @@
+ALTER TABLE cachemessages ADD COLUMN compression integer
@@ -0,0 +1 @@
+DROP INDEX IF EXISTS cachemessages_interface_enqueue_time_index
@@ -0,0 +1,325 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "memorycachestorage.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QSaveFile>
+#include <QtCore/QtEndian>
+
+#include <string.h>
+
+// Snapshot header: magic (4 bytes), version (1 byte), flags (1 byte), CRC32 of the body (4 bytes), body size (4 bytes)
+#define SNAPSHOT_MAGIC "ACSN"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HEADER_SIZE 14
+
+#define SNAPSHOT_FLAG_COMPRESSED 0x01
+
+#define NO_EXPIRY -1
+
+Q_LOGGING_CATEGORY(memoryCacheStorageDC, "hyperdrive.transport.astarte.memorystorage", DEBUG_MESSAGES_DEFAULT_LEVEL)
+
+MemoryCacheStorage::MemoryCacheStorage(const QString &snapshotPath, int compressionLevel)
+    : m_snapshotPath(snapshotPath)
+    , m_compressionLevel(compressionLevel)
+    , m_opened(false)
+    , m_maxId(0)
+{
+}
+
+MemoryCacheStorage::~MemoryCacheStorage()
+{
+}
+
+bool MemoryCacheStorage::open()
+{
+    if (m_opened) {
+        return true;
+    }
+
+    m_persistentEntries.clear();
+    m_messages.clear();
+    m_maxId = 0;
+
+    // A missing or damaged snapshot is not fatal: the storage just starts empty
+    restoreSnapshot();
+
+    m_opened = true;
+    return true;
+}
+
+void MemoryCacheStorage::close()
+{
+    if (!m_opened) {
+        return;
+    }
+
+    saveSnapshot();
+    m_opened = false;
+}
+
+void MemoryCacheStorage::beginBatch(bool durable)
+{
+    Q_UNUSED(durable)
+}
+
+void MemoryCacheStorage::commitBatch()
+{
+}
+
+bool MemoryCacheStorage::insertCacheMessage(int id, const Hyperdrive::CacheMessage &message, const QDateTime &expiry)
+{
+    StoredMessage stored;
+    stored.message = message;
+    stored.expiry = expiry.isValid() ? expiry.toMSecsSinceEpoch() : NO_EXPIRY;
+    m_messages.insert(id, stored);
+    m_maxId = qMax(m_maxId, id);
+    return true;
+}
+
+bool MemoryCacheStorage::deleteCacheMessage(int id)
+{
+    m_messages.remove(id);
+    return true;
+}
+
+bool MemoryCacheStorage::deleteCacheMessages(const QVector<int> &ids)
+{
+    for (int id : ids) {
+        m_messages.remove(id);
+    }
+    return true;
+}
+
+int MemoryCacheStorage::maxCacheMessageId()
+{
+    return m_maxId;
+}
+
+QList<Hyperdrive::CacheMessage> MemoryCacheStorage::cacheMessagesPage(int afterId, int maxId, int limit)
+{
+    QList<Hyperdrive::CacheMessage> ret;
+    for (QMap<int, StoredMessage>::const_iterator it = m_messages.upperBound(afterId);
+         it != m_messages.constEnd() && it.key() <= maxId && ret.count() < limit; ++it) {
+        Hyperdrive::CacheMessage message = it->message;
+        message.addAttribute("dbId", QByteArray::number(it.key()));
+        ret.append(message);
+    }
+
+    return ret;
+}
+
+bool MemoryCacheStorage::deleteExpiredCacheMessages()
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QMap<int, StoredMessage>::iterator it = m_messages.begin();
+    while (it != m_messages.end()) {
+        if (it->expiry != NO_EXPIRY && it->expiry < now) {
+            it = m_messages.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    return true;
+}
+
+bool MemoryCacheStorage::insertPersistentEntry(const QByteArray &target, const QByteArray &payload)
+{
+    m_persistentEntries.insert(target, payload);
+    return true;
+}
+
+bool MemoryCacheStorage::updatePersistentEntry(const QByteArray &target, const QByteArray &payload)
+{
+    m_persistentEntries.insert(target, payload);
+    return true;
+}
+
+bool MemoryCacheStorage::deletePersistentEntry(const QByteArray &target)
+{
+    m_persistentEntries.remove(target);
+    return true;
+}
+
+QByteArray MemoryCacheStorage::persistentEntry(const QByteArray &target)
+{
+    QMap<QByteArray, QByteArray>::const_iterator it = m_persistentEntries.constFind(target);
+    if (it == m_persistentEntries.constEnd()) {
+        return QByteArray();
+    }
+    // Present, but possibly empty
+    return it->isNull() ? QByteArray("") : it.value();
+}
+
+CacheStorage::PersistentEntryList MemoryCacheStorage::persistentEntriesPage(const QByteArray &afterTarget, int limit)
+{
+    PersistentEntryList ret;
+    for (QMap<QByteArray, QByteArray>::const_iterator it = m_persistentEntries.upperBound(afterTarget);
+         it != m_persistentEntries.constEnd() && ret.count() < limit; ++it) {
+        ret.append(qMakePair(it.key(), it.value()));
+    }
+
+    return ret;
+}
+
+bool MemoryCacheStorage::saveSnapshot()
+{
+    if (m_snapshotPath.isEmpty()) {
+        return true;
+    }
+
+    QByteArray body;
+    {
+        QDataStream stream(&body, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_0);
+
+        stream << static_cast<qint32>(m_maxId);
+
+        stream << static_cast<quint32>(m_persistentEntries.count());
+        for (QMap<QByteArray, QByteArray>::const_iterator it = m_persistentEntries.constBegin(); it != m_persistentEntries.constEnd(); ++it) {
+            stream << it.key() << it.value();
+        }
+
+        // The payload is kept apart from the serialized header, as the other storages do
+        stream << static_cast<quint32>(m_messages.count());
+        for (QMap<int, StoredMessage>::const_iterator it = m_messages.constBegin(); it != m_messages.constEnd(); ++it) {
+            Hyperdrive::CacheMessage header = it->message;
+            header.setPayload(QByteArray());
+            stream << static_cast<qint32>(it.key()) << static_cast<qint64>(it->expiry) << header.serialize() << it->message.payload();
+        }
+    }
+
+    quint8 flags = 0;
+    if (m_compressionLevel > 0) {
+        body = qCompress(body, m_compressionLevel);
+        flags |= SNAPSHOT_FLAG_COMPRESSED;
+    }
+
+    uchar header[SNAPSHOT_HEADER_SIZE];
+    memcpy(header, SNAPSHOT_MAGIC, 4);
+    header[4] = SNAPSHOT_VERSION;
+    header[5] = flags;
+    qToLittleEndian<quint32>(CacheStorage::crc32(0, body.constData(), body.size()), header + 6);
+    qToLittleEndian<quint32>(body.size(), header + 10);
+
+    QDir().mkpath(QFileInfo(m_snapshotPath).absolutePath());
+    QSaveFile snapshotFile(m_snapshotPath);
+    if (!snapshotFile.open(QIODevice::WriteOnly)) {
+        qCWarning(memoryCacheStorageDC) << "Could not open snapshot" << m_snapshotPath << snapshotFile.errorString();
+        return false;
+    }
+
+    snapshotFile.write(reinterpret_cast<const char *>(header), SNAPSHOT_HEADER_SIZE);
+    snapshotFile.write(body);
+    if (!snapshotFile.commit()) {
+        qCWarning(memoryCacheStorageDC) << "Could not write snapshot" << m_snapshotPath << snapshotFile.errorString();
+        return false;
+    }
+
+    qCDebug(memoryCacheStorageDC) << "Saved snapshot of" << m_persistentEntries.count() << "persistent entries and"
+                                  << m_messages.count() << "messages," << (SNAPSHOT_HEADER_SIZE + body.size()) << "bytes";
+
+    return true;
+}
+
+bool MemoryCacheStorage::restoreSnapshot()
+{
+    if (m_snapshotPath.isEmpty() || !QFile::exists(m_snapshotPath)) {
+        return false;
+    }
+
+    QFile snapshotFile(m_snapshotPath);
+    if (!snapshotFile.open(QIODevice::ReadOnly)) {
+        qCWarning(memoryCacheStorageDC) << "Could not open snapshot" << m_snapshotPath << snapshotFile.errorString();
+        return false;
+    }
+
+    QByteArray data = snapshotFile.readAll();
+    const uchar *header = reinterpret_cast<const uchar *>(data.constData());
+    if (data.size() < SNAPSHOT_HEADER_SIZE || memcmp(header, SNAPSHOT_MAGIC, 4) != 0 || header[4] != SNAPSHOT_VERSION) {
+        qCWarning(memoryCacheStorageDC) << "Ignoring snapshot" << m_snapshotPath << "with an unknown format";
+        return false;
+    }
+
+    quint8 flags = header[5];
+    quint32 crc = qFromLittleEndian<quint32>(header + 6);
+    quint32 bodySize = qFromLittleEndian<quint32>(header + 10);
+    if (bodySize != static_cast<quint32>(data.size() - SNAPSHOT_HEADER_SIZE)
+        || CacheStorage::crc32(0, data.constData() + SNAPSHOT_HEADER_SIZE, bodySize) != crc) {
+        qCWarning(memoryCacheStorageDC) << "Ignoring truncated or corrupted snapshot" << m_snapshotPath;
+        return false;
+    }
+
+    QByteArray body = data.mid(SNAPSHOT_HEADER_SIZE);
+    if (flags & SNAPSHOT_FLAG_COMPRESSED) {
+        body = qUncompress(body);
+    }
+
+    QDataStream stream(body);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    qint32 maxId;
+    stream >> maxId;
+
+    QMap<QByteArray, QByteArray> persistentEntries;
+    quint32 persistentEntriesCount;
+    stream >> persistentEntriesCount;
+    for (quint32 i = 0; i < persistentEntriesCount && stream.status() == QDataStream::Ok; ++i) {
+        QByteArray target;
+        QByteArray payload;
+        stream >> target >> payload;
+        persistentEntries.insert(target, payload);
+    }
+
+    QMap<int, StoredMessage> messages;
+    quint32 messagesCount;
+    stream >> messagesCount;
+    for (quint32 i = 0; i < messagesCount && stream.status() == QDataStream::Ok; ++i) {
+        qint32 id;
+        qint64 expiry;
+        QByteArray serializedHeader;
+        QByteArray payload;
+        stream >> id >> expiry >> serializedHeader >> payload;
+
+        StoredMessage stored;
+        stored.message = Hyperdrive::CacheMessage::fromBinary(serializedHeader);
+        stored.message.setPayload(payload);
+        stored.expiry = expiry;
+        messages.insert(id, stored);
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(memoryCacheStorageDC) << "Ignoring unreadable snapshot" << m_snapshotPath;
+        return false;
+    }
+
+    m_persistentEntries.swap(persistentEntries);
+    m_messages.swap(messages);
+    m_maxId = maxId;
+
+    qCDebug(memoryCacheStorageDC) << "Restored snapshot of" << m_persistentEntries.count() << "persistent entries and"
+                                  << m_messages.count() << "messages";
+
+    return true;
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MEMORY_CACHE_STORAGE_H
+#define MEMORY_CACHE_STORAGE_H
+
+#include "cachestorage.h"
+
+#include <QtCore/QMap>
+#include <QtCore/QString>
+
+/**
+ * Keeps persistent entries and cache messages in memory only, for devices without a writable persistent filesystem.
+ *
+ * Messages share their data with the ones held by AstarteTransportCache, so storing them costs no copy. The whole
+ * storage can be written to a single snapshot file, checksummed with a CRC32, on demand with saveSnapshot and when
+ * the storage is closed; open restores it. The snapshot is written to a temporary file which replaces the previous
+ * one only once it is complete, so an interrupted snapshot leaves the previous one intact.
+ */
+class MemoryCacheStorage : public CacheStorage
+{
+public:
+    // An empty snapshotPath disables snapshots. A compression level greater than 0 zlib compresses the snapshot.
+    explicit MemoryCacheStorage(const QString &snapshotPath, int compressionLevel = 0);
+    virtual ~MemoryCacheStorage();
+
+    virtual bool open() override;
+    virtual void close() override;
+
+    virtual void beginBatch(bool durable) override;
+    virtual void commitBatch() override;
+
+    virtual bool insertCacheMessage(int id, const Hyperdrive::CacheMessage &message, const QDateTime &expiry) override;
+    virtual bool deleteCacheMessage(int id) override;
+    virtual bool deleteCacheMessages(const QVector<int> &ids) override;
+    virtual int maxCacheMessageId() override;
+    virtual QList<Hyperdrive::CacheMessage> cacheMessagesPage(int afterId, int maxId, int limit) override;
+    virtual bool deleteExpiredCacheMessages() override;
+
+    virtual bool insertPersistentEntry(const QByteArray &target, const QByteArray &payload) override;
+    virtual bool updatePersistentEntry(const QByteArray &target, const QByteArray &payload) override;
+    virtual bool deletePersistentEntry(const QByteArray &target) override;
+    virtual QByteArray persistentEntry(const QByteArray &target) override;
+    virtual PersistentEntryList persistentEntriesPage(const QByteArray &afterTarget, int limit) override;
+
+    virtual bool saveSnapshot() override;
+
+private:
+    struct StoredMessage {
+        Hyperdrive::CacheMessage message;
+        qint64 expiry;
+    };
+
+    bool restoreSnapshot();
+
+    QString m_snapshotPath;
+    int m_compressionLevel;
+    bool m_opened;
+
+    // Ordered by target, for paging
+    QMap<QByteArray, QByteArray> m_persistentEntries;
+    QMap<int, StoredMessage> m_messages;
+    int m_maxId;
+};
+
+#endif // MEMORY_CACHE_STORAGE_H
@@ -0,0 +1,653 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "segmentedlogcachestorage.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QtEndian>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+// Record header: body size (4 bytes), record type (1 byte), CRC32 of type and body (4 bytes)
+#define RECORD_HEADER_SIZE 9
+
+#define RECORD_TYPE_INSERT 1
+#define RECORD_TYPE_TOMBSTONE 2
+// Frame body: qCompress'd sequence of insert records
+#define RECORD_TYPE_COMPRESSED_FRAME 3
+
+#define NOT_IN_FRAME -1
+
+// Insert body: id (4 bytes), expiry msecs or -1 (8 bytes), header size (4 bytes), header, payload
+#define INSERT_BODY_FIXED_SIZE 16
+// Tombstone body: id (4 bytes)
+#define TOMBSTONE_BODY_SIZE 4
+
+#define NO_EXPIRY -1
+
+#define MIGRATION_PAGE_SIZE 256
+
+Q_LOGGING_CATEGORY(segmentedLogCacheStorageDC, "hyperdrive.transport.astarte.segmentedlog", DEBUG_MESSAGES_DEFAULT_LEVEL)
+
+static quint32 recordCrc(quint8 type, const char *body, qint64 size)
+{
+    char typeByte = static_cast<char>(type);
+    return CacheStorage::crc32(CacheStorage::crc32(0, &typeByte, 1), body, size);
+}
+
+template <typename T>
+static void appendLittleEndian(QByteArray &buffer, T value)
+{
+    uchar bytes[sizeof(T)];
+    qToLittleEndian<T>(value, bytes);
+    buffer.append(reinterpret_cast<const char *>(bytes), sizeof(T));
+}
+
+static void appendFramedRecord(QByteArray &buffer, quint8 type, const QByteArray &body)
+{
+    appendLittleEndian<quint32>(buffer, body.size());
+    buffer.append(static_cast<char>(type));
+    appendLittleEndian<quint32>(buffer, recordCrc(type, body.constData(), body.size()));
+    buffer.append(body);
+}
+
+template <typename T>
+static T readLittleEndian(const char *data)
+{
+    return qFromLittleEndian<T>(reinterpret_cast<const uchar *>(data));
+}
+
+static bool decodeInsertBody(const char *body, qint64 size, int *id, qint64 *expiry, Hyperdrive::CacheMessage *message)
+{
+    if (size < INSERT_BODY_FIXED_SIZE) {
+        return false;
+    }
+
+    *id = readLittleEndian<qint32>(body);
+    *expiry = readLittleEndian<qint64>(body + 4);
+    quint32 headerSize = readLittleEndian<quint32>(body + 12);
+    if (headerSize > size - INSERT_BODY_FIXED_SIZE) {
+        return false;
+    }
+
+    if (message) {
+        *message = Hyperdrive::CacheMessage::fromBinary(QByteArray(body + INSERT_BODY_FIXED_SIZE, headerSize));
+        message->setPayload(QByteArray(body + INSERT_BODY_FIXED_SIZE + headerSize, size - INSERT_BODY_FIXED_SIZE - headerSize));
+    }
+
+    return true;
+}
+
+SegmentedLogCacheStorage::SegmentedLogCacheStorage(const QString &dbPath, const QString &migrationsDirPath, const QString &logDirPath,
+                                                   int compressionLevel, qint64 segmentSize)
+    : SQLiteCacheStorage(dbPath, migrationsDirPath)
+    , m_logDirPath(logDirPath)
+    , m_compressionLevel(qBound(0, compressionLevel, 9))
+    , m_segmentSize(segmentSize)
+    , m_maxId(0)
+    , m_currentSegment(1)
+    , m_currentSize(0)
+    , m_writeBufferInserts(0)
+    , m_inBatch(false)
+    , m_batchDurable(false)
+{
+}
+
+SegmentedLogCacheStorage::~SegmentedLogCacheStorage()
+{
+}
+
+QString SegmentedLogCacheStorage::segmentPath(quint32 segment) const
+{
+    return QStringLiteral("%1/%2.log").arg(m_logDirPath).arg(segment, 10, 10, QLatin1Char('0'));
+}
+
+bool SegmentedLogCacheStorage::open()
+{
+    // Persistent entries are still kept in the database
+    if (!SQLiteCacheStorage::open()) {
+        return false;
+    }
+
+    QDir logDir(m_logDirPath);
+    if (!logDir.exists() && !logDir.mkpath(logDir.absolutePath())) {
+        qCWarning(segmentedLogCacheStorageDC) << "Could not create the log directory" << m_logDirPath;
+        return false;
+    }
+
+    m_index.clear();
+    m_liveRecords.clear();
+    m_maxId = 0;
+    m_writeBuffer.clear();
+    m_writeBufferInserts = 0;
+    m_frameBuffer.clear();
+    m_frameRecords.clear();
+
+    QList<quint32> segments;
+    for (const QFileInfo &segmentInfo : logDir.entryInfoList(QStringList() << QStringLiteral("*.log"), QDir::Files, QDir::Name)) {
+        bool ok;
+        quint32 segment = segmentInfo.baseName().toUInt(&ok);
+        if (ok) {
+            segments.append(segment);
+        }
+    }
+
+    for (quint32 segment : segments) {
+        replaySegment(segment);
+    }
+
+    m_currentSegment = segments.isEmpty() ? 1 : segments.last();
+    if (!openCurrentSegment()) {
+        return false;
+    }
+
+    deleteHeadSegments();
+
+    // Move over messages cached by the database backend, if it was used before. Messages keep their ids, so that
+    // a move interrupted by a crash is resumed without duplicates: ids already in the log were moved before it.
+    int databaseMaxId = SQLiteCacheStorage::maxCacheMessageId();
+    int databaseCursor = 0;
+    while (databaseCursor < databaseMaxId) {
+        QList<Hyperdrive::CacheMessage> databaseMessages = SQLiteCacheStorage::cacheMessagesPage(databaseCursor, databaseMaxId, MIGRATION_PAGE_SIZE);
+        if (databaseMessages.isEmpty()) {
+            break;
+        }
+
+        qCInfo(segmentedLogCacheStorageDC) << "Moving" << databaseMessages.count() << "cached messages from the database to the log";
+        QVector<int> movedIds;
+        for (Hyperdrive::CacheMessage message : databaseMessages) {
+            databaseCursor = message.takeAttribute("dbId").toInt();
+            if (!m_index.contains(databaseCursor)) {
+                QDateTime expiry;
+                if (message.hasAttribute("absoluteExpiry")) {
+                    expiry = QDateTime::fromMSecsSinceEpoch(message.attribute("absoluteExpiry").toLongLong());
+                }
+                if (!insertCacheMessage(databaseCursor, message, expiry)) {
+                    continue;
+                }
+            }
+            movedIds.append(databaseCursor);
+        }
+
+        // Rows are only deleted from the database once their copies are on disk
+        syncCurrentSegment();
+        SQLiteCacheStorage::deleteCacheMessages(movedIds);
+    }
+
+    qCDebug(segmentedLogCacheStorageDC) << "Replayed" << m_liveRecords.count() << "segments," << m_index.count() << "live records";
+
+    return true;
+}
+
+void SegmentedLogCacheStorage::close()
+{
+    writeBuffer();
+    m_currentFile.close();
+    SQLiteCacheStorage::close();
+}
+
+void SegmentedLogCacheStorage::replaySegment(quint32 segment)
+{
+    QFile segmentFile(segmentPath(segment));
+    if (!segmentFile.open(QIODevice::ReadWrite)) {
+        qCWarning(segmentedLogCacheStorageDC) << "Could not open segment" << segmentFile.fileName() << segmentFile.errorString();
+        return;
+    }
+
+    m_liveRecords.insert(segment, 0);
+
+    // Segments are bounded in size, so they can be read as a whole
+    QByteArray data = segmentFile.readAll();
+    qint64 offset = replayRecords(data.constData(), data.size(), segment, NOT_IN_FRAME, 0);
+
+    if (offset < data.size()) {
+        qCWarning(segmentedLogCacheStorageDC) << "Truncating" << (data.size() - offset) << "bytes of torn or corrupted records in"
+                                              << segmentFile.fileName() << "at offset" << offset;
+        segmentFile.resize(offset);
+    }
+}
+
+qint64 SegmentedLogCacheStorage::replayRecords(const char *data, qint64 size, quint32 segment, qint64 frameOffset, qint64 frameSize)
+{
+    qint64 offset = 0;
+    while (size - offset >= RECORD_HEADER_SIZE) {
+        const char *header = data + offset;
+        quint32 bodySize = readLittleEndian<quint32>(header);
+        quint8 type = static_cast<quint8>(header[4]);
+        quint32 crc = readLittleEndian<quint32>(header + 5);
+
+        if (bodySize > size - offset - RECORD_HEADER_SIZE) {
+            break;
+        }
+        const char *body = header + RECORD_HEADER_SIZE;
+        if (recordCrc(type, body, bodySize) != crc) {
+            break;
+        }
+
+        if (type == RECORD_TYPE_INSERT) {
+            int id;
+            qint64 expiry;
+            if (!decodeInsertBody(body, bodySize, &id, &expiry, nullptr)) {
+                break;
+            }
+
+            if (m_index.contains(id)) {
+                --m_liveRecords[m_index.value(id).segment];
+            }
+            RecordLocation location;
+            location.segment = segment;
+            if (frameOffset == NOT_IN_FRAME) {
+                location.offset = offset;
+                location.size = RECORD_HEADER_SIZE + bodySize;
+                location.innerOffset = NOT_IN_FRAME;
+                location.innerSize = 0;
+            } else {
+                location.offset = frameOffset;
+                location.size = frameSize;
+                location.innerOffset = offset;
+                location.innerSize = RECORD_HEADER_SIZE + bodySize;
+            }
+            location.expiry = expiry;
+            m_index.insert(id, location);
+            ++m_liveRecords[segment];
+            m_maxId = qMax(m_maxId, id);
+        } else if (type == RECORD_TYPE_TOMBSTONE && bodySize == TOMBSTONE_BODY_SIZE) {
+            int id = readLittleEndian<qint32>(body);
+            QMap<int, RecordLocation>::iterator it = m_index.find(id);
+            if (it != m_index.end()) {
+                --m_liveRecords[it->segment];
+                m_index.erase(it);
+            }
+            m_maxId = qMax(m_maxId, id);
+        } else if (type == RECORD_TYPE_COMPRESSED_FRAME && frameOffset == NOT_IN_FRAME) {
+            QByteArray frame = qUncompress(reinterpret_cast<const uchar *>(body), bodySize);
+            if (frame.isEmpty() || replayRecords(frame.constData(), frame.size(), segment, offset, RECORD_HEADER_SIZE + bodySize) != frame.size()) {
+                break;
+            }
+        } else {
+            break;
+        }
+
+        offset += RECORD_HEADER_SIZE + bodySize;
+    }
+
+    return offset;
+}
+
+bool SegmentedLogCacheStorage::openCurrentSegment()
+{
+    m_currentFile.close();
+    m_currentFile.setFileName(segmentPath(m_currentSegment));
+    if (!m_currentFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCWarning(segmentedLogCacheStorageDC) << "Could not open segment" << m_currentFile.fileName() << m_currentFile.errorString();
+        return false;
+    }
+
+    m_currentSize = m_currentFile.size();
+    if (!m_liveRecords.contains(m_currentSegment)) {
+        m_liveRecords.insert(m_currentSegment, 0);
+    }
+
+    return true;
+}
+
+bool SegmentedLogCacheStorage::rollSegment()
+{
+    if (!writeBuffer()) {
+        return false;
+    }
+
+    // Records of a durable batch might span two segments
+    if (m_batchDurable) {
+        syncCurrentSegment();
+    }
+
+    ++m_currentSegment;
+    return openCurrentSegment();
+}
+
+void SegmentedLogCacheStorage::deleteHeadSegments()
+{
+    // Only the oldest segments are removed, so a tombstone never outlives the records it refers to
+    while (m_liveRecords.count() > 1) {
+        QMap<quint32, int>::iterator head = m_liveRecords.begin();
+        if (head.key() == m_currentSegment || head.value() > 0) {
+            break;
+        }
+
+        if (!QFile::remove(segmentPath(head.key()))) {
+            qCWarning(segmentedLogCacheStorageDC) << "Could not remove acknowledged segment" << segmentPath(head.key());
+            break;
+        }
+        qCDebug(segmentedLogCacheStorageDC) << "Removed acknowledged segment" << head.key();
+        m_liveRecords.erase(head);
+    }
+}
+
+bool SegmentedLogCacheStorage::appendRecord(quint8 type, const QByteArray &body, qint64 *offset, int inserts)
+{
+    if (m_currentSize + m_writeBuffer.size() >= m_segmentSize && !rollSegment()) {
+        return false;
+    }
+
+    *offset = m_currentSize + m_writeBuffer.size();
+    appendFramedRecord(m_writeBuffer, type, body);
+    m_writeBufferInserts += inserts;
+
+    return m_inBatch ? true : writeBuffer();
+}
+
+bool SegmentedLogCacheStorage::flushFrame()
+{
+    if (m_frameBuffer.isEmpty()) {
+        return true;
+    }
+
+    QByteArray frame;
+    frame.swap(m_frameBuffer);
+    QVector<PendingFrameRecord> records;
+    records.swap(m_frameRecords);
+
+    QByteArray body = qCompress(frame, m_compressionLevel);
+    qint64 offset;
+    if (!appendRecord(RECORD_TYPE_COMPRESSED_FRAME, body, &offset, records.count())) {
+        return false;
+    }
+
+    for (const PendingFrameRecord &record : records) {
+        RecordLocation location;
+        location.segment = m_currentSegment;
+        location.offset = offset;
+        location.size = RECORD_HEADER_SIZE + body.size();
+        location.innerOffset = record.innerOffset;
+        location.innerSize = record.innerSize;
+        location.expiry = record.expiry;
+        m_index.insert(record.id, location);
+        ++m_liveRecords[m_currentSegment];
+    }
+
+    qCDebug(segmentedLogCacheStorageDC) << "Compressed" << records.count() << "records from" << frame.size() << "to" << body.size() << "bytes";
+
+    return true;
+}
+
+bool SegmentedLogCacheStorage::writeBuffer()
+{
+    // Pending inserts have to reach the log before anything refers to them
+    if (!flushFrame()) {
+        return false;
+    }
+
+    if (m_writeBuffer.isEmpty()) {
+        return true;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 size = m_writeBuffer.size();
+    qint64 written = m_currentFile.write(m_writeBuffer);
+    bool flushed = m_currentFile.flush();
+    m_writeBuffer.clear();
+    int inserts = m_writeBufferInserts;
+    m_writeBufferInserts = 0;
+
+    Hyperdrive::TransportDatabaseManager::Statistics statistics;
+    statistics.nanosecondsSpent = timer.nsecsElapsed();
+
+    if (written < 0) {
+        Hyperdrive::TransportDatabaseManager::addStatistics(statistics);
+        qCWarning(segmentedLogCacheStorageDC) << "Could not write to segment" << m_currentFile.fileName() << m_currentFile.errorString();
+        return false;
+    }
+
+    statistics.bytesWritten = written;
+    m_currentSize += written;
+    if (written < size || !flushed) {
+        Hyperdrive::TransportDatabaseManager::addStatistics(statistics);
+        qCWarning(segmentedLogCacheStorageDC) << "Could not write" << (size - written) << "bytes to segment" << m_currentFile.fileName()
+                                              << m_currentFile.errorString();
+        return false;
+    }
+
+    // Inserts are accounted only once their records made it to the segment
+    statistics.rowsInserted = inserts;
+    Hyperdrive::TransportDatabaseManager::addStatistics(statistics);
+
+    return true;
+}
+
+void SegmentedLogCacheStorage::beginBatch(bool durable)
+{
+    SQLiteCacheStorage::beginBatch(durable);
+    m_inBatch = true;
+    m_batchDurable = durable;
+}
+
+void SegmentedLogCacheStorage::commitBatch()
+{
+    m_inBatch = false;
+    if (writeBuffer() && m_batchDurable) {
+        syncCurrentSegment();
+    }
+    m_batchDurable = false;
+    SQLiteCacheStorage::commitBatch();
+}
+
+void SegmentedLogCacheStorage::syncCurrentSegment()
+{
+#ifdef Q_OS_UNIX
+    QElapsedTimer timer;
+    timer.start();
+    if (::fdatasync(m_currentFile.handle()) != 0) {
+        qCWarning(segmentedLogCacheStorageDC) << "Could not sync segment" << m_currentFile.fileName() << strerror(errno);
+    }
+
+    Hyperdrive::TransportDatabaseManager::Statistics statistics;
+    statistics.syncs = 1;
+    statistics.nanosecondsSpent = timer.nsecsElapsed();
+    Hyperdrive::TransportDatabaseManager::addStatistics(statistics);
+#endif
+}
+
+bool SegmentedLogCacheStorage::insertCacheMessage(int id, const Hyperdrive::CacheMessage &message, const QDateTime &expiry)
+{
+    // The payload is appended as it is after the serialized header, as the database backend does
+    Hyperdrive::CacheMessage header = message;
+    header.setPayload(QByteArray());
+    QByteArray serializedHeader = header.serialize();
+
+    QByteArray body;
+    body.reserve(INSERT_BODY_FIXED_SIZE + serializedHeader.size() + message.payload().size());
+    appendLittleEndian<qint32>(body, id);
+    appendLittleEndian<qint64>(body, expiry.isValid() ? expiry.toMSecsSinceEpoch() : NO_EXPIRY);
+    appendLittleEndian<quint32>(body, serializedHeader.size());
+    body.append(serializedHeader);
+    body.append(message.payload());
+
+    qint64 recordExpiry = expiry.isValid() ? expiry.toMSecsSinceEpoch() : NO_EXPIRY;
+    m_maxId = qMax(m_maxId, id);
+
+    if (m_compressionLevel > 0 && m_inBatch) {
+        // Compressed together with the other inserts of the batch when the batch is written
+        PendingFrameRecord record;
+        record.id = id;
+        record.innerOffset = m_frameBuffer.size();
+        record.innerSize = RECORD_HEADER_SIZE + body.size();
+        record.expiry = recordExpiry;
+        appendFramedRecord(m_frameBuffer, RECORD_TYPE_INSERT, body);
+        m_frameRecords.append(record);
+        return true;
+    }
+
+    qint64 offset;
+    if (!appendRecord(RECORD_TYPE_INSERT, body, &offset, 1)) {
+        return false;
+    }
+
+    RecordLocation location;
+    location.segment = m_currentSegment;
+    location.offset = offset;
+    location.size = RECORD_HEADER_SIZE + body.size();
+    location.innerOffset = NOT_IN_FRAME;
+    location.innerSize = 0;
+    location.expiry = recordExpiry;
+    m_index.insert(id, location);
+    ++m_liveRecords[m_currentSegment];
+
+    return true;
+}
+
+bool SegmentedLogCacheStorage::deleteCacheMessage(int id)
+{
+    // The tombstone must follow the insert it refers to
+    if (!flushFrame()) {
+        return false;
+    }
+
+    QMap<int, RecordLocation>::iterator it = m_index.find(id);
+    if (it == m_index.end()) {
+        return true;
+    }
+
+    --m_liveRecords[it->segment];
+    m_index.erase(it);
+
+    Hyperdrive::TransportDatabaseManager::Statistics statistics;
+    statistics.rowsDeleted = 1;
+    Hyperdrive::TransportDatabaseManager::addStatistics(statistics);
+
+    QByteArray body;
+    appendLittleEndian<qint32>(body, id);
+
+    qint64 offset;
+    bool ok = appendRecord(RECORD_TYPE_TOMBSTONE, body, &offset);
+    deleteHeadSegments();
+
+    return ok;
+}
+
+bool SegmentedLogCacheStorage::deleteCacheMessages(const QVector<int> &ids)
+{
+    // Tombstones are buffered and written together
+    bool wasInBatch = m_inBatch;
+    m_inBatch = true;
+
+    bool ok = true;
+    for (int id : ids) {
+        ok = deleteCacheMessage(id) && ok;
+    }
+
+    m_inBatch = wasInBatch;
+    return (m_inBatch || writeBuffer()) && ok;
+}
+
+int SegmentedLogCacheStorage::maxCacheMessageId()
+{
+    return m_maxId;
+}
+
+bool SegmentedLogCacheStorage::deleteExpiredCacheMessages()
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QList<int> expiredIds;
+    for (QMap<int, RecordLocation>::const_iterator i = m_index.constBegin(); i != m_index.constEnd(); ++i) {
+        if (i->expiry != NO_EXPIRY && i->expiry < now) {
+            expiredIds.append(i.key());
+        }
+    }
+
+    bool ok = true;
+    for (int id : expiredIds) {
+        ok = deleteCacheMessage(id) && ok;
+    }
+
+    return ok;
+}
+
+QList<Hyperdrive::CacheMessage> SegmentedLogCacheStorage::cacheMessagesPage(int afterId, int maxId, int limit)
+{
+    QList<Hyperdrive::CacheMessage> ret;
+
+    if (!writeBuffer()) {
+        return ret;
+    }
+
+    QFile segmentFile;
+    // Consecutive records usually share the same frame, which is uncompressed only once
+    quint32 frameSegment = 0;
+    qint64 frameOffset = NOT_IN_FRAME;
+    QByteArray frame;
+    for (QMap<int, RecordLocation>::const_iterator i = m_index.upperBound(afterId);
+         i != m_index.constEnd() && i.key() <= maxId && ret.count() < limit; ++i) {
+        if (segmentFile.fileName() != segmentPath(i->segment)) {
+            segmentFile.close();
+            segmentFile.setFileName(segmentPath(i->segment));
+            if (!segmentFile.open(QIODevice::ReadOnly)) {
+                qCWarning(segmentedLogCacheStorageDC) << "Could not open segment" << segmentFile.fileName() << segmentFile.errorString();
+                continue;
+            }
+        }
+
+        QByteArray record;
+        if (i->innerOffset == NOT_IN_FRAME) {
+            if (!segmentFile.isOpen() || !segmentFile.seek(i->offset)) {
+                continue;
+            }
+            record = segmentFile.read(i->size);
+            if (record.size() != i->size) {
+                record.clear();
+            }
+        } else {
+            if (frameSegment != i->segment || frameOffset != i->offset) {
+                frame.clear();
+                frameSegment = i->segment;
+                frameOffset = i->offset;
+                if (segmentFile.isOpen() && segmentFile.seek(i->offset)) {
+                    QByteArray frameRecord = segmentFile.read(i->size);
+                    if (frameRecord.size() == i->size) {
+                        frame = qUncompress(reinterpret_cast<const uchar *>(frameRecord.constData()) + RECORD_HEADER_SIZE,
+                                            frameRecord.size() - RECORD_HEADER_SIZE);
+                    }
+                }
+            }
+            if (i->innerOffset + i->innerSize <= frame.size()) {
+                record = frame.mid(i->innerOffset, i->innerSize);
+            }
+        }
+
+        int id;
+        qint64 expiry;
+        Hyperdrive::CacheMessage message;
+        if (record.size() < RECORD_HEADER_SIZE
+                || !decodeInsertBody(record.constData() + RECORD_HEADER_SIZE, record.size() - RECORD_HEADER_SIZE, &id, &expiry, &message)) {
+            qCWarning(segmentedLogCacheStorageDC) << "Could not read record" << i.key() << "from" << segmentFile.fileName();
+            continue;
+        }
+
+        message.addAttribute("dbId", QByteArray::number(id));
+        ret.append(message);
+    }
+
+    return ret;
+}
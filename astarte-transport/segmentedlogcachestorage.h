@@ -0,0 +1,112 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SEGMENTED_LOG_CACHE_STORAGE_H
+#define SEGMENTED_LOG_CACHE_STORAGE_H
+
+#include "sqlitecachestorage.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QMap>
+#include <QtCore/QVector>
+
+/**
+ * Stores cache messages in append-only segment files, while persistent entries stay in the persistence database.
+ *
+ * Every record is framed with its size and a CRC32. Inserts append the whole message, deletes append a tombstone.
+ * Once every record of the oldest segment has been deleted the segment file is removed, so the log is only ever
+ * written sequentially at its tail and trimmed at its head. A torn record at the end of a segment, left by a crash
+ * in the middle of a write, is truncated when the log is replayed.
+ *
+ * With a compression level greater than 0, the inserts of a batch are compressed together in a single frame,
+ * so that the similar records of consecutive messages share the same zlib window.
+ */
+class SegmentedLogCacheStorage : public SQLiteCacheStorage
+{
+public:
+    SegmentedLogCacheStorage(const QString &dbPath, const QString &migrationsDirPath, const QString &logDirPath,
+                             int compressionLevel = 0, qint64 segmentSize = 4 * 1024 * 1024);
+    virtual ~SegmentedLogCacheStorage();
+
+    virtual bool open() override;
+    virtual void close() override;
+
+    virtual void beginBatch(bool durable) override;
+    virtual void commitBatch() override;
+
+    virtual bool insertCacheMessage(int id, const Hyperdrive::CacheMessage &message, const QDateTime &expiry) override;
+    virtual bool deleteCacheMessage(int id) override;
+    virtual bool deleteCacheMessages(const QVector<int> &ids) override;
+    virtual int maxCacheMessageId() override;
+    virtual QList<Hyperdrive::CacheMessage> cacheMessagesPage(int afterId, int maxId, int limit) override;
+    virtual bool deleteExpiredCacheMessages() override;
+
+private:
+    // Offset and size of the record in the segment. Records inside a compressed frame refer to the frame,
+    // and to their own offset and size in the uncompressed frame.
+    struct RecordLocation {
+        quint32 segment;
+        qint64 offset;
+        qint64 size;
+        qint64 innerOffset;
+        qint64 innerSize;
+        qint64 expiry;
+    };
+
+    struct PendingFrameRecord {
+        int id;
+        qint64 innerOffset;
+        qint64 innerSize;
+        qint64 expiry;
+    };
+
+    QString segmentPath(quint32 segment) const;
+    void replaySegment(quint32 segment);
+    qint64 replayRecords(const char *data, qint64 size, quint32 segment, qint64 frameOffset, qint64 frameSize);
+    bool openCurrentSegment();
+    bool rollSegment();
+    void deleteHeadSegments();
+
+    // inserts is the number of cache messages the record holds
+    bool appendRecord(quint8 type, const QByteArray &body, qint64 *offset, int inserts = 0);
+    bool writeBuffer();
+    bool flushFrame();
+    void syncCurrentSegment();
+
+    QString m_logDirPath;
+    int m_compressionLevel;
+    qint64 m_segmentSize;
+
+    // Live records by id, and live records count of every segment on disk
+    QMap<int, RecordLocation> m_index;
+    QMap<quint32, int> m_liveRecords;
+    int m_maxId;
+
+    quint32 m_currentSegment;
+    QFile m_currentFile;
+    qint64 m_currentSize;
+    QByteArray m_writeBuffer;
+    // Insert records in the write buffer, accounted when it is written
+    int m_writeBufferInserts;
+    QByteArray m_frameBuffer;
+    QVector<PendingFrameRecord> m_frameRecords;
+    bool m_inBatch;
+    bool m_batchDurable;
+};
+
+#endif // SEGMENTED_LOG_CACHE_STORAGE_H
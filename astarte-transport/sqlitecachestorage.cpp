@@ -0,0 +1,123 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sqlitecachestorage.h"
+
+SQLiteCacheStorage::SQLiteCacheStorage(const QString &dbPath, const QString &migrationsDirPath)
+    : m_dbPath(dbPath)
+    , m_migrationsDirPath(migrationsDirPath)
+    , m_connectionName(QStringLiteral("astarte-cache-storage"))
+    , m_restoreSynchronousMode(false)
+{
+}
+
+SQLiteCacheStorage::~SQLiteCacheStorage()
+{
+}
+
+QString SQLiteCacheStorage::connectionName() const
+{
+    return m_connectionName;
+}
+
+bool SQLiteCacheStorage::open()
+{
+    return Hyperdrive::TransportDatabaseManager::ensureDatabase(m_dbPath, m_migrationsDirPath, m_connectionName);
+}
+
+void SQLiteCacheStorage::close()
+{
+    m_batchTransaction.reset();
+    Hyperdrive::TransportDatabaseManager::closeDatabase(m_connectionName);
+}
+
+void SQLiteCacheStorage::beginBatch(bool durable)
+{
+    // In WAL mode a FULL commit syncs the log once, which makes the whole batch durable
+    if (durable && Hyperdrive::TransportDatabaseManager::synchronousMode() < Hyperdrive::TransportDatabaseManager::SynchronousMode::Full) {
+        m_restoreSynchronousMode = Hyperdrive::TransportDatabaseManager::applySynchronousMode(
+            Hyperdrive::TransportDatabaseManager::SynchronousMode::Full, m_connectionName);
+    }
+
+    m_batchTransaction.reset(new Hyperdrive::TransportDatabaseManager::ScopedTransaction(m_connectionName));
+}
+
+void SQLiteCacheStorage::commitBatch()
+{
+    m_batchTransaction.reset();
+
+    if (m_restoreSynchronousMode) {
+        Hyperdrive::TransportDatabaseManager::applySynchronousMode(Hyperdrive::TransportDatabaseManager::synchronousMode(), m_connectionName);
+        m_restoreSynchronousMode = false;
+    }
+}
+
+bool SQLiteCacheStorage::insertCacheMessage(int id, const Hyperdrive::CacheMessage &message, const QDateTime &expiry)
+{
+    return Hyperdrive::TransportDatabaseManager::Transactions::insertCacheMessage(id, message, expiry, m_connectionName);
+}
+
+bool SQLiteCacheStorage::deleteCacheMessage(int id)
+{
+    return Hyperdrive::TransportDatabaseManager::Transactions::deleteCacheMessage(id, m_connectionName);
+}
+
+bool SQLiteCacheStorage::deleteCacheMessages(const QVector<int> &ids)
+{
+    return Hyperdrive::TransportDatabaseManager::Transactions::deleteCacheMessages(ids, m_connectionName);
+}
+
+int SQLiteCacheStorage::maxCacheMessageId()
+{
+    return Hyperdrive::TransportDatabaseManager::Transactions::maxCacheMessageId(m_connectionName);
+}
+
+QList<Hyperdrive::CacheMessage> SQLiteCacheStorage::cacheMessagesPage(int afterId, int maxId, int limit)
+{
+    return Hyperdrive::TransportDatabaseManager::Transactions::cacheMessagesPage(afterId, maxId, limit, m_connectionName);
+}
+
+bool SQLiteCacheStorage::deleteExpiredCacheMessages()
+{
+    return Hyperdrive::TransportDatabaseManager::Transactions::deleteExpiredCacheMessages(m_connectionName);
+}
+
+bool SQLiteCacheStorage::insertPersistentEntry(const QByteArray &target, const QByteArray &payload)
+{
+    return Hyperdrive::TransportDatabaseManager::Transactions::insertPersistentEntry(target, payload, m_connectionName);
+}
+
+bool SQLiteCacheStorage::updatePersistentEntry(const QByteArray &target, const QByteArray &payload)
+{
+    return Hyperdrive::TransportDatabaseManager::Transactions::updatePersistentEntry(target, payload, m_connectionName);
+}
+
+bool SQLiteCacheStorage::deletePersistentEntry(const QByteArray &target)
+{
+    return Hyperdrive::TransportDatabaseManager::Transactions::deletePersistentEntry(target, m_connectionName);
+}
+
+QByteArray SQLiteCacheStorage::persistentEntry(const QByteArray &target)
+{
+    return Hyperdrive::TransportDatabaseManager::Transactions::persistentEntry(target, m_connectionName);
+}
+
+CacheStorage::PersistentEntryList SQLiteCacheStorage::persistentEntriesPage(const QByteArray &afterTarget, int limit)
+{
+    return Hyperdrive::TransportDatabaseManager::Transactions::persistentEntriesPage(afterTarget, limit, m_connectionName);
+}
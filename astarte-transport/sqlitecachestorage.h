@@ -0,0 +1,68 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SQLITE_CACHE_STORAGE_H
+#define SQLITE_CACHE_STORAGE_H
+
+#include "cachestorage.h"
+
+#include <QtCore/QScopedPointer>
+#include <QtCore/QString>
+
+#include <transportdatabasemanager.h>
+
+/**
+ * Stores everything in the persistence database through TransportDatabaseManager, using a dedicated connection.
+ */
+class SQLiteCacheStorage : public CacheStorage
+{
+public:
+    SQLiteCacheStorage(const QString &dbPath, const QString &migrationsDirPath);
+    virtual ~SQLiteCacheStorage();
+
+    virtual bool open() override;
+    virtual void close() override;
+
+    virtual void beginBatch(bool durable) override;
+    virtual void commitBatch() override;
+
+    virtual bool insertCacheMessage(int id, const Hyperdrive::CacheMessage &message, const QDateTime &expiry) override;
+    virtual bool deleteCacheMessage(int id) override;
+    virtual bool deleteCacheMessages(const QVector<int> &ids) override;
+    virtual int maxCacheMessageId() override;
+    virtual QList<Hyperdrive::CacheMessage> cacheMessagesPage(int afterId, int maxId, int limit) override;
+    virtual bool deleteExpiredCacheMessages() override;
+
+    virtual bool insertPersistentEntry(const QByteArray &target, const QByteArray &payload) override;
+    virtual bool updatePersistentEntry(const QByteArray &target, const QByteArray &payload) override;
+    virtual bool deletePersistentEntry(const QByteArray &target) override;
+    virtual QByteArray persistentEntry(const QByteArray &target) override;
+    virtual PersistentEntryList persistentEntriesPage(const QByteArray &afterTarget, int limit) override;
+
+protected:
+    QString connectionName() const;
+
+private:
+    QString m_dbPath;
+    QString m_migrationsDirPath;
+    QString m_connectionName;
+    QScopedPointer<Hyperdrive::TransportDatabaseManager::ScopedTransaction> m_batchTransaction;
+    bool m_restoreSynchronousMode;
+};
+
+#endif // SQLITE_CACHE_STORAGE_H
@@ -58,6 +58,17 @@ static bool isValidTarget(const QByteArray &target)
 
 bool AstarteGenericProducer::sendData(const QVariant &value, const QByteArray &target,
         const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    return sendData(value, target, timestamp, Hyperspace::EncodedMetadata(metadata));
+}
+
+bool AstarteGenericProducer::sendData(const QVariantHash &value, const QByteArray &target, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    return sendData(value, target, timestamp, Hyperspace::EncodedMetadata(metadata));
+}
+
+bool AstarteGenericProducer::sendData(const QVariant &value, const QByteArray &target,
+        const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata)
 {
     if (!isValidTarget(target)) {
         qCWarning(astartGenericProducerDC) << "Invalid target: " << target << ". Discarding value: " << value;
@@ -161,7 +172,7 @@ bool AstarteGenericProducer::sendData(const QVariant &value, const QByteArray &t
     return false;
 }
 
-bool AstarteGenericProducer::sendData(const QVariantHash &value, const QByteArray &target, const QDateTime &timestamp, const QVariantHash &metadata)
+bool AstarteGenericProducer::sendData(const QVariantHash &value, const QByteArray &target, const QDateTime &timestamp, const Hyperspace::EncodedMetadata &metadata)
 {
     // TODO: verify path match
     QHash<QByteArray, QByteArray> attributes;
@@ -41,6 +41,10 @@ public:
             const QDateTime &timestamp = QDateTime(), const QVariantHash &metadata = QVariantHash());
     bool sendData(const QVariantHash &value, const QByteArray &target,
             const QDateTime &timestamp = QDateTime(), const QVariantHash &metadata = QVariantHash());
+    bool sendData(const QVariant &value, const QByteArray &target, const QDateTime &timestamp,
+            const Hyperspace::EncodedMetadata &metadata);
+    bool sendData(const QVariantHash &value, const QByteArray &target, const QDateTime &timestamp,
+            const Hyperspace::EncodedMetadata &metadata);
     bool unsetPath(const QByteArray &target);
 
     void setMappingToTokens(const QHash<QByteArray, QByteArrayList> &mappingToTokens);
@@ -0,0 +1,445 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QMap>
+#include <QtCore/QObject>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QTextStream>
+
+#include <cachemessage.h>
+#include <hyperdriveconfig.h>
+#include <transportdatabasemanager.h>
+
+using namespace Hyperdrive;
+
+#define CONNECTION_NAME "astarte-cache-tool"
+
+// Rows are read and written a page at a time, so memory does not grow with the database
+#define PAGE_SIZE 1000
+
+#define MINUTE_MS (60 * 1000)
+#define HOUR_MS (60 * MINUTE_MS)
+#define DAY_MS (24 * HOUR_MS)
+
+namespace {
+
+struct Counter
+{
+    Counter() : count(0), bytes(0) {}
+
+    void add(qint64 size)
+    {
+        ++count;
+        bytes += size;
+    }
+
+    quint64 count;
+    quint64 bytes;
+};
+
+// Power of two size buckets: bucket n holds sizes in (2^(n-1), 2^n]
+class SizeHistogram
+{
+public:
+    void add(qint64 size)
+    {
+        int bucket = 0;
+        while ((Q_INT64_C(1) << bucket) < size) {
+            ++bucket;
+        }
+        ++m_buckets[bucket];
+    }
+
+    void print(QTextStream &out) const
+    {
+        for (QMap<int, quint64>::const_iterator it = m_buckets.constBegin(); it != m_buckets.constEnd(); ++it) {
+            out << QStringLiteral("    <= %1 bytes: %2\n").arg(Q_INT64_C(1) << it.key()).arg(it.value());
+        }
+    }
+
+private:
+    QMap<int, quint64> m_buckets;
+};
+
+}
+
+static QByteArray interfaceFromTarget(const QByteArray &target)
+{
+    int separator = target.indexOf('/', 1);
+    return separator < 0 ? target.mid(1) : target.mid(1, separator - 1);
+}
+
+static void printCounters(QTextStream &out, const QHash<QByteArray, Counter> &counters)
+{
+    // Sorted by name, for output stable across runs
+    QMap<QByteArray, Counter> sorted;
+    for (QHash<QByteArray, Counter>::const_iterator it = counters.constBegin(); it != counters.constEnd(); ++it) {
+        sorted.insert(it.key(), it.value());
+    }
+    for (QMap<QByteArray, Counter>::const_iterator it = sorted.constBegin(); it != sorted.constEnd(); ++it) {
+        out << QStringLiteral("    %1: %2 (%3 bytes)\n").arg(QLatin1String(it.key())).arg(it->count).arg(it->bytes);
+    }
+}
+
+// The log and memory storage backends keep the cache messages next to the database, in files this tool does not read
+static QString otherStorageBackendPath(const QString &dbPath)
+{
+    QDir persistencyDir = QFileInfo(dbPath).dir();
+    QDir logDir(persistencyDir.filePath(QStringLiteral("cachelog")));
+    if (logDir.exists() && !logDir.entryList(QStringList() << QStringLiteral("*.log"), QDir::Files).isEmpty()) {
+        return logDir.path();
+    }
+
+    QString snapshotPath = persistencyDir.filePath(QStringLiteral("cache.snapshot"));
+    if (QFile::exists(snapshotPath)) {
+        return snapshotPath;
+    }
+
+    return QString();
+}
+
+// A database with an older schema is inspected through a migrated copy, so that the original is never written
+static bool openForInspection(const QString &dbPath, const QString &migrationsDirPath, QTemporaryDir &copyDir)
+{
+    bool outdated;
+    if (TransportDatabaseManager::openDatabaseReadOnly(dbPath, migrationsDirPath, QStringLiteral(CONNECTION_NAME), &outdated)) {
+        return true;
+    }
+    if (!outdated) {
+        return false;
+    }
+
+    if (!copyDir.isValid()) {
+        QTextStream(stderr) << QObject::tr("Could not create a temporary directory: %1
+").arg(copyDir.errorString());
+        return false;
+    }
+
+    QTextStream(stderr) << QObject::tr("Database %1 has an older schema, inspecting a migrated copy
+").arg(dbPath);
+    QString copyPath = copyDir.filePath(QFileInfo(dbPath).fileName());
+    // Committed transactions might still be in the write ahead log only
+    if (!QFile::copy(dbPath, copyPath)
+        || (QFile::exists(dbPath + QStringLiteral("-wal")) && !QFile::copy(dbPath + QStringLiteral("-wal"), copyPath + QStringLiteral("-wal")))) {
+        QTextStream(stderr) << QObject::tr("Could not copy database %1
+").arg(dbPath);
+        return false;
+    }
+
+    return TransportDatabaseManager::ensureDatabase(copyPath, migrationsDirPath, QStringLiteral(CONNECTION_NAME));
+}
+
+static int summary(QTextStream &out, bool perTarget)
+{
+    Counter messagesTotal;
+    QHash<QByteArray, Counter> messagesPerInterface;
+    QHash<QByteArray, Counter> messagesPerTarget;
+    SizeHistogram messagesSizes;
+    // Expiry distribution, relative to now
+    quint64 noExpiry = 0;
+    quint64 expired = 0;
+    quint64 withinMinute = 0;
+    quint64 withinHour = 0;
+    quint64 withinDay = 0;
+    quint64 later = 0;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int maxId = TransportDatabaseManager::Transactions::maxCacheMessageId(QStringLiteral(CONNECTION_NAME));
+    int cursor = 0;
+    while (cursor < maxId) {
+        QList<CacheMessage> page = TransportDatabaseManager::Transactions::cacheMessagesPage(cursor, maxId, PAGE_SIZE,
+                                                                                            QStringLiteral(CONNECTION_NAME));
+        if (page.isEmpty()) {
+            break;
+        }
+
+        for (const CacheMessage &message : page) {
+            cursor = message.attribute("dbId").toInt();
+            qint64 size = message.target().size() + message.payload().size();
+            messagesTotal.add(size);
+            messagesPerInterface[interfaceFromTarget(message.target())].add(size);
+            if (perTarget) {
+                messagesPerTarget[message.target()].add(size);
+            }
+            messagesSizes.add(size);
+
+            if (!message.hasAttribute("absoluteExpiry")) {
+                ++noExpiry;
+                continue;
+            }
+            qint64 remaining = message.attribute("absoluteExpiry").toLongLong() - now;
+            if (remaining <= 0) {
+                ++expired;
+            } else if (remaining <= MINUTE_MS) {
+                ++withinMinute;
+            } else if (remaining <= HOUR_MS) {
+                ++withinHour;
+            } else if (remaining <= DAY_MS) {
+                ++withinDay;
+            } else {
+                ++later;
+            }
+        }
+    }
+
+    Counter entriesTotal;
+    QHash<QByteArray, Counter> entriesPerInterface;
+    SizeHistogram entriesSizes;
+    QByteArray targetCursor;
+    Q_FOREVER {
+        QList<QPair<QByteArray, QByteArray> > page = TransportDatabaseManager::Transactions::persistentEntriesPage(targetCursor, PAGE_SIZE,
+                                                                                                                 QStringLiteral(CONNECTION_NAME));
+        if (page.isEmpty()) {
+            break;
+        }
+
+        for (const QPair<QByteArray, QByteArray> &entry : page) {
+            targetCursor = entry.first;
+            qint64 size = entry.first.size() + entry.second.size();
+            entriesTotal.add(size);
+            entriesPerInterface[interfaceFromTarget(entry.first)].add(size);
+            entriesSizes.add(size);
+        }
+    }
+
+    out << QStringLiteral("Cache messages: %1 (%2 bytes), max id %3\n").arg(messagesTotal.count).arg(messagesTotal.bytes).arg(maxId);
+    out << QStringLiteral("  Per interface:\n");
+    printCounters(out, messagesPerInterface);
+    if (perTarget) {
+        out << QStringLiteral("  Per target:\n");
+        printCounters(out, messagesPerTarget);
+    }
+    out << QStringLiteral("  Sizes:\n");
+    messagesSizes.print(out);
+    out << QStringLiteral("  Expiry:\n");
+    out << QStringLiteral("    never: %1\n").arg(noExpiry);
+    out << QStringLiteral("    expired: %1\n").arg(expired);
+    out << QStringLiteral("    within a minute: %1\n").arg(withinMinute);
+    out << QStringLiteral("    within an hour: %1\n").arg(withinHour);
+    out << QStringLiteral("    within a day: %1\n").arg(withinDay);
+    out << QStringLiteral("    later: %1\n").arg(later);
+
+    out << QStringLiteral("Persistent entries: %1 (%2 bytes)\n").arg(entriesTotal.count).arg(entriesTotal.bytes);
+    out << QStringLiteral("  Per interface:\n");
+    printCounters(out, entriesPerInterface);
+    out << QStringLiteral("  Sizes:\n");
+    entriesSizes.print(out);
+
+    return 0;
+}
+
+static int exportMessages(QFile &file)
+{
+    int maxId = TransportDatabaseManager::Transactions::maxCacheMessageId(QStringLiteral(CONNECTION_NAME));
+    int cursor = 0;
+    quint64 exported = 0;
+    while (cursor < maxId) {
+        QList<CacheMessage> page = TransportDatabaseManager::Transactions::cacheMessagesPage(cursor, maxId, PAGE_SIZE,
+                                                                                            QStringLiteral(CONNECTION_NAME));
+        if (page.isEmpty()) {
+            break;
+        }
+
+        for (CacheMessage message : page) {
+            cursor = message.takeAttribute("dbId").toInt();
+
+            // Attributes are short ASCII strings, Latin-1 maps any byte to a character anyway
+            QJsonObject attributes;
+            QHash<QByteArray, QByteArray> messageAttributes = message.attributes();
+            for (QHash<QByteArray, QByteArray>::const_iterator it = messageAttributes.constBegin(); it != messageAttributes.constEnd(); ++it) {
+                attributes.insert(QLatin1String(it.key()), QString::fromLatin1(it.value()));
+            }
+
+            QJsonObject line;
+            line.insert(QStringLiteral("id"), cursor);
+            line.insert(QStringLiteral("target"), QString::fromLatin1(message.target()));
+            line.insert(QStringLiteral("interfaceType"), static_cast<int>(message.interfaceType()));
+            line.insert(QStringLiteral("attributes"), attributes);
+            line.insert(QStringLiteral("payload"), QString::fromLatin1(message.payload().toBase64()));
+
+            file.write(QJsonDocument(line).toJson(QJsonDocument::Compact));
+            file.write("\n");
+            ++exported;
+        }
+    }
+
+    QTextStream(stderr) << QObject::tr("Exported %1 messages\n").arg(exported);
+    return 0;
+}
+
+static int importMessages(QFile &file)
+{
+    int nextId = TransportDatabaseManager::Transactions::maxCacheMessageId(QStringLiteral(CONNECTION_NAME)) + 1;
+    quint64 imported = 0;
+    quint64 lineNumber = 0;
+    bool ok = true;
+
+    while (!file.atEnd() && ok) {
+        // One transaction per page of lines
+        TransportDatabaseManager::ScopedTransaction transaction(QStringLiteral(CONNECTION_NAME));
+        for (int i = 0; i < PAGE_SIZE && !file.atEnd(); ++i) {
+            QByteArray rawLine = file.readLine().trimmed();
+            ++lineNumber;
+            if (rawLine.isEmpty()) {
+                continue;
+            }
+
+            QJsonParseError error;
+            QJsonObject line = QJsonDocument::fromJson(rawLine, &error).object();
+            if (error.error != QJsonParseError::NoError || !line.contains(QStringLiteral("target"))) {
+                QTextStream(stderr) << QObject::tr("Skipping invalid line %1: %2\n").arg(lineNumber).arg(error.errorString());
+                continue;
+            }
+
+            CacheMessage message;
+            message.setTarget(line.value(QStringLiteral("target")).toString().toLatin1());
+            message.setInterfaceType(static_cast<Interface::Type>(line.value(QStringLiteral("interfaceType")).toInt()));
+            message.setPayload(QByteArray::fromBase64(line.value(QStringLiteral("payload")).toString().toLatin1()));
+            QJsonObject attributes = line.value(QStringLiteral("attributes")).toObject();
+            for (QJsonObject::const_iterator it = attributes.constBegin(); it != attributes.constEnd(); ++it) {
+                message.addAttribute(it.key().toLatin1(), it.value().toString().toLatin1());
+            }
+
+            QDateTime expiry;
+            if (message.hasAttribute("absoluteExpiry")) {
+                expiry = QDateTime::fromMSecsSinceEpoch(message.attribute("absoluteExpiry").toLongLong());
+            }
+
+            if (!TransportDatabaseManager::Transactions::insertCacheMessage(nextId++, message, expiry, QStringLiteral(CONNECTION_NAME))) {
+                ok = false;
+                break;
+            }
+            ++imported;
+        }
+    }
+
+    QTextStream(stderr) << QObject::tr("Imported %1 messages\n").arg(imported);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    app.setApplicationName(QObject::tr("Astarte cache tool"));
+    app.setOrganizationDomain(QStringLiteral("com.ispirata.Hemera"));
+    app.setOrganizationName(QStringLiteral("Ispirata"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QObject::tr("Inspects and maintains the Astarte transport persistence database"));
+    parser.addVersionOption();
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("command"), QObject::tr("One of summary, vacuum, purge-expired, export, import"));
+    parser.addPositionalArgument(QStringLiteral("database"), QObject::tr("The path to persistence.db"));
+    parser.addPositionalArgument(QStringLiteral("file"), QObject::tr("The NDJSON file to export to or import from, standard output "
+                                                                    "or input if missing"), QStringLiteral("[file]"));
+
+    parser.addOptions({
+        {
+            QStringList{QStringLiteral("m"), QStringLiteral("migrations")},
+            QObject::tr("The directory of the database migrations"),
+            QStringLiteral("directory"),
+            QStringLiteral("%1/db/migrations").arg(QLatin1String(StaticConfig::transportAstarteDataDir()))
+        },
+        {
+            QStringList{QStringLiteral("t"), QStringLiteral("targets")},
+            QObject::tr("Include the counts per target in the summary")
+        }
+    });
+
+    parser.process(app);
+
+    QStringList arguments = parser.positionalArguments();
+    if (arguments.length() < 2) {
+        parser.showHelp(1);
+    }
+
+    QString command = arguments.value(0);
+    QString dbPath = arguments.value(1);
+
+    if (command != QStringLiteral("import") && !QFile::exists(dbPath)) {
+        QTextStream(stderr) << QObject::tr("Database %1 does not exist\n").arg(dbPath);
+        return 1;
+    }
+
+    // Only vacuum does not deal with cache messages
+    QString otherBackendPath = otherStorageBackendPath(dbPath);
+    if (command != QStringLiteral("vacuum") && !otherBackendPath.isEmpty()) {
+        QTextStream(stderr) << QObject::tr("Cache messages are kept in %1 by the log or memory storage backend, this tool only "
+                                           "handles the sqlite one\n").arg(otherBackendPath);
+        return 1;
+    }
+
+    // Inspection never changes the database. Maintenance brings it to the current schema, as the transport would
+    // do when opening it.
+    QTemporaryDir copyDir;
+    bool databaseOpened;
+    if (command == QStringLiteral("summary") || command == QStringLiteral("export")) {
+        databaseOpened = openForInspection(dbPath, parser.value(QStringLiteral("migrations")), copyDir);
+    } else {
+        databaseOpened = TransportDatabaseManager::ensureDatabase(dbPath, parser.value(QStringLiteral("migrations")), QStringLiteral(CONNECTION_NAME));
+    }
+    if (!databaseOpened) {
+        QTextStream(stderr) << QObject::tr("Could not open database %1\n").arg(dbPath);
+        return 1;
+    }
+
+    int ret = 0;
+    if (command == QStringLiteral("summary")) {
+        QTextStream out(stdout);
+        ret = summary(out, parser.isSet(QStringLiteral("targets")));
+    } else if (command == QStringLiteral("vacuum")) {
+        ret = TransportDatabaseManager::vacuum(QStringLiteral(CONNECTION_NAME)) ? 0 : 1;
+    } else if (command == QStringLiteral("purge-expired")) {
+        quint64 deletedBefore = TransportDatabaseManager::statistics().rowsDeleted;
+        ret = TransportDatabaseManager::Transactions::deleteExpiredCacheMessages(QStringLiteral(CONNECTION_NAME)) ? 0 : 1;
+        QTextStream(stdout) << QObject::tr("Purged %1 expired messages\n").arg(TransportDatabaseManager::statistics().rowsDeleted - deletedBefore);
+    } else if (command == QStringLiteral("export") || command == QStringLiteral("import")) {
+        bool exporting = command == QStringLiteral("export");
+        QFile file;
+        bool opened;
+        if (arguments.length() > 2) {
+            file.setFileName(arguments.value(2));
+            opened = file.open(exporting ? QIODevice::WriteOnly | QIODevice::Truncate : QIODevice::ReadOnly);
+        } else {
+            opened = exporting ? file.open(stdout, QIODevice::WriteOnly) : file.open(stdin, QIODevice::ReadOnly);
+        }
+
+        if (!opened) {
+            QTextStream(stderr) << QObject::tr("Could not open %1: %2\n").arg(file.fileName(), file.errorString());
+            ret = 1;
+        } else {
+            ret = exporting ? exportMessages(file) : importMessages(file);
+        }
+    } else {
+        QTextStream(stderr) << QObject::tr("Unknown command %1\n").arg(command);
+        ret = 1;
+    }
+
+    TransportDatabaseManager::closeDatabase(QStringLiteral(CONNECTION_NAME));
+
+    return ret;
+}
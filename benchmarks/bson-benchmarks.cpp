@@ -0,0 +1,460 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QVariantHash>
+
+#include <QtTest/QtTest>
+
+#include <astartetransport.h>
+#include <cachemessage.h>
+
+#include <HyperspaceCore/BSONDocument>
+#include <HyperspaceCore/BSONSerializer>
+#include <HyperspaceProducerConsumer/ConsumerAbstractAdaptor>
+#include <HyperspaceProducerConsumer/ProducerAbstractInterface>
+
+#include <stdlib.h>
+
+// Minimum wall time spent measuring each row
+#define MINIMUM_MEASUREMENT_NS (200 * 1000 * 1000)
+// Iterations used to sample allocations
+#define ALLOCATION_SAMPLE_ITERATIONS 100
+
+#define ARRAY_SAMPLE_LENGTH 16
+#define LARGE_ARRAY_LENGTH 10000
+#define LARGE_AGGREGATE_KEYS 1000
+#define LARGE_BLOB_SIZE (1024 * 1024)
+#define LARGE_STRING_SIZE (64 * 1024)
+
+static QBasicAtomicInt s_allocations = Q_BASIC_ATOMIC_INITIALIZER(0);
+static bool s_countAllocations = false;
+static volatile int s_sink = 0;
+
+#if defined(__GLIBC__)
+// Count heap allocations by interposing the allocator entry points. QByteArray, QHash and friends
+// allocate through malloc directly, so hooking operator new alone would miss most of them.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) __THROW
+{
+    s_allocations.fetchAndAddRelaxed(1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) __THROW
+{
+    s_allocations.fetchAndAddRelaxed(1);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) __THROW
+{
+    s_allocations.fetchAndAddRelaxed(1);
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+template <typename Operation>
+static void benchmark(Operation operation)
+{
+    // Warm up caches and lazily initialized Qt internals
+    operation();
+
+    if (s_countAllocations) {
+#if defined(__GLIBC__)
+        int before = s_allocations.load();
+        for (int i = 0; i < ALLOCATION_SAMPLE_ITERATIONS; ++i) {
+            operation();
+        }
+        QTest::setBenchmarkResult(qreal(s_allocations.load() - before) / ALLOCATION_SAMPLE_ITERATIONS, QTest::Events);
+#else
+        QSKIP("Allocation counting is supported only on glibc");
+#endif
+        return;
+    }
+
+    QElapsedTimer timer;
+    qint64 iterations = 0;
+    int batch = 1;
+
+    timer.start();
+    do {
+        for (int i = 0; i < batch; ++i) {
+            operation();
+        }
+        iterations += batch;
+        batch *= 2;
+    } while (timer.nsecsElapsed() < MINIMUM_MEASUREMENT_NS);
+
+    QTest::setBenchmarkResult(qreal(timer.nsecsElapsed()) / iterations, QTest::WalltimeNanoseconds);
+}
+
+// Mirrors the envelope built by ProducerAbstractInterface::sendDataOnEndpoint
+static QByteArray encodeSample(const QVariant &value, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    Hyperspace::Util::BSONSerializer serializer;
+    if (value.type() == QVariant::Hash) {
+        serializer.appendDocument("v", value.toHash());
+    } else {
+        serializer.appendValue("v", value);
+    }
+    if (!timestamp.isNull() && timestamp.isValid()) {
+        serializer.appendDateTime("t", timestamp);
+    }
+    if (!metadata.isEmpty()) {
+        serializer.appendDocument("m", metadata);
+    }
+    serializer.appendEndOfDocument();
+    return serializer.document();
+}
+
+template <typename T>
+static QVariant arraySample(int length, T element)
+{
+    QList<QVariant> list;
+    list.reserve(length);
+    for (int i = 0; i < length; ++i) {
+        list.append(QVariant(element));
+    }
+    return QVariant(list);
+}
+
+static QList< QPair<QByteArray, QVariant> > scalarAndArraySamples()
+{
+    QDateTime now = QDateTime::currentDateTime();
+
+    return QList< QPair<QByteArray, QVariant> >()
+        << qMakePair(QByteArray("integer"), QVariant(42))
+        << qMakePair(QByteArray("longinteger"), QVariant(Q_INT64_C(1) << 40))
+        << qMakePair(QByteArray("double"), QVariant(3.14159))
+        << qMakePair(QByteArray("boolean"), QVariant(true))
+        << qMakePair(QByteArray("string"), QVariant(QStringLiteral("The quick brown fox jumps over the lazy dog")))
+        << qMakePair(QByteArray("binaryblob"), QVariant(QByteArray(32, 'x')))
+        << qMakePair(QByteArray("datetime"), QVariant(now))
+        << qMakePair(QByteArray("integerarray"), arraySample(ARRAY_SAMPLE_LENGTH, 42))
+        << qMakePair(QByteArray("longintegerarray"), arraySample(ARRAY_SAMPLE_LENGTH, Q_INT64_C(1) << 40))
+        << qMakePair(QByteArray("doublearray"), arraySample(ARRAY_SAMPLE_LENGTH, 3.14159))
+        << qMakePair(QByteArray("booleanarray"), arraySample(ARRAY_SAMPLE_LENGTH, true))
+        << qMakePair(QByteArray("stringarray"), arraySample(ARRAY_SAMPLE_LENGTH, QStringLiteral("fox")))
+        << qMakePair(QByteArray("binaryblobarray"), arraySample(ARRAY_SAMPLE_LENGTH, QByteArray(32, 'x')))
+        << qMakePair(QByteArray("datetimearray"), arraySample(ARRAY_SAMPLE_LENGTH, now));
+}
+
+static QList< QPair<QByteArray, QVariant> > largeSamples()
+{
+    QVariantHash aggregate;
+    for (int i = 0; i < LARGE_AGGREGATE_KEYS; ++i) {
+        aggregate.insert(QStringLiteral("key%1").arg(i), i);
+    }
+
+    return QList< QPair<QByteArray, QVariant> >()
+        << qMakePair(QByteArray("binaryblob-1MiB"), QVariant(QByteArray(LARGE_BLOB_SIZE, 'x')))
+        << qMakePair(QByteArray("string-64KiB"), QVariant(QString(LARGE_STRING_SIZE, QLatin1Char('x'))))
+        << qMakePair(QByteArray("integerarray-10k"), arraySample(LARGE_ARRAY_LENGTH, 42))
+        << qMakePair(QByteArray("stringarray-10k"), arraySample(LARGE_ARRAY_LENGTH, QStringLiteral("fox")))
+        << qMakePair(QByteArray("aggregate-1k-keys"), QVariant(aggregate));
+}
+
+static QVariantHash metadataSample()
+{
+    QVariantHash metadata;
+    metadata.insert(QStringLiteral("site"), QStringLiteral("plant-42"));
+    metadata.insert(QStringLiteral("firmware"), QStringLiteral("1.4.2"));
+    metadata.insert(QStringLiteral("calibration"), 1337);
+    return metadata;
+}
+
+static void addEncodeRows(const QList< QPair<QByteArray, QVariant> > &samples)
+{
+    QTest::addColumn<QVariant>("value");
+    QTest::addColumn<QDateTime>("timestamp");
+    QTest::addColumn<QVariantHash>("metadata");
+
+    QDateTime timestamp = QDateTime::currentDateTime();
+    QVariantHash metadata = metadataSample();
+
+    for (const QPair<QByteArray, QVariant> &sample : samples) {
+        QTest::newRow(QByteArray(sample.first + "/plain").constData()) << sample.second << QDateTime() << QVariantHash();
+        QTest::newRow(QByteArray(sample.first + "/timestamp").constData()) << sample.second << timestamp << QVariantHash();
+        QTest::newRow(QByteArray(sample.first + "/metadata").constData()) << sample.second << QDateTime() << metadata;
+        QTest::newRow(QByteArray(sample.first + "/timestamp+metadata").constData()) << sample.second << timestamp << metadata;
+    }
+}
+
+static void addDecodeRows(const QList< QPair<QByteArray, QVariant> > &samples)
+{
+    QTest::addColumn<QByteArray>("payload");
+    QTest::addColumn<int>("type");
+    QTest::addColumn<bool>("array");
+
+    for (const QPair<QByteArray, QVariant> &sample : samples) {
+        bool array = sample.second.type() == QVariant::List;
+        if (sample.second.type() == QVariant::Hash) {
+            // Consumers do not receive aggregates
+            continue;
+        }
+        int type = array ? sample.second.toList().value(0).type() : sample.second.type();
+        QTest::newRow(sample.first.constData()) << encodeSample(sample.second, QDateTime(), QVariantHash()) << type << array;
+    }
+}
+
+class BenchmarkConsumer : public Hyperspace::ProducerConsumer::ConsumerAbstractAdaptor
+{
+public:
+    explicit BenchmarkConsumer(Hyperdrive::AstarteTransport *astarteTransport)
+        : ConsumerAbstractAdaptor("org.astarteplatform.Benchmark", astarteTransport, nullptr) {}
+
+    bool decode(const QByteArray &payload, int type, bool array)
+    {
+        if (array) {
+            QList<QVariant> value;
+            return payloadToValue(payload, &value);
+        }
+
+        switch (type) {
+            case QMetaType::Bool: {
+                bool value;
+                return payloadToValue(payload, &value);
+            }
+            case QMetaType::Int: {
+                int value;
+                return payloadToValue(payload, &value);
+            }
+            case QMetaType::LongLong: {
+                qint64 value;
+                return payloadToValue(payload, &value);
+            }
+            case QMetaType::QByteArray: {
+                QByteArray value;
+                return payloadToValue(payload, &value);
+            }
+            case QMetaType::Double: {
+                double value;
+                return payloadToValue(payload, &value);
+            }
+            case QMetaType::QString: {
+                QString value;
+                return payloadToValue(payload, &value);
+            }
+            case QMetaType::QDateTime: {
+                QDateTime value;
+                return payloadToValue(payload, &value);
+            }
+            default:
+                return false;
+        }
+    }
+
+protected:
+    virtual void populateTokensAndStates() override final {}
+    virtual DispatchResult dispatch(int i, const QByteArray &value, const QList<QByteArray> &inputTokens) override final
+    {
+        Q_UNUSED(i);
+        Q_UNUSED(value);
+        Q_UNUSED(inputTokens);
+        return IndexNotFound;
+    }
+};
+
+class BSONBenchmarks : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void encode_data();
+    void encode();
+    void encodeLarge_data();
+    void encodeLarge();
+
+    void decode_data();
+    void decode();
+    void decodeLarge_data();
+    void decodeLarge();
+
+    void cacheMessageSerialize_data();
+    void cacheMessageSerialize();
+    void cacheMessageFromBinary_data();
+    void cacheMessageFromBinary();
+
+private:
+    void runEncode();
+    void runDecode();
+    static Hyperdrive::CacheMessage cacheMessageSample(int payloadSize, bool withAttributes);
+
+    Hyperdrive::AstarteTransport *m_transport;
+    BenchmarkConsumer *m_consumer;
+};
+
+void BSONBenchmarks::initTestCase()
+{
+    // The transport is never initialized, it only hosts the consumer
+    m_transport = new Hyperdrive::AstarteTransport(QString(), this);
+    m_consumer = new BenchmarkConsumer(m_transport);
+}
+
+void BSONBenchmarks::cleanupTestCase()
+{
+    delete m_consumer;
+}
+
+void BSONBenchmarks::runEncode()
+{
+    QFETCH(QVariant, value);
+    QFETCH(QDateTime, timestamp);
+    QFETCH(QVariantHash, metadata);
+
+    benchmark([&] {
+        s_sink += encodeSample(value, timestamp, metadata).size();
+    });
+}
+
+void BSONBenchmarks::runDecode()
+{
+    QFETCH(QByteArray, payload);
+    QFETCH(int, type);
+    QFETCH(bool, array);
+
+    QVERIFY(m_consumer->decode(payload, type, array));
+
+    benchmark([&] {
+        s_sink += m_consumer->decode(payload, type, array);
+    });
+}
+
+void BSONBenchmarks::encode_data()
+{
+    addEncodeRows(scalarAndArraySamples());
+}
+
+void BSONBenchmarks::encode()
+{
+    runEncode();
+}
+
+void BSONBenchmarks::encodeLarge_data()
+{
+    addEncodeRows(largeSamples());
+}
+
+void BSONBenchmarks::encodeLarge()
+{
+    runEncode();
+}
+
+void BSONBenchmarks::decode_data()
+{
+    addDecodeRows(scalarAndArraySamples());
+}
+
+void BSONBenchmarks::decode()
+{
+    runDecode();
+}
+
+void BSONBenchmarks::decodeLarge_data()
+{
+    addDecodeRows(largeSamples());
+}
+
+void BSONBenchmarks::decodeLarge()
+{
+    runDecode();
+}
+
+Hyperdrive::CacheMessage BSONBenchmarks::cacheMessageSample(int payloadSize, bool withAttributes)
+{
+    Hyperdrive::CacheMessage message;
+    message.setTarget("/org.astarteplatform.Benchmark/sensors/1/value");
+    message.setInterfaceType(Hyperdrive::Interface::Type::DataStream);
+    message.setPayload(encodeSample(QVariant(QByteArray(payloadSize, 'x')), QDateTime::currentDateTime(), QVariantHash()));
+
+    if (withAttributes) {
+        message.addAttribute("interfaceType", QByteArray::number(static_cast<int>(Hyperdrive::Interface::Type::DataStream)));
+        message.addAttribute("retention", QByteArray::number(static_cast<int>(Hyperspace::Retention::Stored)));
+        message.addAttribute("reliability", QByteArray::number(static_cast<int>(Hyperspace::Reliability::Guaranteed)));
+        message.addAttribute("absoluteExpiry", QByteArray::number(QDateTime::currentMSecsSinceEpoch()));
+    }
+
+    return message;
+}
+
+void BSONBenchmarks::cacheMessageSerialize_data()
+{
+    QTest::addColumn<int>("payloadSize");
+    QTest::addColumn<bool>("withAttributes");
+
+    QTest::newRow("small") << 16 << false;
+    QTest::newRow("small/attributes") << 16 << true;
+    QTest::newRow("1KiB/attributes") << 1024 << true;
+    QTest::newRow("1MiB/attributes") << LARGE_BLOB_SIZE << true;
+}
+
+void BSONBenchmarks::cacheMessageSerialize()
+{
+    QFETCH(int, payloadSize);
+    QFETCH(bool, withAttributes);
+
+    Hyperdrive::CacheMessage message = cacheMessageSample(payloadSize, withAttributes);
+
+    benchmark([&] {
+        s_sink += message.serialize().size();
+    });
+}
+
+void BSONBenchmarks::cacheMessageFromBinary_data()
+{
+    cacheMessageSerialize_data();
+}
+
+void BSONBenchmarks::cacheMessageFromBinary()
+{
+    QFETCH(int, payloadSize);
+    QFETCH(bool, withAttributes);
+
+    Hyperdrive::CacheMessage message = cacheMessageSample(payloadSize, withAttributes);
+    QByteArray serialized = message.serialize();
+    QCOMPARE(Hyperdrive::CacheMessage::fromBinary(serialized), message);
+
+    benchmark([&] {
+        s_sink += Hyperdrive::CacheMessage::fromBinary(serialized).payload().size();
+    });
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    // -allocations reports allocations/op instead of ns/op, every other argument goes to QtTest
+    QStringList arguments = app.arguments();
+    s_countAllocations = arguments.removeAll(QStringLiteral("-allocations")) > 0;
+
+    BSONBenchmarks benchmarks;
+    return QTest::qExec(&benchmarks, arguments);
+}
+
+#include "bson-benchmarks.moc"
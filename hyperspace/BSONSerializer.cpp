@@ -91,6 +91,11 @@ QByteArray BSONSerializer::document() const
     return m_doc;
 }
 
+void BSONSerializer::reserve(int size)
+{
+    m_doc.reserve(size);
+}
+
 void BSONSerializer::appendEndOfDocument()
 {
     m_doc.append('\0');
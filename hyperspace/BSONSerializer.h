@@ -37,6 +37,8 @@ class BSONSerializer
 
         QByteArray document() const;
 
+        void reserve(int size);
+
         void appendEndOfDocument();
 
         void appendDoubleValue(const char *name, double value);
@@ -0,0 +1,58 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "EncodedMetadata.h"
+
+#include "BSONSerializer.h"
+
+namespace Hyperspace {
+
+EncodedMetadata::EncodedMetadata()
+{
+}
+
+EncodedMetadata::EncodedMetadata(const QVariantHash &metadata)
+{
+    if (metadata.isEmpty()) {
+        return;
+    }
+
+    Util::BSONSerializer serializer;
+    for (QVariantHash::const_iterator i = metadata.constBegin(); i != metadata.constEnd(); ++i) {
+        serializer.appendValue(i.key().toLatin1().constData(), i.value());
+    }
+    serializer.appendEndOfDocument();
+    m_document = serializer.document();
+}
+
+bool EncodedMetadata::operator==(const EncodedMetadata &other) const
+{
+    return m_document == other.m_document;
+}
+
+bool EncodedMetadata::isEmpty() const
+{
+    return m_document.isEmpty();
+}
+
+QByteArray EncodedMetadata::document() const
+{
+    return m_document;
+}
+
+}
@@ -0,0 +1,64 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HYPERSPACE_ENCODEDMETADATA_H
+#define HYPERSPACE_ENCODEDMETADATA_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QVariantHash>
+
+#include <HyperspaceCore/Global>
+
+namespace Hyperspace {
+
+/**
+ * @class EncodedMetadata
+ * @ingroup HyperspaceCore
+ * @headerfile HyperspaceCore/hyperspaceglobal.h <HyperspaceCore/EncodedMetadata>
+ *
+ * @brief A metadata block encoded once as a BSON document.
+ *
+ * Metadata attached to samples is usually the same for every send. Building an EncodedMetadata
+ * once and passing it to sendData avoids encoding the QVariantHash again for every sample: the
+ * serializer appends the prebuilt document as it is.
+ *
+ * The sendData overloads taking a QVariantHash are kept, and keep encoding it on every call.
+ */
+class HYPERSPACE_QT5_EXPORT EncodedMetadata {
+public:
+    /**
+     * @brief Constructs an empty EncodedMetadata
+     */
+    EncodedMetadata();
+    explicit EncodedMetadata(const QVariantHash &metadata);
+
+    bool operator==(const EncodedMetadata &other) const;
+    inline bool operator!=(const EncodedMetadata &other) const { return !operator==(other); }
+
+    bool isEmpty() const;
+
+    /// The encoded BSON document, empty if there is no metadata
+    QByteArray document() const;
+
+private:
+    QByteArray m_document;
+};
+
+}
+
+#endif // HYPERSPACE_ENCODEDMETADATA_H
@@ -27,6 +27,12 @@
 
 #define METHOD_ERROR "ERROR"
 
+// Sizes of the envelope built around a value named "v", "t" or "m"
+#define BSON_DOCUMENT_OVERHEAD (4 + 1)
+#define BSON_BINARY_VALUE_OVERHEAD (1 + 2 + 4 + 1)
+#define BSON_DATETIME_VALUE_SIZE (1 + 2 + 8)
+#define BSON_DOCUMENT_VALUE_OVERHEAD (1 + 2)
+
 Q_LOGGING_CATEGORY(producerConsumerDC, "hyperspace.producerconsumer", DEBUG_MESSAGES_DEFAULT_LEVEL)
 
 namespace Hyperspace
@@ -157,22 +163,32 @@ void ProducerAbstractInterface::sendRawDataOnEndpoint(const QByteArray &value, c
 }
 
 void ProducerAbstractInterface::sendDataOnEndpoint(const QByteArray &value, const QByteArray &target,
-        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata)
 {
+    // Size the buffer exactly, so that large blobs are copied only once into the envelope
+    int size = BSON_DOCUMENT_OVERHEAD + BSON_BINARY_VALUE_OVERHEAD + value.size();
+    if (!timestamp.isNull() && timestamp.isValid()) {
+        size += BSON_DATETIME_VALUE_SIZE;
+    }
+    if (!metadata.isEmpty()) {
+        size += BSON_DOCUMENT_VALUE_OVERHEAD + metadata.document().size();
+    }
+
     Util::BSONSerializer serializer;
+    serializer.reserve(size);
     serializer.appendBinaryValue("v", value);
     if (!timestamp.isNull() && timestamp.isValid()) {
         serializer.appendDateTime("t", timestamp);
     }
     if (!metadata.isEmpty()) {
-        serializer.appendDocument("m", metadata);
+        serializer.appendDocument("m", metadata.document());
     }
     serializer.appendEndOfDocument();
     sendRawDataOnEndpoint(serializer.document(), target, attributes);
 }
 
 void ProducerAbstractInterface::sendDataOnEndpoint(double value, const QByteArray &target,
-        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata)
 {
     Util::BSONSerializer serializer;
     serializer.appendDoubleValue("v", value);
@@ -180,14 +196,14 @@ void ProducerAbstractInterface::sendDataOnEndpoint(double value, const QByteArra
         serializer.appendDateTime("t", timestamp);
     }
     if (!metadata.isEmpty()) {
-        serializer.appendDocument("m", metadata);
+        serializer.appendDocument("m", metadata.document());
     }
     serializer.appendEndOfDocument();
     sendRawDataOnEndpoint(serializer.document(), target, attributes);
 }
 
 void ProducerAbstractInterface::sendDataOnEndpoint(int value, const QByteArray &target,
-        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata)
 {
     Util::BSONSerializer serializer;
     serializer.appendInt32Value("v", value);
@@ -195,14 +211,14 @@ void ProducerAbstractInterface::sendDataOnEndpoint(int value, const QByteArray &
         serializer.appendDateTime("t", timestamp);
     }
     if (!metadata.isEmpty()) {
-        serializer.appendDocument("m", metadata);
+        serializer.appendDocument("m", metadata.document());
     }
     serializer.appendEndOfDocument();
     sendRawDataOnEndpoint(serializer.document(), target, attributes);
 }
 
 void ProducerAbstractInterface::sendDataOnEndpoint(qint64 value, const QByteArray &target, const QHash<QByteArray,
-        QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+        QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata)
 {
     Util::BSONSerializer serializer;
     serializer.appendInt64Value("v", value);
@@ -210,14 +226,14 @@ void ProducerAbstractInterface::sendDataOnEndpoint(qint64 value, const QByteArra
         serializer.appendDateTime("t", timestamp);
     }
     if (!metadata.isEmpty()) {
-        serializer.appendDocument("m", metadata);
+        serializer.appendDocument("m", metadata.document());
     }
     serializer.appendEndOfDocument();
     sendRawDataOnEndpoint(serializer.document(), target, attributes);
 }
 
 void ProducerAbstractInterface::sendDataOnEndpoint(bool value, const QByteArray &target,
-        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata)
 {
     Util::BSONSerializer serializer;
     serializer.appendBooleanValue("v", value);
@@ -225,14 +241,14 @@ void ProducerAbstractInterface::sendDataOnEndpoint(bool value, const QByteArray
         serializer.appendDateTime("t", timestamp);
     }
     if (!metadata.isEmpty()) {
-        serializer.appendDocument("m", metadata);
+        serializer.appendDocument("m", metadata.document());
     }
     serializer.appendEndOfDocument();
     sendRawDataOnEndpoint(serializer.document(), target, attributes);
 }
 
 void ProducerAbstractInterface::sendDataOnEndpoint(const QString &value, const QByteArray &target,
-        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata)
 {
     Util::BSONSerializer serializer;
     serializer.appendString("v", value);
@@ -240,14 +256,14 @@ void ProducerAbstractInterface::sendDataOnEndpoint(const QString &value, const Q
         serializer.appendDateTime("t", timestamp);
     }
     if (!metadata.isEmpty()) {
-        serializer.appendDocument("m", metadata);
+        serializer.appendDocument("m", metadata.document());
     }
     serializer.appendEndOfDocument();
     sendRawDataOnEndpoint(serializer.document(), target, attributes);
 }
 
 void ProducerAbstractInterface::sendDataOnEndpoint(const QDateTime &value, const QByteArray &target,
-        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata)
 {
     Util::BSONSerializer serializer;
     serializer.appendDateTime("v", value);
@@ -255,14 +271,14 @@ void ProducerAbstractInterface::sendDataOnEndpoint(const QDateTime &value, const
         serializer.appendDateTime("t", timestamp);
     }
     if (!metadata.isEmpty()) {
-        serializer.appendDocument("m", metadata);
+        serializer.appendDocument("m", metadata.document());
     }
     serializer.appendEndOfDocument();
     sendRawDataOnEndpoint(serializer.document(), target, attributes);
 }
 
 void ProducerAbstractInterface::sendDataOnEndpoint(const QVariantHash &value, const QByteArray &target,
-        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata)
 {
     Util::BSONSerializer serializer;
     serializer.appendDocument("v", value);
@@ -270,14 +286,14 @@ void ProducerAbstractInterface::sendDataOnEndpoint(const QVariantHash &value, co
         serializer.appendDateTime("t", timestamp);
     }
     if (!metadata.isEmpty()) {
-        serializer.appendDocument("m", metadata);
+        serializer.appendDocument("m", metadata.document());
     }
     serializer.appendEndOfDocument();
     sendRawDataOnEndpoint(serializer.document(), target, attributes);
 }
 
 void ProducerAbstractInterface::sendDataOnEndpoint(QList<QVariant> value, const QByteArray &target,
-        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata)
 {
     Util::BSONSerializer serializer;
     serializer.appendArray("v", value);
@@ -285,12 +301,66 @@ void ProducerAbstractInterface::sendDataOnEndpoint(QList<QVariant> value, const
         serializer.appendDateTime("t", timestamp);
     }
     if (!metadata.isEmpty()) {
-        serializer.appendDocument("m", metadata);
+        serializer.appendDocument("m", metadata.document());
     }
     serializer.appendEndOfDocument();
     sendRawDataOnEndpoint(serializer.document(), target, attributes);
 }
 
+void ProducerAbstractInterface::sendDataOnEndpoint(const QByteArray &value, const QByteArray &target,
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    sendDataOnEndpoint(value, target, attributes, timestamp, EncodedMetadata(metadata));
+}
+
+void ProducerAbstractInterface::sendDataOnEndpoint(double value, const QByteArray &target,
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    sendDataOnEndpoint(value, target, attributes, timestamp, EncodedMetadata(metadata));
+}
+
+void ProducerAbstractInterface::sendDataOnEndpoint(int value, const QByteArray &target,
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    sendDataOnEndpoint(value, target, attributes, timestamp, EncodedMetadata(metadata));
+}
+
+void ProducerAbstractInterface::sendDataOnEndpoint(qint64 value, const QByteArray &target,
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    sendDataOnEndpoint(value, target, attributes, timestamp, EncodedMetadata(metadata));
+}
+
+void ProducerAbstractInterface::sendDataOnEndpoint(bool value, const QByteArray &target,
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    sendDataOnEndpoint(value, target, attributes, timestamp, EncodedMetadata(metadata));
+}
+
+void ProducerAbstractInterface::sendDataOnEndpoint(const QString &value, const QByteArray &target,
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    sendDataOnEndpoint(value, target, attributes, timestamp, EncodedMetadata(metadata));
+}
+
+void ProducerAbstractInterface::sendDataOnEndpoint(const QDateTime &value, const QByteArray &target,
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    sendDataOnEndpoint(value, target, attributes, timestamp, EncodedMetadata(metadata));
+}
+
+void ProducerAbstractInterface::sendDataOnEndpoint(const QVariantHash &value, const QByteArray &target,
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    sendDataOnEndpoint(value, target, attributes, timestamp, EncodedMetadata(metadata));
+}
+
+void ProducerAbstractInterface::sendDataOnEndpoint(QList<QVariant> value, const QByteArray &target,
+        const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const QVariantHash &metadata)
+{
+    sendDataOnEndpoint(value, target, attributes, timestamp, EncodedMetadata(metadata));
+}
+
 bool ProducerAbstractInterface::payloadToValue(const QByteArray &payload, QByteArray *value)
 {
     Util::BSONDocument doc(payload);
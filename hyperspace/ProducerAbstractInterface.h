@@ -20,6 +20,7 @@
 #define _HYPERSPACE_PLUS_PROVIDERABSTRACTINTERFACE_H_
 
 #include <HyperspaceCore/AbstractWaveTarget>
+#include <HyperspaceCore/EncodedMetadata>
 
 #include <QtCore/QDateTime>
 
@@ -94,6 +95,27 @@ class ProducerAbstractInterface : public AbstractWaveTarget
         void sendDataOnEndpoint(QList<QVariant> value, const QByteArray &target,
             const QHash<QByteArray, QByteArray> &attributes = QHash<QByteArray, QByteArray>(), const QDateTime &timestamp = QDateTime(), const QVariantHash &metadata = QVariantHash());
 
+        // Metadata encoded once, for samples sent with the same metadata
+        void sendDataOnEndpoint(const QByteArray &value, const QByteArray &target,
+            const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata);
+        void sendDataOnEndpoint(double value, const QByteArray &target,
+            const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata);
+        void sendDataOnEndpoint(int value, const QByteArray &target,
+            const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata);
+        void sendDataOnEndpoint(qint64 value, const QByteArray &target,
+            const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata);
+        void sendDataOnEndpoint(bool value, const QByteArray &target,
+            const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata);
+        void sendDataOnEndpoint(const QString &value, const QByteArray &target,
+            const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata);
+        void sendDataOnEndpoint(const QDateTime &value, const QByteArray &target,
+            const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata);
+        void sendDataOnEndpoint(const QVariantHash &value, const QByteArray &target,
+            const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata);
+
+        void sendDataOnEndpoint(QList<QVariant> value, const QByteArray &target,
+            const QHash<QByteArray, QByteArray> &attributes, const QDateTime &timestamp, const EncodedMetadata &metadata);
+
         bool payloadToValue(const QByteArray &payload, QByteArray *value);
         bool payloadToValue(const QByteArray &payload, int *value);
         bool payloadToValue(const QByteArray &payload, qint64 *value);
@@ -0,0 +1,36 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hyperdriveabstractmqttclientwrapper.h"
+
+#include <hemeraasyncinitobject_p.h>
+
+namespace Hyperdrive {
+
+AbstractMQTTClientWrapper::AbstractMQTTClientWrapper(Hemera::AsyncInitObjectPrivate &dd, QObject *parent)
+    : AsyncInitObject(dd, parent)
+{
+}
+
+AbstractMQTTClientWrapper::~AbstractMQTTClientWrapper()
+{
+}
+
+}
+
+#include "moc_hyperdriveabstractmqttclientwrapper.cpp"
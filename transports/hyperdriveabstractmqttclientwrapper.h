@@ -0,0 +1,103 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HYPERDRIVE_ABSTRACTMQTTCLIENTWRAPPER_H
+#define HYPERDRIVE_ABSTRACTMQTTCLIENTWRAPPER_H
+
+#include <HemeraCore/AsyncInitObject>
+
+#include <QtCore/QDateTime>
+#include <QtCore/QList>
+#include <QtCore/QVector>
+
+namespace Hyperdrive {
+
+// The MQTT client AstarteTransport depends on. MQTTClientWrapper, backed by libmosquitto, is the default
+// implementation, LoopbackMQTTClientWrapper is an in-process broker for tests and benchmarks.
+class AbstractMQTTClientWrapper : public Hemera::AsyncInitObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(AbstractMQTTClientWrapper)
+
+    Q_PROPERTY(Status status READ status NOTIFY statusChanged)
+
+public:
+    enum Status {
+        UnknownStatus = 0,
+        DisconnectedStatus = 1,
+        ConnectedStatus = 2,
+        ConnectingStatus = 3,
+        DisconnectingStatus = 4,
+        ReconnectingStatus = 5
+    };
+    Q_ENUM(Status);
+    enum MQTTQoS {
+        AtMostOnceQoS = 0,
+        AtLeastOnceQoS = 1,
+        ExactlyOnceQoS = 2,
+        DefaultQoS = 99
+    };
+    Q_ENUM(MQTTQoS);
+    enum MQTTProtocolVersion {
+        MQTT311ProtocolVersion = 4,
+        MQTT5ProtocolVersion = 5
+    };
+    Q_ENUM(MQTTProtocolVersion);
+
+    virtual ~AbstractMQTTClientWrapper();
+
+    virtual Status status() const = 0;
+    virtual QByteArray hardwareId() const = 0;
+    virtual QByteArray rootClientTopic() const = 0;
+    virtual QDateTime clientCertificateExpiry() const = 0;
+    virtual bool sessionPresent() const = 0;
+
+    virtual void setKeepAlive(quint64 seconds) = 0;
+    virtual void setEventLoopIO(bool eventLoopIO) = 0;
+    virtual void setMaxInFlightMessages(int maxInFlightMessages) = 0;
+    virtual void setProtocolVersion(MQTTProtocolVersion protocolVersion) = 0;
+    virtual MQTTProtocolVersion protocolVersion() const = 0;
+
+    // Returns the message id, or a value <= 0 on failure
+    virtual int publish(const QByteArray &topic, const QByteArray &payload, MQTTQoS qos = DefaultQoS, bool retained = false) = 0;
+    virtual void subscribe(const QByteArray &topic, MQTTQoS qos = DefaultQoS) = 0;
+    virtual bool subscribe(const QList<QByteArray> &topics, MQTTQoS qos = DefaultQoS) = 0;
+    virtual bool unsubscribe(const QList<QByteArray> &topics) = 0;
+
+public Q_SLOTS:
+    virtual bool connectToBroker() = 0;
+    virtual bool disconnectFromBroker() = 0;
+
+protected:
+    explicit AbstractMQTTClientWrapper(Hemera::AsyncInitObjectPrivate &dd, QObject *parent = nullptr);
+
+Q_SIGNALS:
+    void messageReceived(const QByteArray &topic, const QByteArray &payload);
+    void statusChanged(Hyperdrive::AbstractMQTTClientWrapper::Status status);
+    void connectionLost(const QString &cause);
+    void publishConfirmed(int mid);
+    // Every confirmation collected since the previous batch, in confirmation order
+    void publishesConfirmed(const QVector<int> &mids);
+    void connectionFailed();
+    void connectionStarted();
+    void connackReceived();
+    void connackTimeout();
+};
+}
+
+#endif // HYPERDRIVE_ABSTRACTMQTTCLIENTWRAPPER_H
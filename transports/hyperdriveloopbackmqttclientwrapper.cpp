@@ -0,0 +1,476 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hyperdriveloopbackmqttclientwrapper.h"
+#include "hyperdriveloopbackmqttclientwrapper_p.h"
+
+#include <QtCore/QLoggingCategory>
+
+Q_LOGGING_CATEGORY(loopbackMqttDC, "hyperdrive.loopbackmqttclientwrapper", DEBUG_MESSAGES_DEFAULT_LEVEL)
+
+#define MAX_MESSAGE_ID 65535
+
+namespace Hyperdrive {
+
+void LoopbackMQTTClientWrapperPrivate::setStatus(LoopbackMQTTClientWrapper::Status s)
+{
+    Q_Q(LoopbackMQTTClientWrapper);
+
+    if (status != s) {
+        status = s;
+        Q_EMIT q->statusChanged(status);
+    }
+}
+
+int LoopbackMQTTClientWrapperPrivate::takeMid()
+{
+    int mid = nextMid;
+    nextMid = nextMid == MAX_MESSAGE_ID ? 1 : nextMid + 1;
+    return mid;
+}
+
+void LoopbackMQTTClientWrapperPrivate::enqueue(const LoopbackMessage &message)
+{
+    messages.enqueue(message);
+    scheduleDelivery();
+}
+
+void LoopbackMQTTClientWrapperPrivate::confirm(int mid)
+{
+    confirmedPublishes.append(mid);
+    // Confirmations are batched until the event loop runs again, like the ones of the mosquitto thread
+    if (!confirmTimer->isActive()) {
+        confirmTimer->start();
+    }
+}
+
+void LoopbackMQTTClientWrapperPrivate::scheduleDelivery()
+{
+    if (messages.isEmpty() || deliveryTimer->isActive()) {
+        return;
+    }
+
+    deliveryTimer->start(static_cast<int>(qMax(qint64(0), messages.head().due - clock.elapsed())));
+}
+
+void LoopbackMQTTClientWrapperPrivate::deliverMessages()
+{
+    Q_Q(LoopbackMQTTClientWrapper);
+
+    qint64 now = clock.elapsed();
+    // The handlers might publish, or disconnect and empty the queue
+    while (!messages.isEmpty() && messages.head().due <= now) {
+        LoopbackMessage message = messages.dequeue();
+        if (message.echo) {
+            Q_EMIT q->messageReceived(message.topic, message.payload);
+        }
+        if (message.mid > 0) {
+            confirm(message.mid);
+        }
+    }
+
+    scheduleDelivery();
+}
+
+void LoopbackMQTTClientWrapperPrivate::deliverConfirmedPublishes()
+{
+    Q_Q(LoopbackMQTTClientWrapper);
+
+    QVector<int> mids;
+    mids.swap(confirmedPublishes);
+    if (mids.isEmpty()) {
+        return;
+    }
+
+    Q_EMIT q->publishesConfirmed(mids);
+    for (int mid : mids) {
+        Q_EMIT q->publishConfirmed(mid);
+    }
+}
+
+void LoopbackMQTTClientWrapperPrivate::connected()
+{
+    Q_Q(LoopbackMQTTClientWrapper);
+
+    sessionPresent = hasSession;
+    hasSession = true;
+
+    // Unacknowledged messages are resent before anything else, as mosquitto does
+    qint64 due = clock.elapsed() + latency;
+    while (!unacknowledged.isEmpty()) {
+        LoopbackMessage message = unacknowledged.dequeue();
+        message.due = due;
+        message.echo = isSubscribed(message.topic);
+        messages.enqueue(message);
+    }
+    scheduleDelivery();
+
+    if (disconnectInterval > 0) {
+        disconnectTimer->start(disconnectInterval);
+    }
+
+    Q_EMIT q->connackReceived();
+    setStatus(LoopbackMQTTClientWrapper::ConnectedStatus);
+}
+
+void LoopbackMQTTClientWrapperPrivate::dropConnection(const QString &cause)
+{
+    Q_Q(LoopbackMQTTClientWrapper);
+
+    disconnectTimer->stop();
+    deliveryTimer->stop();
+
+    // QoS 0 messages are gone with the connection, the others wait for the next one
+    while (!messages.isEmpty()) {
+        LoopbackMessage message = messages.dequeue();
+        if (message.mid > 0) {
+            unacknowledged.enqueue(message);
+        }
+    }
+
+    if (status != LoopbackMQTTClientWrapper::ConnectedStatus) {
+        return;
+    }
+
+    ++droppedConnections;
+    qCInfo(loopbackMqttDC) << "Dropping the connection:" << cause;
+    Q_EMIT q->connectionLost(cause);
+    setStatus(LoopbackMQTTClientWrapper::ReconnectingStatus);
+    connectTimer->start(reconnectionDelay);
+}
+
+bool LoopbackMQTTClientWrapperPrivate::isSubscribed(const QByteArray &topic) const
+{
+    if (subscriptions.contains(topic)) {
+        return true;
+    }
+
+    for (const QByteArray &filter : subscriptions) {
+        if (topicMatches(filter, topic)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LoopbackMQTTClientWrapperPrivate::topicMatches(const QByteArray &filter, const QByteArray &topic)
+{
+    QList<QByteArray> filterLevels = filter.split('/');
+    QList<QByteArray> topicLevels = topic.split('/');
+
+    for (int i = 0; i < filterLevels.size(); ++i) {
+        if (filterLevels.at(i) == "#") {
+            return true;
+        }
+        if (i >= topicLevels.size() || (filterLevels.at(i) != "+" && filterLevels.at(i) != topicLevels.at(i))) {
+            return false;
+        }
+    }
+    return filterLevels.size() == topicLevels.size();
+}
+
+LoopbackMQTTClientWrapper::LoopbackMQTTClientWrapper(const QByteArray &clientId, QObject *parent)
+    : AbstractMQTTClientWrapper(*new LoopbackMQTTClientWrapperPrivate(this), parent)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+    d->clientId = clientId;
+}
+
+LoopbackMQTTClientWrapper::~LoopbackMQTTClientWrapper()
+{
+}
+
+void LoopbackMQTTClientWrapper::setLatency(int msecs)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+    d->latency = qMax(0, msecs);
+}
+
+void LoopbackMQTTClientWrapper::setLossRate(double lossRate)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+    d->lossRate = qBound(0.0, lossRate, 1.0);
+}
+
+void LoopbackMQTTClientWrapper::setDisconnectInterval(int msecs)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+    d->disconnectInterval = qMax(0, msecs);
+}
+
+void LoopbackMQTTClientWrapper::setReconnectionDelay(int msecs)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+    d->reconnectionDelay = qMax(0, msecs);
+}
+
+void LoopbackMQTTClientWrapper::setSeed(quint32 seed)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+    d->random.seed(seed);
+}
+
+void LoopbackMQTTClientWrapper::injectMessage(const QByteArray &topic, const QByteArray &payload)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+
+    if (Q_UNLIKELY(!d->deliveryTimer)) {
+        qCWarning(loopbackMqttDC) << "Attempted to inject a message before initializing the client!";
+        return;
+    }
+
+    if (d->status == ConnectedStatus && d->isSubscribed(topic)) {
+        d->enqueue({d->clock.elapsed() + d->latency, 0, topic, payload, true});
+    }
+}
+
+quint64 LoopbackMQTTClientWrapper::publishedMessages() const
+{
+    Q_D(const LoopbackMQTTClientWrapper);
+    return d->publishedMessages;
+}
+
+quint64 LoopbackMQTTClientWrapper::lostMessages() const
+{
+    Q_D(const LoopbackMQTTClientWrapper);
+    return d->lostMessages;
+}
+
+quint64 LoopbackMQTTClientWrapper::droppedConnections() const
+{
+    Q_D(const LoopbackMQTTClientWrapper);
+    return d->droppedConnections;
+}
+
+LoopbackMQTTClientWrapper::Status LoopbackMQTTClientWrapper::status() const
+{
+    Q_D(const LoopbackMQTTClientWrapper);
+    return d->status;
+}
+
+QByteArray LoopbackMQTTClientWrapper::hardwareId() const
+{
+    Q_D(const LoopbackMQTTClientWrapper);
+    return d->clientId;
+}
+
+QByteArray LoopbackMQTTClientWrapper::rootClientTopic() const
+{
+    Q_D(const LoopbackMQTTClientWrapper);
+    return d->clientId;
+}
+
+QDateTime LoopbackMQTTClientWrapper::clientCertificateExpiry() const
+{
+    return QDateTime();
+}
+
+bool LoopbackMQTTClientWrapper::sessionPresent() const
+{
+    Q_D(const LoopbackMQTTClientWrapper);
+    return d->sessionPresent;
+}
+
+void LoopbackMQTTClientWrapper::setKeepAlive(quint64 seconds)
+{
+    // Nothing to keep alive
+    Q_UNUSED(seconds);
+}
+
+void LoopbackMQTTClientWrapper::setEventLoopIO(bool eventLoopIO)
+{
+    // Always driven by the event loop
+    Q_UNUSED(eventLoopIO);
+}
+
+void LoopbackMQTTClientWrapper::setMaxInFlightMessages(int maxInFlightMessages)
+{
+    // The broker never holds messages back
+    Q_UNUSED(maxInFlightMessages);
+}
+
+void LoopbackMQTTClientWrapper::setProtocolVersion(MQTTProtocolVersion protocolVersion)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+    d->protocolVersion = protocolVersion;
+}
+
+LoopbackMQTTClientWrapper::MQTTProtocolVersion LoopbackMQTTClientWrapper::protocolVersion() const
+{
+    Q_D(const LoopbackMQTTClientWrapper);
+    return d->protocolVersion;
+}
+
+void LoopbackMQTTClientWrapper::initImpl()
+{
+    Q_D(LoopbackMQTTClientWrapper);
+
+    d->deliveryTimer = new QTimer(this);
+    d->deliveryTimer->setSingleShot(true);
+    connect(d->deliveryTimer, &QTimer::timeout, this, [d] {
+        d->deliverMessages();
+    });
+    d->confirmTimer = new QTimer(this);
+    d->confirmTimer->setSingleShot(true);
+    d->confirmTimer->setInterval(0);
+    connect(d->confirmTimer, &QTimer::timeout, this, [d] {
+        d->deliverConfirmedPublishes();
+    });
+    d->connectTimer = new QTimer(this);
+    d->connectTimer->setSingleShot(true);
+    connect(d->connectTimer, &QTimer::timeout, this, [d] {
+        d->connected();
+    });
+    d->disconnectTimer = new QTimer(this);
+    d->disconnectTimer->setSingleShot(true);
+    connect(d->disconnectTimer, &QTimer::timeout, this, [d] {
+        d->dropConnection(QStringLiteral("Simulated connection drop"));
+    });
+
+    d->clock.start();
+
+    setReady();
+}
+
+bool LoopbackMQTTClientWrapper::connectToBroker()
+{
+    Q_D(LoopbackMQTTClientWrapper);
+
+    if (Q_UNLIKELY(!d->connectTimer)) {
+        qCWarning(loopbackMqttDC) << "Attempted to connect before initializing the client!";
+        return false;
+    }
+
+    switch (d->status) {
+        // We are already connecting
+        case ConnectingStatus:
+        case ConnectedStatus:
+        case ReconnectingStatus: {
+            return true;
+        }
+
+        default: {
+            d->setStatus(ConnectingStatus);
+            Q_EMIT connectionStarted();
+            // The CONNACK takes the same time as any other answer of the broker
+            d->connectTimer->start(d->latency);
+            return true;
+        }
+    }
+}
+
+bool LoopbackMQTTClientWrapper::disconnectFromBroker()
+{
+    Q_D(LoopbackMQTTClientWrapper);
+
+    if (d->status == DisconnectedStatus || !d->connectTimer) {
+        return true;
+    }
+
+    d->setStatus(DisconnectingStatus);
+    d->connectTimer->stop();
+    d->dropConnection(QStringLiteral("Disconnected"));
+    d->setStatus(DisconnectedStatus);
+    return true;
+}
+
+int LoopbackMQTTClientWrapper::publish(const QByteArray &topic, const QByteArray &payload, MQTTQoS lqos, bool retained)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+    Q_UNUSED(retained);
+
+    if (Q_UNLIKELY(!d->deliveryTimer)) {
+        qCWarning(loopbackMqttDC) << "Attempted to call publish before initializing the client!";
+        return -1;
+    }
+
+    int qos = lqos == DefaultQoS ? AtLeastOnceQoS : static_cast<int>(lqos);
+    if (qos == AtMostOnceQoS && d->status != ConnectedStatus) {
+        qCWarning(loopbackMqttDC) << "Failed to publish a QoS 0 message while not connected";
+        return -1;
+    }
+
+    int mid = d->takeMid();
+    ++d->publishedMessages;
+    LoopbackMessage message = {d->clock.elapsed() + d->latency, qos == AtMostOnceQoS ? 0 : mid, topic, payload, false};
+
+    if (d->status != ConnectedStatus) {
+        // Sent once connected, like mosquitto does
+        d->unacknowledged.enqueue(message);
+        return mid;
+    }
+
+    std::uniform_real_distribution<double> roll(0.0, 1.0);
+    bool lost = d->lossRate > 0 && roll(d->random) < d->lossRate;
+    if (lost) {
+        ++d->lostMessages;
+    }
+
+    if (qos == AtMostOnceQoS) {
+        // mosquitto confirms QoS 0 messages once they are written, whether they arrive or not
+        d->confirm(mid);
+        if (!lost && d->isSubscribed(topic)) {
+            message.echo = true;
+            d->enqueue(message);
+        }
+    } else if (lost) {
+        // The broker never answers: the connection times out and the message is sent again on the next one.
+        // Dropped once publish returned, the caller does not expect its status to change meanwhile.
+        d->unacknowledged.enqueue(message);
+        QTimer::singleShot(0, this, [d] {
+            d->dropConnection(QStringLiteral("Simulated message loss"));
+        });
+    } else {
+        message.echo = d->isSubscribed(topic);
+        d->enqueue(message);
+    }
+
+    return mid;
+}
+
+void LoopbackMQTTClientWrapper::subscribe(const QByteArray &topic, MQTTQoS qos)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+    Q_UNUSED(qos);
+    d->subscriptions.insert(topic);
+}
+
+bool LoopbackMQTTClientWrapper::subscribe(const QList<QByteArray> &topics, MQTTQoS qos)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+    Q_UNUSED(qos);
+
+    for (const QByteArray &topic : topics) {
+        d->subscriptions.insert(topic);
+    }
+    return true;
+}
+
+bool LoopbackMQTTClientWrapper::unsubscribe(const QList<QByteArray> &topics)
+{
+    Q_D(LoopbackMQTTClientWrapper);
+
+    for (const QByteArray &topic : topics) {
+        d->subscriptions.remove(topic);
+    }
+    return true;
+}
+
+}
+
+#include "moc_hyperdriveloopbackmqttclientwrapper.cpp"
@@ -0,0 +1,84 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HYPERDRIVE_LOOPBACKMQTTCLIENTWRAPPER_H
+#define HYPERDRIVE_LOOPBACKMQTTCLIENTWRAPPER_H
+
+#include "hyperdriveabstractmqttclientwrapper.h"
+
+namespace Hyperdrive {
+
+class LoopbackMQTTClientWrapperPrivate;
+// An in-process broker: publishes are acknowledged and echoed to matching subscriptions without any
+// network, so that the SDK stack can be tested and benchmarked hermetically.
+class LoopbackMQTTClientWrapper : public AbstractMQTTClientWrapper
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(LoopbackMQTTClientWrapper)
+    Q_DECLARE_PRIVATE_D(d_h_ptr, LoopbackMQTTClientWrapper)
+
+public:
+    explicit LoopbackMQTTClientWrapper(const QByteArray &clientId, QObject *parent = nullptr);
+    virtual ~LoopbackMQTTClientWrapper();
+
+    /// Time the broker takes to acknowledge a QoS 1 or 2 message, and to deliver a message.
+    void setLatency(int msecs);
+    /// Fraction of publishes lost on the way, between 0 and 1. A lost QoS 0 message is confirmed but never
+    /// delivered, a lost QoS 1 or 2 message drops the connection and is acknowledged after reconnecting.
+    void setLossRate(double lossRate);
+    /// Interval between dropped connections, 0 never drops it.
+    void setDisconnectInterval(int msecs);
+    /// Delay before reconnecting after the connection dropped.
+    void setReconnectionDelay(int msecs);
+    /// Seed of the losses, to make runs reproducible.
+    void setSeed(quint32 seed);
+
+    /// Delivers a message as if a server published it, if a subscription matches the topic.
+    void injectMessage(const QByteArray &topic, const QByteArray &payload);
+
+    quint64 publishedMessages() const;
+    quint64 lostMessages() const;
+    quint64 droppedConnections() const;
+
+    virtual Status status() const override;
+    virtual QByteArray hardwareId() const override;
+    virtual QByteArray rootClientTopic() const override;
+    virtual QDateTime clientCertificateExpiry() const override;
+    virtual bool sessionPresent() const override;
+
+    virtual void setKeepAlive(quint64 seconds) override;
+    virtual void setEventLoopIO(bool eventLoopIO) override;
+    virtual void setMaxInFlightMessages(int maxInFlightMessages) override;
+    virtual void setProtocolVersion(MQTTProtocolVersion protocolVersion) override;
+    virtual MQTTProtocolVersion protocolVersion() const override;
+
+    virtual int publish(const QByteArray &topic, const QByteArray &payload, MQTTQoS qos = DefaultQoS, bool retained = false) override;
+    virtual void subscribe(const QByteArray &topic, MQTTQoS qos = DefaultQoS) override;
+    virtual bool subscribe(const QList<QByteArray> &topics, MQTTQoS qos = DefaultQoS) override;
+    virtual bool unsubscribe(const QList<QByteArray> &topics) override;
+
+public Q_SLOTS:
+    virtual bool connectToBroker() override;
+    virtual bool disconnectFromBroker() override;
+
+protected:
+    virtual void initImpl() override final;
+};
+}
+
+#endif // HYPERDRIVE_LOOPBACKMQTTCLIENTWRAPPER_H
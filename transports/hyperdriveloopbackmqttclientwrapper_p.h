@@ -0,0 +1,118 @@
+/*
+ * This file is part of Astarte.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HYPERDRIVE_LOOPBACKMQTTCLIENTWRAPPER_P_H
+#define HYPERDRIVE_LOOPBACKMQTTCLIENTWRAPPER_P_H
+
+#include "hyperdriveloopbackmqttclientwrapper.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QQueue>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+
+#include <hemeraasyncinitobject_p.h>
+
+#include <random>
+
+namespace Hyperdrive {
+
+// A message on its way through the broker
+struct LoopbackMessage
+{
+    qint64 due;
+    // 0 for messages which need no acknowledgement
+    int mid;
+    QByteArray topic;
+    QByteArray payload;
+    // Whether a subscription of the client matches the topic
+    bool echo;
+};
+
+class LoopbackMQTTClientWrapperPrivate : public Hemera::AsyncInitObjectPrivate
+{
+public:
+    LoopbackMQTTClientWrapperPrivate(LoopbackMQTTClientWrapper *q) : Hemera::AsyncInitObjectPrivate(q)
+                                                                   , status(LoopbackMQTTClientWrapper::DisconnectedStatus)
+                                                                   , sessionPresent(false)
+                                                                   , hasSession(false)
+                                                                   , protocolVersion(LoopbackMQTTClientWrapper::MQTT311ProtocolVersion)
+                                                                   , latency(0)
+                                                                   , lossRate(0)
+                                                                   , disconnectInterval(0)
+                                                                   , reconnectionDelay(100)
+                                                                   , nextMid(1)
+                                                                   , deliveryTimer(nullptr)
+                                                                   , confirmTimer(nullptr)
+                                                                   , connectTimer(nullptr)
+                                                                   , disconnectTimer(nullptr)
+                                                                   , publishedMessages(0)
+                                                                   , lostMessages(0)
+                                                                   , droppedConnections(0) {}
+
+    Q_DECLARE_PUBLIC(LoopbackMQTTClientWrapper)
+
+    LoopbackMQTTClientWrapper::Status status;
+    QByteArray clientId;
+    bool sessionPresent;
+    // The broker keeps the session, and unacknowledged messages, across connections
+    bool hasSession;
+    LoopbackMQTTClientWrapper::MQTTProtocolVersion protocolVersion;
+
+    int latency;
+    double lossRate;
+    int disconnectInterval;
+    int reconnectionDelay;
+    std::minstd_rand random;
+
+    int nextMid;
+    QSet<QByteArray> subscriptions;
+    // In due order, as every message waits the same latency
+    QQueue<LoopbackMessage> messages;
+    // QoS 1 and 2 messages to acknowledge once connected again
+    QQueue<LoopbackMessage> unacknowledged;
+    QVector<int> confirmedPublishes;
+
+    QElapsedTimer clock;
+    QTimer *deliveryTimer;
+    QTimer *confirmTimer;
+    QTimer *connectTimer;
+    QTimer *disconnectTimer;
+
+    quint64 publishedMessages;
+    quint64 lostMessages;
+    quint64 droppedConnections;
+
+    void setStatus(LoopbackMQTTClientWrapper::Status s);
+    int takeMid();
+    void enqueue(const LoopbackMessage &message);
+    void confirm(int mid);
+    void scheduleDelivery();
+    void deliverMessages();
+    void deliverConfirmedPublishes();
+    void connected();
+    void dropConnection(const QString &cause);
+    bool isSubscribed(const QByteArray &topic) const;
+
+    static bool topicMatches(const QByteArray &filter, const QByteArray &topic);
+};
+
+}
+
+#endif // HYPERDRIVE_LOOPBACKMQTTCLIENTWRAPPER_P_H
@@ -32,18 +32,247 @@
 #include <HemeraCore/Fingerprints>
 #include <HemeraCore/Literals>
 
-// We use the as variant
-#include <mosquittopp.h>
+#include <mosquitto.h>
+
+#include <algorithm>
+
+#include <string.h>
 
 #define CONNACK_TIMEOUT (2 * 60 * 1000)
 
 #define MIN_RECONNECTION_DELAY 3
 #define MAX_RECONNECTION_DELAY 30
 
+// Period of loop_misc in event loop I/O mode, which takes care of keepalives and retries
+#define LOOP_MISC_INTERVAL 1000
+
+#define RECEIVE_BUFFER_POOL_SIZE 16
+// Larger messages get a buffer of their own, to not keep big allocations around
+#define RECEIVE_BUFFER_MAX_POOLED_SIZE (64 * 1024)
+
+// Upper bound of the topic aliases we use, whatever the broker allows
+#define MAX_TOPIC_ALIASES 64
+// Publishes a topic needs before it competes for an alias
+#define TOPIC_ALIAS_MIN_USES 4
+// Uses are halved every this many publishes, so that aliases follow the current traffic
+#define TOPIC_ALIAS_DECAY_INTERVAL 1024
+
 Q_LOGGING_CATEGORY(mqttWrapperDC, "hyperdrive.mqttclientwrapper", DEBUG_MESSAGES_DEFAULT_LEVEL)
 
 namespace Hyperdrive {
 
+HyperdriveMosquittoClient::HyperdriveMosquittoClient(MQTTClientWrapperPrivate *d, const char *id, bool clean_session)
+    : m_mosq(mosquitto_new(id, clean_session, this))
+    , d(d)
+{
+    // Only one of the connect callbacks, libmosquitto calls every one which is set
+#if defined(HYPERDRIVE_MQTT_V5_SUPPORT)
+    mosquitto_connect_v5_callback_set(m_mosq, on_connect_v5);
+#elif LIBMOSQUITTO_MAJOR <= 1 && LIBMOSQUITTO_MINOR < 5
+    mosquitto_connect_callback_set(m_mosq, on_connect);
+#else
+    mosquitto_connect_with_flags_callback_set(m_mosq, on_connect_with_flags);
+#endif
+    mosquitto_disconnect_callback_set(m_mosq, on_disconnect);
+    mosquitto_publish_callback_set(m_mosq, on_publish);
+    mosquitto_message_callback_set(m_mosq, on_message);
+    mosquitto_subscribe_callback_set(m_mosq, on_subscribe);
+    mosquitto_unsubscribe_callback_set(m_mosq, on_unsubscribe);
+    mosquitto_log_callback_set(m_mosq, on_log);
+}
+
+HyperdriveMosquittoClient::~HyperdriveMosquittoClient()
+{
+    mosquitto_destroy(m_mosq);
+}
+
+int HyperdriveMosquittoClient::connect_async(const char *host, int port, int keepalive)
+{
+    return mosquitto_connect_async(m_mosq, host, port, keepalive);
+}
+
+int HyperdriveMosquittoClient::reconnect_async()
+{
+    return mosquitto_reconnect_async(m_mosq);
+}
+
+int HyperdriveMosquittoClient::disconnect()
+{
+    return mosquitto_disconnect(m_mosq);
+}
+
+int HyperdriveMosquittoClient::publish(int *mid, const char *topic, int payloadlen, const void *payload, int qos, bool retain)
+{
+    return mosquitto_publish(m_mosq, mid, topic, payloadlen, payload, qos, retain);
+}
+
+int HyperdriveMosquittoClient::publish_with_alias(int *mid, const char *topic, int payloadlen, const void *payload, int qos, bool retain, int alias)
+{
+#ifdef HYPERDRIVE_MQTT_V5_SUPPORT
+    mosquitto_property *properties = nullptr;
+    int rc = mosquitto_property_add_int16(&properties, MQTT_PROP_TOPIC_ALIAS, alias);
+    if (rc == MOSQ_ERR_SUCCESS) {
+        rc = mosquitto_publish_v5(m_mosq, mid, topic, payloadlen, payload, qos, retain, properties);
+    }
+    mosquitto_property_free_all(&properties);
+    return rc;
+#else
+    Q_UNUSED(alias);
+    return mosquitto_publish(m_mosq, mid, topic, payloadlen, payload, qos, retain);
+#endif
+}
+
+int HyperdriveMosquittoClient::subscribe(int *mid, const char *sub, int qos)
+{
+    return mosquitto_subscribe(m_mosq, mid, sub, qos);
+}
+
+int HyperdriveMosquittoClient::subscribe_multiple(int sub_count, char *const *subs, int qos)
+{
+#ifdef HYPERDRIVE_MQTT_V5_SUPPORT
+    return mosquitto_subscribe_multiple(m_mosq, NULL, sub_count, subs, qos, 0, NULL);
+#else
+    for (int i = 0; i < sub_count; ++i) {
+        int rc = mosquitto_subscribe(m_mosq, NULL, subs[i], qos);
+        if (rc != MOSQ_ERR_SUCCESS) {
+            return rc;
+        }
+    }
+    return MOSQ_ERR_SUCCESS;
+#endif
+}
+
+int HyperdriveMosquittoClient::unsubscribe_multiple(int sub_count, char *const *subs)
+{
+#ifdef HYPERDRIVE_MQTT_V5_SUPPORT
+    return mosquitto_unsubscribe_multiple(m_mosq, NULL, sub_count, subs, NULL);
+#else
+    for (int i = 0; i < sub_count; ++i) {
+        int rc = mosquitto_unsubscribe(m_mosq, NULL, subs[i]);
+        if (rc != MOSQ_ERR_SUCCESS) {
+            return rc;
+        }
+    }
+    return MOSQ_ERR_SUCCESS;
+#endif
+}
+
+int HyperdriveMosquittoClient::set_protocol_version(int version)
+{
+#ifdef HYPERDRIVE_MQTT_V5_SUPPORT
+    return mosquitto_int_option(m_mosq, MOSQ_OPT_PROTOCOL_VERSION, version);
+#else
+    return version == MQTTClientWrapper::MQTT311ProtocolVersion ? MOSQ_ERR_SUCCESS : MOSQ_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void HyperdriveMosquittoClient::reconnect_delay_set(unsigned int reconnect_delay, unsigned int reconnect_delay_max, bool reconnect_exponential_backoff)
+{
+    mosquitto_reconnect_delay_set(m_mosq, reconnect_delay, reconnect_delay_max, reconnect_exponential_backoff);
+}
+
+int HyperdriveMosquittoClient::max_inflight_messages_set(unsigned int max_inflight_messages)
+{
+    return mosquitto_max_inflight_messages_set(m_mosq, max_inflight_messages);
+}
+
+int HyperdriveMosquittoClient::tls_set(const char *cafile, const char *capath, const char *certfile, const char *keyfile)
+{
+    return mosquitto_tls_set(m_mosq, cafile, capath, certfile, keyfile, NULL);
+}
+
+int HyperdriveMosquittoClient::tls_opts_set(int cert_reqs)
+{
+    return mosquitto_tls_opts_set(m_mosq, cert_reqs, NULL, NULL);
+}
+
+int HyperdriveMosquittoClient::socket()
+{
+    return mosquitto_socket(m_mosq);
+}
+
+int HyperdriveMosquittoClient::loop_read(int max_packets)
+{
+    return mosquitto_loop_read(m_mosq, max_packets);
+}
+
+int HyperdriveMosquittoClient::loop_write(int max_packets)
+{
+    return mosquitto_loop_write(m_mosq, max_packets);
+}
+
+int HyperdriveMosquittoClient::loop_misc()
+{
+    return mosquitto_loop_misc(m_mosq);
+}
+
+int HyperdriveMosquittoClient::loop_start()
+{
+    return mosquitto_loop_start(m_mosq);
+}
+
+int HyperdriveMosquittoClient::loop_stop()
+{
+    return mosquitto_loop_stop(m_mosq, false);
+}
+
+bool HyperdriveMosquittoClient::want_write()
+{
+    return mosquitto_want_write(m_mosq);
+}
+
+void HyperdriveMosquittoClient::on_connect(struct mosquitto *, void *obj, int rc)
+{
+    static_cast<HyperdriveMosquittoClient*>(obj)->d->on_connect(rc);
+}
+
+#if !(LIBMOSQUITTO_MAJOR <= 1 && LIBMOSQUITTO_MINOR < 5)
+void HyperdriveMosquittoClient::on_connect_with_flags(struct mosquitto *, void *obj, int rc, int flags)
+{
+    static_cast<HyperdriveMosquittoClient*>(obj)->d->on_connect_with_flags(rc, flags);
+}
+#endif
+
+#ifdef HYPERDRIVE_MQTT_V5_SUPPORT
+void HyperdriveMosquittoClient::on_connect_v5(struct mosquitto *, void *obj, int rc, int flags, const mosquitto_property *properties)
+{
+    // Absent unless the broker allows aliases
+    uint16_t topicAliasMaximum = 0;
+    mosquitto_property_read_int16(properties, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &topicAliasMaximum, false);
+    static_cast<HyperdriveMosquittoClient*>(obj)->d->on_connect_v5(rc, flags, topicAliasMaximum);
+}
+#endif
+
+void HyperdriveMosquittoClient::on_disconnect(struct mosquitto *, void *obj, int rc)
+{
+    static_cast<HyperdriveMosquittoClient*>(obj)->d->on_disconnect(rc);
+}
+
+void HyperdriveMosquittoClient::on_publish(struct mosquitto *, void *obj, int mid)
+{
+    static_cast<HyperdriveMosquittoClient*>(obj)->d->on_publish(mid);
+}
+
+void HyperdriveMosquittoClient::on_message(struct mosquitto *, void *obj, const struct mosquitto_message *message)
+{
+    static_cast<HyperdriveMosquittoClient*>(obj)->d->on_message(message);
+}
+
+void HyperdriveMosquittoClient::on_subscribe(struct mosquitto *, void *obj, int mid, int qos_count, const int *granted_qos)
+{
+    static_cast<HyperdriveMosquittoClient*>(obj)->d->on_subscribe(mid, qos_count, granted_qos);
+}
+
+void HyperdriveMosquittoClient::on_unsubscribe(struct mosquitto *, void *obj, int mid)
+{
+    static_cast<HyperdriveMosquittoClient*>(obj)->d->on_unsubscribe(mid);
+}
+
+void HyperdriveMosquittoClient::on_log(struct mosquitto *, void *obj, int level, const char *str)
+{
+    static_cast<HyperdriveMosquittoClient*>(obj)->d->on_log(level, str);
+}
+
 void MQTTClientWrapperPrivate::setStatus(MQTTClientWrapper::Status s)
 {
     if (status != s) {
@@ -53,6 +282,146 @@ void MQTTClientWrapperPrivate::setStatus(MQTTClientWrapper::Status s)
     }
 }
 
+void MQTTClientWrapperPrivate::attachSocket()
+{
+    Q_Q(MQTTClientWrapper);
+
+    detachSocket();
+
+    int fd = mosquitto->socket();
+    if (fd < 0) {
+        qCWarning(mqttWrapperDC) << "Mosquitto has no socket to watch";
+        scheduleReconnection();
+        return;
+    }
+
+    readNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, q);
+    QObject::connect(readNotifier, &QSocketNotifier::activated, q, [this] {
+        // Several packets might be waiting, TLS buffers them out of sight of the notifier
+        handleLoopResult(mosquitto->loop_read(100));
+    });
+
+    writeNotifier = new QSocketNotifier(fd, QSocketNotifier::Write, q);
+    QObject::connect(writeNotifier, &QSocketNotifier::activated, q, [this] {
+        handleLoopResult(mosquitto->loop_write(100));
+    });
+
+    updateWriteNotifier();
+    miscTimer->start();
+}
+
+void MQTTClientWrapperPrivate::detachSocket()
+{
+    // They might be emitting right now
+    if (readNotifier) {
+        readNotifier->setEnabled(false);
+        readNotifier->deleteLater();
+        readNotifier = nullptr;
+    }
+    if (writeNotifier) {
+        writeNotifier->setEnabled(false);
+        writeNotifier->deleteLater();
+        writeNotifier = nullptr;
+    }
+    if (miscTimer) {
+        miscTimer->stop();
+    }
+}
+
+void MQTTClientWrapperPrivate::updateWriteNotifier()
+{
+    if (writeNotifier) {
+        writeNotifier->setEnabled(mosquitto->want_write());
+    }
+}
+
+void MQTTClientWrapperPrivate::handleLoopResult(int rc)
+{
+    if (rc == MOSQ_ERR_SUCCESS) {
+        updateWriteNotifier();
+        return;
+    }
+
+    detachSocket();
+
+    if (status == MQTTClientWrapper::DisconnectingStatus || status == MQTTClientWrapper::DisconnectedStatus) {
+        setStatus(MQTTClientWrapper::DisconnectedStatus);
+        return;
+    }
+
+    // The network thread would reconnect on its own
+    qCInfo(mqttWrapperDC) << "Connection lost, return code" << rc;
+    if (status != MQTTClientWrapper::ReconnectingStatus) {
+        Q_Q(MQTTClientWrapper);
+        setStatus(MQTTClientWrapper::ReconnectingStatus);
+        Q_EMIT q->connectionStarted();
+    }
+    scheduleReconnection();
+}
+
+void MQTTClientWrapperPrivate::scheduleReconnection()
+{
+    if (reconnectTimer->isActive()) {
+        return;
+    }
+
+    // Same exponential backoff mosquitto uses
+    qCDebug(mqttWrapperDC) << "Reconnecting in" << reconnectionDelay << "seconds";
+    reconnectTimer->start(reconnectionDelay * 1000);
+    reconnectionDelay = qMin(reconnectionDelay * 2, maxReconnectionDelay);
+}
+
+void MQTTClientWrapperPrivate::reconnect()
+{
+    if (status != MQTTClientWrapper::ReconnectingStatus && status != MQTTClientWrapper::ConnectingStatus) {
+        return;
+    }
+
+    int rc = mosquitto->reconnect_async();
+    if (rc != MOSQ_ERR_SUCCESS) {
+        qCInfo(mqttWrapperDC) << "Could not reconnect to broker, return code" << rc;
+        scheduleReconnection();
+        return;
+    }
+
+    attachSocket();
+}
+
+QByteArray MQTTClientWrapperPrivate::receiveBuffer(const char *data, int size)
+{
+    // Resizing to 0 would free the buffer, and there is nothing to copy anyway
+    if (size == 0) {
+        return QByteArray();
+    }
+
+    if (size > RECEIVE_BUFFER_MAX_POOLED_SIZE) {
+        return QByteArray(data, size);
+    }
+
+    if (receiveBuffers.isEmpty()) {
+        receiveBuffers.resize(RECEIVE_BUFFER_POOL_SIZE);
+    }
+
+    for (int i = 0; i < RECEIVE_BUFFER_POOL_SIZE; ++i) {
+        QByteArray &buffer = receiveBuffers[(nextReceiveBuffer + i) % RECEIVE_BUFFER_POOL_SIZE];
+        // Only the pool holds it and the message fits: resizing it does not reallocate. Empty slots share the
+        // null data, which never looks detached.
+        if (buffer.isDetached() && buffer.capacity() >= size) {
+            buffer.resize(size);
+            memcpy(buffer.data(), data, size);
+            nextReceiveBuffer = (nextReceiveBuffer + i + 1) % RECEIVE_BUFFER_POOL_SIZE;
+            return buffer;
+        }
+    }
+
+    // No free buffer is large enough. The replaced one lives on with its receivers, if any, and the new one is
+    // sized to the message, so that a small message never holds a large allocation.
+    QByteArray &buffer = receiveBuffers[nextReceiveBuffer];
+    buffer = QByteArray(data, size);
+    nextReceiveBuffer = (nextReceiveBuffer + 1) % RECEIVE_BUFFER_POOL_SIZE;
+    return buffer;
+}
+
 void MQTTClientWrapperPrivate::handleConnack(int rc)
 {
     qCInfo(mqttWrapperDC) << "Connected to broker returned!";
@@ -64,6 +433,7 @@ void MQTTClientWrapperPrivate::handleConnack(int rc)
 
     if (rc == MOSQ_ERR_SUCCESS) {
         qCInfo(mqttWrapperDC) << "Connected to broker, session present: " << sessionPresent;
+        reconnectionDelay = minReconnectionDelay;
         setStatus(MQTTClientWrapper::ConnectedStatus);
     } else {
         qCInfo(mqttWrapperDC) << "Could not connected to broker!" << rc;
@@ -92,7 +462,18 @@ void MQTTClientWrapperPrivate::on_disconnect(int rc)
 
     if (rc == 0) {
         // Client requested disconnect.
-        mosquitto->loop_stop();
+        if (eventLoopIO) {
+            detachSocket();
+        } else {
+            mosquitto->loop_stop();
+        }
+    } else if (eventLoopIO) {
+        // Reconnection is left to handleLoopResult, which gets the error right after this
+        qCInfo(mqttWrapperDC) << "Unexpected disconnection from broker!" << rc;
+        setStatus(MQTTClientWrapper::ReconnectingStatus);
+
+        Q_Q(MQTTClientWrapper);
+        Q_EMIT q->connectionStarted();
     } else {
         // Unexpected disconnect, Mosquitto will reconnect
         qCInfo(mqttWrapperDC) << "Unexpected disconnection from broker!" << rc;
@@ -107,10 +488,10 @@ void MQTTClientWrapperPrivate::on_message(const struct mosquitto_message *messag
 {
     Q_Q(MQTTClientWrapper);
 
-    // We need to copy the bytes. It's impossible to control the ownership otherwise.
-    // Do not use ::fromRawData until you find out how to do 0-copy without leaking!!
-    QByteArray payload((char*)message->payload, message->payloadlen);
-    QByteArray topic(message->topic);
+    // We need to copy the bytes: mosquitto frees them as soon as we return, while the receivers
+    // might still be queued. The copies go to pooled buffers, which avoids an allocation for each.
+    QByteArray payload = receiveBuffer(static_cast<const char*>(message->payload), message->payloadlen);
+    QByteArray topic = receiveBuffer(message->topic, qstrlen(message->topic));
 
     Q_EMIT q->messageReceived(topic, payload);
 
@@ -142,16 +523,137 @@ void MQTTClientWrapperPrivate::on_log(int level, const char *str)
     }
 }
 
-void MQTTClientWrapperPrivate::on_error()
+void MQTTClientWrapperPrivate::on_connect_v5(int rc, int flags, int brokerTopicAliasMaximum)
+{
+    if (rc == MOSQ_ERR_SUCCESS) {
+        sessionPresent = isSessionPresent(flags);
+        topicAliasMaximum.storeRelease(protocolVersion.loadAcquire() == MQTTClientWrapper::MQTT5ProtocolVersion ? brokerTopicAliasMaximum : 0);
+        // Aliases do not survive the connection
+        connectionGeneration.ref();
+#ifdef HYPERDRIVE_MQTT_V5_SUPPORT
+    } else if (protocolVersion.loadAcquire() == MQTTClientWrapper::MQTT5ProtocolVersion
+               && (rc == CONNACK_REFUSED_PROTOCOL_VERSION || rc == MQTT_RC_UNSUPPORTED_PROTOCOL_VERSION)) {
+        // A 3.1.1 broker answers with its own refusal code. The next reconnection uses 3.1.1
+        qCInfo(mqttWrapperDC) << "The broker does not support MQTT v5, falling back to 3.1.1";
+        protocolVersion.storeRelease(MQTTClientWrapper::MQTT311ProtocolVersion);
+        mosquitto->set_protocol_version(MQTTClientWrapper::MQTT311ProtocolVersion);
+#endif
+    }
+    this->handleConnack(rc);
+}
+
+int MQTTClientWrapperPrivate::topicAliasFor(const QByteArray &topic, bool *announce)
+{
+    int maximum = qMin(topicAliasMaximum.loadAcquire(), MAX_TOPIC_ALIASES);
+    if (maximum <= 0) {
+        return 0;
+    }
+
+    int generation = connectionGeneration.loadAcquire();
+    if (generation != topicAliasGeneration) {
+        topicAliasGeneration = generation;
+        resetTopicAliases();
+        topicAliasOwners.resize(maximum);
+    }
+
+    if (++topicAliasPublishes >= TOPIC_ALIAS_DECAY_INTERVAL) {
+        topicAliasPublishes = 0;
+        for (QHash<QByteArray, TopicAlias>::iterator it = topicAliases.begin(); it != topicAliases.end();) {
+            it.value().uses /= 2;
+            if (it.value().uses == 0 && it.value().alias == 0) {
+                it = topicAliases.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    TopicAlias &entry = topicAliases[topic];
+    ++entry.uses;
+
+    if (entry.alias == 0 && entry.uses >= TOPIC_ALIAS_MIN_USES) {
+        if (topicAliasCount < maximum) {
+            entry.alias = ++topicAliasCount;
+            topicAliasOwners[entry.alias - 1] = topic;
+        } else {
+            // Take the alias of the least used topic, if this one is clearly hotter
+            int victimAlias = 0;
+            quint32 victimUses = 0;
+            for (int alias = 1; alias <= topicAliasCount; ++alias) {
+                quint32 uses = topicAliases.value(topicAliasOwners.at(alias - 1)).uses;
+                if (victimAlias == 0 || uses < victimUses) {
+                    victimAlias = alias;
+                    victimUses = uses;
+                }
+            }
+
+            if (entry.uses > 2 * victimUses) {
+                QHash<QByteArray, TopicAlias>::iterator victim = topicAliases.find(topicAliasOwners.at(victimAlias - 1));
+                if (victim != topicAliases.end()) {
+                    victim.value().alias = 0;
+                    victim.value().announced = false;
+                }
+                entry.alias = victimAlias;
+                topicAliasOwners[victimAlias - 1] = topic;
+            }
+        }
+        // Rebinding an alias only needs the topic to be sent along with it
+        entry.announced = false;
+    }
+
+    *announce = !entry.announced;
+    return entry.alias;
+}
+
+void MQTTClientWrapperPrivate::resetTopicAliases()
 {
-    qCWarning(mqttWrapperDC) << "MOSQUITTO ERROR!";
+    topicAliases.clear();
+    topicAliasOwners.clear();
+    topicAliasCount = 0;
+    topicAliasPublishes = 0;
 }
 
 void MQTTClientWrapperPrivate::on_publish(int mid)
+{
+    ConfirmedPublish *confirmed = new ConfirmedPublish;
+    confirmed->mid = mid;
+
+    ConfirmedPublish *head;
+    do {
+        head = confirmedPublishes.loadAcquire();
+        confirmed->next = head;
+    } while (!confirmedPublishes.testAndSetRelease(head, confirmed));
+
+    // Only the first confirmation of a batch wakes up the owner thread
+    if (!head) {
+        Q_Q(MQTTClientWrapper);
+        QMetaObject::invokeMethod(q, "deliverConfirmedPublishes", Qt::QueuedConnection);
+    }
+}
+
+void MQTTClientWrapperPrivate::deliverConfirmedPublishes()
 {
     Q_Q(MQTTClientWrapper);
 
-    Q_EMIT q->publishConfirmed(mid);
+    ConfirmedPublish *confirmed = confirmedPublishes.fetchAndStoreAcquire(nullptr);
+    QVector<int> mids;
+    while (confirmed) {
+        ConfirmedPublish *next = confirmed->next;
+        mids.append(confirmed->mid);
+        delete confirmed;
+        confirmed = next;
+    }
+
+    if (mids.isEmpty()) {
+        return;
+    }
+
+    // The stack pops the latest first
+    std::reverse(mids.begin(), mids.end());
+    Q_EMIT q->publishesConfirmed(mids);
+    for (int mid : mids) {
+        Q_EMIT q->publishConfirmed(mid);
+    }
 }
 
 bool MQTTClientWrapperPrivate::isSessionPresent(int flags)
@@ -165,7 +667,7 @@ MQTTClientWrapper::MQTTClientWrapper(const QUrl &host, QObject *parent)
 }
 
 MQTTClientWrapper::MQTTClientWrapper(const QUrl &host, const QByteArray &clientId, QObject *parent)
-    : Hemera::AsyncInitObject(*new MQTTClientWrapperPrivate(this), parent)
+    : AbstractMQTTClientWrapper(*new MQTTClientWrapperPrivate(this), parent)
 {
     Q_D(MQTTClientWrapper);
     d->hardwareId = clientId;
@@ -182,10 +684,21 @@ MQTTClientWrapper::~MQTTClientWrapper()
     if (Q_LIKELY(d->mosquitto)) {
         qCWarning(mqttWrapperDC) << "Stopping mosquitto!";
         d->mosquitto->disconnect();
-        d->mosquitto->loop_stop();
+        if (d->eventLoopIO) {
+            d->detachSocket();
+        } else {
+            d->mosquitto->loop_stop();
+        }
 
         delete d->mosquitto;
-        mosqpp::lib_cleanup();
+        mosquitto_lib_cleanup();
+    }
+
+    ConfirmedPublish *confirmed = d->confirmedPublishes.fetchAndStoreAcquire(nullptr);
+    while (confirmed) {
+        ConfirmedPublish *next = confirmed->next;
+        delete confirmed;
+        confirmed = next;
     }
 }
 
@@ -242,6 +755,39 @@ void MQTTClientWrapper::setKeepAlive(quint64 seconds)
     d->keepAlive = seconds;
 }
 
+void MQTTClientWrapper::setEventLoopIO(bool eventLoopIO)
+{
+    Q_D(MQTTClientWrapper);
+    d->eventLoopIO = eventLoopIO;
+}
+
+void MQTTClientWrapper::setMaxInFlightMessages(int maxInFlightMessages)
+{
+    Q_D(MQTTClientWrapper);
+    d->maxInFlightMessages = qMax(0, maxInFlightMessages);
+    if (d->mosquitto) {
+        d->mosquitto->max_inflight_messages_set(d->maxInFlightMessages);
+    }
+}
+
+void MQTTClientWrapper::setProtocolVersion(MQTTProtocolVersion protocolVersion)
+{
+    Q_D(MQTTClientWrapper);
+#ifndef HYPERDRIVE_MQTT_V5_SUPPORT
+    if (protocolVersion == MQTT5ProtocolVersion) {
+        qCWarning(mqttWrapperDC) << "MQTT v5 needs libmosquitto 1.6 or later, using 3.1.1";
+        protocolVersion = MQTT311ProtocolVersion;
+    }
+#endif
+    d->protocolVersion.storeRelease(protocolVersion);
+}
+
+MQTTClientWrapper::MQTTProtocolVersion MQTTClientWrapper::protocolVersion() const
+{
+    Q_D(const MQTTClientWrapper);
+    return static_cast<MQTTProtocolVersion>(d->protocolVersion.loadAcquire());
+}
+
 void MQTTClientWrapper::setIgnoreSslErrors(bool ignoreSslErrors)
 {
     Q_D(MQTTClientWrapper);
@@ -282,13 +828,24 @@ void MQTTClientWrapper::initImpl()
     Hyperdrive::Utils::seedRNG();
 
     auto initMosquitto = [this, d] {
+        // Always successful
+        mosquitto_lib_init();
+
         // Initialize stuff
         d->mosquitto = new HyperdriveMosquittoClient(d, d->hardwareId.constData(), d->cleanSession);
+        if (d->mosquitto->set_protocol_version(d->protocolVersion.loadAcquire()) != MOSQ_ERR_SUCCESS) {
+            qCWarning(mqttWrapperDC) << "Could not set MQTT protocol version" << d->protocolVersion.loadAcquire() << ", using 3.1.1";
+            d->protocolVersion.storeRelease(MQTT311ProtocolVersion);
+        }
 
         // Set a randomized reconnect with exponential backoff
         int randomizedMinDelaySec = Hyperdrive::Utils::randomizedInterval(MIN_RECONNECTION_DELAY, 0.7);
         int randomizedMaxDelaySec = Hyperdrive::Utils::randomizedInterval(MAX_RECONNECTION_DELAY, 0.2);
         d->mosquitto->reconnect_delay_set(randomizedMinDelaySec, randomizedMaxDelaySec, true);
+        d->minReconnectionDelay = randomizedMinDelaySec;
+        d->maxReconnectionDelay = randomizedMaxDelaySec;
+        d->reconnectionDelay = randomizedMinDelaySec;
+        d->mosquitto->max_inflight_messages_set(d->maxInFlightMessages);
 
         // SSL
         if (!d->pathToCA.isEmpty() && !d->pathToPKey.isEmpty() && !d->pathToCertificate.isEmpty()) {
@@ -306,9 +863,6 @@ void MQTTClientWrapper::initImpl()
             }
         }
 
-        // Always successful
-        mosqpp::lib_init();
-
         qCWarning(mqttWrapperDC) << "Mosquitto is up!";
 
         setReady();
@@ -320,6 +874,17 @@ void MQTTClientWrapper::initImpl()
     connect(this, &MQTTClientWrapper::connectionStarted, d->connackTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
     connect(this, &MQTTClientWrapper::connackReceived, d->connackTimer, &QTimer::stop);
 
+    d->miscTimer = new QTimer(this);
+    d->miscTimer->setInterval(LOOP_MISC_INTERVAL);
+    connect(d->miscTimer, &QTimer::timeout, this, [d] {
+        d->handleLoopResult(d->mosquitto->loop_misc());
+    });
+    d->reconnectTimer = new QTimer(this);
+    d->reconnectTimer->setSingleShot(true);
+    connect(d->reconnectTimer, &QTimer::timeout, this, [d] {
+        d->reconnect();
+    });
+
     if (!d->hardwareId.isEmpty()) {
         initMosquitto();
         return;
@@ -361,7 +926,11 @@ bool MQTTClientWrapper::connectToBroker()
                 Q_EMIT connectionFailed();
                 return false;
             }
-            if (d->mosquitto->loop_start() != MOSQ_ERR_SUCCESS) {
+            if (d->eventLoopIO) {
+                d->setStatus(MQTTClientWrapper::ConnectingStatus);
+                d->reconnectionDelay = d->minReconnectionDelay;
+                d->attachSocket();
+            } else if (d->mosquitto->loop_start() != MOSQ_ERR_SUCCESS) {
                 qCWarning(mqttWrapperDC) << "Could not initiate async mosquitto loop! Something is beyond broken!";
                 return false;
             }
@@ -402,6 +971,10 @@ bool MQTTClientWrapper::disconnectFromBroker()
             if ((rc = d->mosquitto->disconnect()) != MOSQ_ERR_SUCCESS) {
                 if (rc == MOSQ_ERR_NO_CONN) {
                     qCWarning(mqttWrapperDC) << "Trying to disconnect, but not connected to a broker";
+                    if (d->eventLoopIO) {
+                        d->reconnectTimer->stop();
+                        d->detachSocket();
+                    }
                     d->setStatus(MQTTClientWrapper::DisconnectedStatus);
                     return true;
                 } else {
@@ -410,6 +983,10 @@ bool MQTTClientWrapper::disconnectFromBroker()
                 }
             }
             d->setStatus(MQTTClientWrapper::DisconnectingStatus);
+            if (d->eventLoopIO) {
+                d->reconnectTimer->stop();
+                d->updateWriteNotifier();
+            }
             return true;
         }
         default: {
@@ -432,10 +1009,25 @@ int MQTTClientWrapper::publish(const QByteArray& topic, const QByteArray& payloa
     int qos = lqos == MQTTQoS::DefaultQoS ? d->publishQoS : (int)lqos;
     int mid;
 
-    if ((rc = d->mosquitto->publish(&mid, topic.constData(), payload.length(), const_cast<char*>(payload.data()), qos, retained)) != MOSQ_ERR_SUCCESS) {
+    // Aliases are used for QoS 0 only: mosquitto might resend other messages on a new connection, which
+    // does not know their alias
+    bool announceAlias = false;
+    int alias = qos == AtMostOnceQoS ? d->topicAliasFor(topic, &announceAlias) : 0;
+    if (alias > 0) {
+        rc = d->mosquitto->publish_with_alias(&mid, announceAlias ? topic.constData() : "", payload.length(), payload.constData(), qos, retained, alias);
+        if (rc == MOSQ_ERR_SUCCESS) {
+            d->topicAliases[topic].announced = true;
+        }
+    } else {
+        rc = d->mosquitto->publish(&mid, topic.constData(), payload.length(), payload.constData(), qos, retained);
+    }
+
+    if (rc != MOSQ_ERR_SUCCESS) {
         qCWarning(mqttWrapperDC) << "Failed to start sendMessage, return code " << rc;
         return -rc;
     }
+    // Whatever did not fit in the socket is written once it is writable
+    d->updateWriteNotifier();
 
     return mid;
 }
@@ -460,6 +1052,56 @@ void MQTTClientWrapper::subscribe(const QByteArray& topic, MQTTQoS subQoS)
     if ((rc = d->mosquitto->subscribe(NULL, topic.constData(), qos)) != MOSQ_ERR_SUCCESS) {
         qCWarning(mqttWrapperDC) << "Failed to start subscribe, return code " << rc;
     }
+    d->updateWriteNotifier();
+}
+
+bool MQTTClientWrapper::subscribe(const QList<QByteArray> &topics, MQTTQoS subQoS)
+{
+    Q_D(MQTTClientWrapper);
+
+    if (Q_UNLIKELY(!d->mosquitto)) {
+        qCWarning(mqttWrapperDC) << "Attempted to call subscribe before initializing the client!";
+        return false;
+    }
+
+    int qos = subQoS == MQTTQoS::DefaultQoS ? d->publishQoS : (int)subQoS;
+    QVector<char*> subs;
+    subs.reserve(topics.size());
+    for (const QByteArray &topic : topics) {
+        subs.append(const_cast<char*>(topic.constData()));
+    }
+
+    int rc = d->mosquitto->subscribe_multiple(subs.size(), subs.constData(), qos);
+    d->updateWriteNotifier();
+    if (rc != MOSQ_ERR_SUCCESS) {
+        qCWarning(mqttWrapperDC) << "Failed to start subscribe to" << topics.size() << "topics, return code " << rc;
+        return false;
+    }
+    return true;
+}
+
+bool MQTTClientWrapper::unsubscribe(const QList<QByteArray> &topics)
+{
+    Q_D(MQTTClientWrapper);
+
+    if (Q_UNLIKELY(!d->mosquitto)) {
+        qCWarning(mqttWrapperDC) << "Attempted to call unsubscribe before initializing the client!";
+        return false;
+    }
+
+    QVector<char*> subs;
+    subs.reserve(topics.size());
+    for (const QByteArray &topic : topics) {
+        subs.append(const_cast<char*>(topic.constData()));
+    }
+
+    int rc = d->mosquitto->unsubscribe_multiple(subs.size(), subs.constData());
+    d->updateWriteNotifier();
+    if (rc != MOSQ_ERR_SUCCESS) {
+        qCWarning(mqttWrapperDC) << "Failed to start unsubscribe from" << topics.size() << "topics, return code " << rc;
+        return false;
+    }
+    return true;
 }
 
 }
@@ -19,10 +19,13 @@
 #ifndef HYPERDRIVE_MQTTCLIENTWRAPPER_H
 #define HYPERDRIVE_MQTTCLIENTWRAPPER_H
 
-#include <HemeraCore/AsyncInitObject>
+#include "hyperdriveabstractmqttclientwrapper.h"
+
 #include <HemeraCore/Operation>
 
+#include <QtCore/QList>
 #include <QtCore/QUrl>
+#include <QtCore/QVector>
 
 namespace Hemera {
 class Operation;
@@ -31,41 +34,24 @@ class Operation;
 namespace Hyperdrive {
 
 class MQTTClientWrapperPrivate;
-class MQTTClientWrapper : public Hemera::AsyncInitObject
+class MQTTClientWrapper : public AbstractMQTTClientWrapper
 {
     Q_OBJECT
     Q_DISABLE_COPY(MQTTClientWrapper)
     Q_DECLARE_PRIVATE_D(d_h_ptr, MQTTClientWrapper)
 
-    Q_PROPERTY(Status status READ status NOTIFY statusChanged)
+    Q_PRIVATE_SLOT(d_func(), void deliverConfirmedPublishes())
 
 public:
-    enum Status {
-        UnknownStatus = 0,
-        DisconnectedStatus = 1,
-        ConnectedStatus = 2,
-        ConnectingStatus = 3,
-        DisconnectingStatus = 4,
-        ReconnectingStatus = 5
-    };
-    Q_ENUM(Status);
-    enum MQTTQoS {
-        AtMostOnceQoS = 0,
-        AtLeastOnceQoS = 1,
-        ExactlyOnceQoS = 2,
-        DefaultQoS = 99
-    };
-    Q_ENUM(MQTTQoS);
-
     explicit MQTTClientWrapper(const QUrl &host, QObject *parent);
     explicit MQTTClientWrapper(const QUrl &host, const QByteArray &clientId, QObject *parent = nullptr);
     virtual ~MQTTClientWrapper();
 
-    Status status() const;
-    QByteArray hardwareId() const;
-    QByteArray rootClientTopic() const;
-    QDateTime clientCertificateExpiry() const;
-    bool sessionPresent() const;
+    virtual Status status() const override;
+    virtual QByteArray hardwareId() const override;
+    virtual QByteArray rootClientTopic() const override;
+    virtual QDateTime clientCertificateExpiry() const override;
+    virtual bool sessionPresent() const override;
 
     void setMutualSSLAuthentication(const QString &pathToCA, const QString &pathToPKey, const QString &pathToCertificate);
     void setPublishQoS(MQTTQoS qos);
@@ -73,29 +59,30 @@ public:
     void setIgnoreSslErrors(bool ignoreSslErrors);
     /// Note: this will only work if set before initializing the Client.
     void setCleanSession(bool cleanSession = true);
-    void setKeepAlive(quint64 seconds);
+    virtual void setKeepAlive(quint64 seconds) override;
     void setLastWill(const QByteArray &topic, const QByteArray &message, MQTTQoS qos, bool retained = false);
+    /// Drive the connection from the Qt event loop instead of a mosquitto network thread.
+    /// Note: this will only work if set before connecting to the broker.
+    virtual void setEventLoopIO(bool eventLoopIO) override;
+    /// Limit of QoS 1 and 2 messages mosquitto keeps in flight, 0 means no limit.
+    virtual void setMaxInFlightMessages(int maxInFlightMessages) override;
+    /// MQTT v5 is negotiated when available, falling back to 3.1.1 if the broker refuses it.
+    /// Note: this will only work if set before initializing the Client.
+    virtual void setProtocolVersion(MQTTProtocolVersion protocolVersion) override;
+    virtual MQTTProtocolVersion protocolVersion() const override;
 
-    int publish(const QByteArray &topic, const QByteArray &payload, MQTTQoS qos = DefaultQoS, bool retained = false);
-    void subscribe(const QByteArray &topic, MQTTQoS qos = DefaultQoS);
+    virtual int publish(const QByteArray &topic, const QByteArray &payload, MQTTQoS qos = DefaultQoS, bool retained = false) override;
+    virtual void subscribe(const QByteArray &topic, MQTTQoS qos = DefaultQoS) override;
+    /// Subscribes to every topic with a single SUBSCRIBE packet, where libmosquitto supports it.
+    virtual bool subscribe(const QList<QByteArray> &topics, MQTTQoS qos = DefaultQoS) override;
+    virtual bool unsubscribe(const QList<QByteArray> &topics) override;
 
 public Q_SLOTS:
-    bool connectToBroker();
-    bool disconnectFromBroker();
+    virtual bool connectToBroker() override;
+    virtual bool disconnectFromBroker() override;
 
 protected:
     virtual void initImpl() override final;
-
-Q_SIGNALS:
-    void messageReceived(const QByteArray &topic, const QByteArray &payload);
-    void statusChanged(Hyperdrive::MQTTClientWrapper::Status status);
-    void connectionLost(const QString &cause);
-    void publishConfirmed(int mid);
-    void connectionFailed();
-    void connectionStarted();
-    void connackReceived();
-    void connackTimeout();
-
 };
 }
 
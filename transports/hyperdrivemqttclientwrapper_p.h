@@ -23,17 +23,34 @@
 
 #include <HemeraCore/Operation>
 
+#include <QtCore/QAtomicPointer>
 #include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QSocketNotifier>
 #include <QtCore/QTimer>
+#include <QtCore/QVector>
 
 #include <hemeraasyncinitobject_p.h>
 
-#include <mosquittopp.h>
+#include <mosquitto.h>
+
+// MQTT v5 needs the properties API of the C library
+#if defined(LIBMOSQUITTO_VERSION_NUMBER) && LIBMOSQUITTO_VERSION_NUMBER >= 1006000
+#define HYPERDRIVE_MQTT_V5_SUPPORT
+#include <mqtt_protocol.h>
+#endif
 
 namespace Hyperdrive {
 
 class HyperdriveMosquittoClient;
 
+// Node of the lock free stack of publish confirmations
+struct ConfirmedPublish
+{
+    int mid;
+    ConfirmedPublish *next;
+};
+
 class MQTTClientWrapperPrivate : public Hemera::AsyncInitObjectPrivate
 {
 public:
@@ -45,7 +62,24 @@ public:
                                                    , cleanSession(false)
                                                    , sessionPresent(false)
                                                    , publishQoS(1)
-                                                   , subscribeQoS(1) {}
+                                                   , subscribeQoS(1)
+                                                   , eventLoopIO(false)
+                                                   , readNotifier(nullptr)
+                                                   , writeNotifier(nullptr)
+                                                   , miscTimer(nullptr)
+                                                   , reconnectTimer(nullptr)
+                                                   , minReconnectionDelay(0)
+                                                   , maxReconnectionDelay(0)
+                                                   , reconnectionDelay(0)
+                                                   , maxInFlightMessages(20)
+                                                   , nextReceiveBuffer(0)
+                                                   , confirmedPublishes(nullptr)
+                                                   , protocolVersion(MQTTClientWrapper::MQTT311ProtocolVersion)
+                                                   , topicAliasMaximum(0)
+                                                   , connectionGeneration(0)
+                                                   , topicAliasGeneration(-1)
+                                                   , topicAliasCount(0)
+                                                   , topicAliasPublishes(0) {}
 
     Q_DECLARE_PUBLIC(MQTTClientWrapper)
 
@@ -70,6 +104,43 @@ public:
     QDateTime clientCertificateExpiry;
     QTimer *connackTimer;
 
+    // Event loop I/O: mosquitto is driven by notifiers on its socket, with reconnections scheduled by us
+    bool eventLoopIO;
+    QSocketNotifier *readNotifier;
+    QSocketNotifier *writeNotifier;
+    QTimer *miscTimer;
+    QTimer *reconnectTimer;
+    int minReconnectionDelay;
+    int maxReconnectionDelay;
+    int reconnectionDelay;
+
+    int maxInFlightMessages;
+
+    // Topics and payloads of received messages, a buffer is reused once every receiver released it.
+    // Only touched by the thread running the mosquitto callbacks.
+    QVector<QByteArray> receiveBuffers;
+    int nextReceiveBuffer;
+
+    // Pushed by the thread running the mosquitto callbacks, taken whole by deliverConfirmedPublishes
+    QAtomicPointer<ConfirmedPublish> confirmedPublishes;
+
+    // MQTT v5. The callbacks publish what the broker granted, the publishing thread owns the alias table
+    QAtomicInt protocolVersion;
+    QAtomicInt topicAliasMaximum;
+    QAtomicInt connectionGeneration;
+    struct TopicAlias {
+        TopicAlias() : alias(0), uses(0), announced(false) {}
+        int alias;
+        quint32 uses;
+        bool announced;
+    };
+    QHash<QByteArray, TopicAlias> topicAliases;
+    // Topic owning each alias, indexed by alias - 1
+    QVector<QByteArray> topicAliasOwners;
+    int topicAliasGeneration;
+    int topicAliasCount;
+    int topicAliasPublishes;
+
     // SSL
     QString pathToCA;
     QString pathToPKey;
@@ -77,46 +148,88 @@ public:
 
     void setStatus(MQTTClientWrapper::Status s);
 
+    // Event loop I/O
+    void attachSocket();
+    void detachSocket();
+    void updateWriteNotifier();
+    void handleLoopResult(int rc);
+    void scheduleReconnection();
+    void reconnect();
+
+    QByteArray receiveBuffer(const char *data, int size);
+
+    void deliverConfirmedPublishes();
+
+    // Topic alias to publish topic with, 0 for none. Sets announce when the topic has to be sent along
+    int topicAliasFor(const QByteArray &topic, bool *announce);
+    void resetTopicAliases();
+
     // MQTT CALLBACKS
     void on_connect(int rc);
     void on_connect_with_flags(int rc, int flags);
     void on_disconnect(int rc);
     void on_publish(int mid);
+    void on_connect_v5(int rc, int flags, int brokerTopicAliasMaximum);
     void on_message(const struct mosquitto_message *message);
     void on_subscribe(int mid, int qos_count, const int *granted_qos);
     void on_unsubscribe(int mid);
     void on_log(int level, const char *str);
-    void on_error();
 
 private:
     void handleConnack(int rc);
     static bool isSessionPresent(int flags);
 };
 
-class HyperdriveMosquittoClient : public mosqpp::mosquittopp
+// Same interface as mosqpp::mosquittopp, on top of the C library which also exposes MQTT v5
+class HyperdriveMosquittoClient
 {
 public:
-    explicit HyperdriveMosquittoClient(MQTTClientWrapperPrivate *d, const char *id, bool clean_session)
-        : mosquittopp(id, clean_session)
-        , d(d) {}
-    virtual ~HyperdriveMosquittoClient() {}
-
-    // MQTT CALLBACKS. Just redirect to our private class
-#if LIBMOSQUITTO_MAJOR <= 1 && LIBMOSQUITTO_MINOR < 5
-    inline virtual void on_connect(int rc) override { d->on_connect(rc); }
-#else
-    inline virtual void on_connect_with_flags(int rc, int flags) override { d->on_connect_with_flags(rc, flags); }
-#endif
-    inline virtual void on_disconnect(int rc) override { d->on_disconnect(rc); }
-    inline virtual void on_publish(int mid) override { d->on_publish(mid); }
-    inline virtual void on_message(const struct mosquitto_message *message) override { d->on_message(message); }
-    inline virtual void on_subscribe(int mid, int qos_count, const int *granted_qos) override { d->on_subscribe(mid, qos_count, granted_qos); }
-    inline virtual void on_unsubscribe(int mid) override { d->on_unsubscribe(mid); }
-    inline virtual void on_log(int level, const char *str) override { d->on_log(level, str); }
-    inline virtual void on_error() override { d->on_error(); }
+    explicit HyperdriveMosquittoClient(MQTTClientWrapperPrivate *d, const char *id, bool clean_session);
+    ~HyperdriveMosquittoClient();
+
+    int connect_async(const char *host, int port, int keepalive);
+    int reconnect_async();
+    int disconnect();
+    int publish(int *mid, const char *topic, int payloadlen, const void *payload, int qos, bool retain);
+    // MQTT v5 only: topic may be empty when the alias is already known to the broker
+    int publish_with_alias(int *mid, const char *topic, int payloadlen, const void *payload, int qos, bool retain, int alias);
+    int subscribe(int *mid, const char *sub, int qos);
+    // A single packet where the library supports it, one per topic otherwise
+    int subscribe_multiple(int sub_count, char *const *subs, int qos);
+    int unsubscribe_multiple(int sub_count, char *const *subs);
+    int set_protocol_version(int version);
+
+    void reconnect_delay_set(unsigned int reconnect_delay, unsigned int reconnect_delay_max, bool reconnect_exponential_backoff);
+    int max_inflight_messages_set(unsigned int max_inflight_messages);
+    int tls_set(const char *cafile, const char *capath, const char *certfile, const char *keyfile);
+    int tls_opts_set(int cert_reqs);
+
+    int socket();
+    int loop_read(int max_packets);
+    int loop_write(int max_packets);
+    int loop_misc();
+    int loop_start();
+    int loop_stop();
+    bool want_write();
 
 private:
+    struct mosquitto *m_mosq;
     MQTTClientWrapperPrivate *d;
+
+    // MQTT CALLBACKS. Just redirect to our private class
+    static void on_connect(struct mosquitto *, void *obj, int rc);
+#if !(LIBMOSQUITTO_MAJOR <= 1 && LIBMOSQUITTO_MINOR < 5)
+    static void on_connect_with_flags(struct mosquitto *, void *obj, int rc, int flags);
+#endif
+#ifdef HYPERDRIVE_MQTT_V5_SUPPORT
+    static void on_connect_v5(struct mosquitto *, void *obj, int rc, int flags, const mosquitto_property *properties);
+#endif
+    static void on_disconnect(struct mosquitto *, void *obj, int rc);
+    static void on_publish(struct mosquitto *, void *obj, int mid);
+    static void on_message(struct mosquitto *, void *obj, const struct mosquitto_message *message);
+    static void on_subscribe(struct mosquitto *, void *obj, int mid, int qos_count, const int *granted_qos);
+    static void on_unsubscribe(struct mosquitto *, void *obj, int mid);
+    static void on_log(struct mosquitto *, void *obj, int level, const char *str);
 };
 
 }
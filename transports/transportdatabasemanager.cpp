@@ -19,13 +19,26 @@
 #include "transportdatabasemanager.h"
 
 #include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QFile>
 #include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QtEndian>
+
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <string.h>
 
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlError>
 #include <QtSql/QSqlQuery>
 
+#include <HyperspaceCore/BSONDocument>
+#include <HyperspaceCore/BSONSerializer>
+
 #define VERSION_VALUE 0
 
 #define TARGET_VALUE 0
@@ -34,17 +47,533 @@
 #define EXPIRY_VALUE 0
 
 #define ID_VALUE 0
+#define MAX_ID_VALUE 0
 #define CACHEMESSAGE_VALUE 1
+#define CACHEMESSAGE_PAYLOAD_VALUE 2
+#define CACHEMESSAGE_TARGET_VALUE 3
+#define CACHEMESSAGE_INTERFACE_TYPE_VALUE 4
+#define CACHEMESSAGE_RELIABILITY_VALUE 5
+#define CACHEMESSAGE_RETENTION_VALUE 6
+#define CACHEMESSAGE_ATTRIBUTES_VALUE 7
+#define CACHEMESSAGE_COMPRESSION_VALUE 8
+
+#define CACHEMESSAGE_COLUMNS "id, cachemessage, payload, target, interface_type, reliability, retention, attributes, compression"
+
+#define PAYLOAD_COMPRESSION_NONE 0
+#define PAYLOAD_COMPRESSION_ZLIB 1
+// Smaller payloads rarely get any smaller
+#define PAYLOAD_COMPRESSION_MIN_SIZE 64
+
+#define DELETE_CHUNK_SIZE 500
+
+// The migration filling the normalized columns of rows written before them
+#define BACKFILL_SCHEMA_VERSION 6
+#define BACKFILL_PAGE_SIZE 256
+
+#define SQLITE_HEADER_SIZE 100
+#define SQLITE_HEADER_MAGIC "SQLite format 3"
+#define SQLITE_HEADER_PAGE_SIZE_OFFSET 16
+
+// Rows copied per query when rebuilding
+#define INTEGRITY_PAGE_SIZE 256
+// Problems reported by the background check, past the first few the database is to be recovered anyway
+#define INTEGRITY_MAX_ERRORS 10
 
 Q_LOGGING_CATEGORY(transportDatabaseManagerDC, "hyperdrive.transportdatabasemanager", DEBUG_MESSAGES_DEFAULT_LEVEL)
 
+namespace {
+
+struct ConnectionState
+{
+    ConnectionState() : transactionDepth(0), synchronousMode(Hyperdrive::TransportDatabaseManager::SynchronousMode::Normal) {}
+
+    QHash<QString, QSqlQuery> preparedQueries;
+    int transactionDepth;
+    Hyperdrive::TransportDatabaseManager::SynchronousMode synchronousMode;
+};
+
+enum class WriteKind {
+    Insert,
+    Update,
+    Delete
+};
+
+// Connections are bound to the thread which opened them, so is their state
+typedef QHash<QString, ConnectionState> ConnectionStatesHash;
+
+}
+
+Q_GLOBAL_STATIC(QThreadStorage<ConnectionStatesHash>, s_connectionStates)
+
 namespace Hyperdrive {
 
 namespace TransportDatabaseManager {
 
-bool ensureDatabase(const QString &dbPath, const QString &migrationsDirPath)
+static SynchronousMode s_synchronousMode = SynchronousMode::Normal;
+static int s_payloadCompressionLevel = 0;
+static IntegrityRecovery s_integrityRecovery = IntegrityRecovery::Rebuild;
+
+// Updated from every connection thread
+static QMutex s_statisticsMutex;
+static Statistics s_statistics;
+
+static QString effectiveConnectionName(const QString &connectionName)
+{
+    return connectionName.isEmpty() ? QLatin1String(QSqlDatabase::defaultConnection) : connectionName;
+}
+
+static QSqlDatabase databaseConnection(const QString &connectionName)
+{
+    QSqlDatabase db = QSqlDatabase::database(effectiveConnectionName(connectionName), false);
+    if (!db.isOpen()) {
+        qCWarning(transportDatabaseManagerDC) << "Database connection" << effectiveConnectionName(connectionName) << "is not open, call ensureDatabase first";
+    }
+    return db;
+}
+
+static ConnectionState &connectionState(const QString &connectionName)
+{
+    return s_connectionStates->localData()[effectiveConnectionName(connectionName)];
+}
+
+// Statements are prepared once and kept alive for the lifetime of the connection
+static QSqlQuery preparedQuery(const QString &statement, const QString &connectionName)
+{
+    QHash<QString, QSqlQuery> &preparedQueries = connectionState(connectionName).preparedQueries;
+    QHash<QString, QSqlQuery>::const_iterator it = preparedQueries.constFind(statement);
+    if (it != preparedQueries.constEnd()) {
+        return it.value();
+    }
+
+    QSqlQuery query(QSqlDatabase::database(effectiveConnectionName(connectionName), false));
+    if (!query.prepare(statement)) {
+        qCWarning(transportDatabaseManagerDC) << "Could not prepare query" << statement << query.lastError();
+        return query;
+    }
+
+    preparedQueries.insert(statement, query);
+    return query;
+}
+
+// The target is /interface/path
+static QByteArray interfaceFromTarget(const QByteArray &target)
+{
+    int separator = target.indexOf('/', 1);
+    return separator < 0 ? target.mid(1) : target.mid(1, separator - 1);
+}
+
+// Rows written before the schema was normalized keep their fields in the serialized CacheMessage, which SQL can't
+// decode. The columns are filled from it, the serialized message stays the one read back.
+static bool backfillCacheMessages(const QSqlDatabase &db)
+{
+    QSqlQuery selectQuery(db);
+    selectQuery.prepare(QStringLiteral("SELECT id, cachemessage FROM cachemessages WHERE cachemessage IS NOT NULL AND target IS NULL "
+                                       "AND id > :id ORDER BY id LIMIT %1").arg(BACKFILL_PAGE_SIZE));
+    QSqlQuery updateQuery(db);
+    updateQuery.prepare(QStringLiteral("UPDATE cachemessages SET target=:target, interface=:interface, interface_type=:interface_type, "
+                                       "reliability=:reliability, retention=:retention, enqueue_time=:enqueue_time WHERE id=:id"));
+    // When they were enqueued is not recorded, the migration is the closest known time
+    qint64 enqueueTime = QDateTime::currentMSecsSinceEpoch();
+
+    int lastId = -1;
+    QList< QPair< int, CacheMessage > > page;
+    do {
+        page.clear();
+        selectQuery.bindValue(QStringLiteral(":id"), lastId);
+        if (!selectQuery.exec()) {
+            qCWarning(transportDatabaseManagerDC) << "Could not read legacy cache messages" << selectQuery.lastError();
+            return false;
+        }
+        while (selectQuery.next()) {
+            lastId = selectQuery.value(0).toInt();
+            page.append(qMakePair(lastId, CacheMessage::fromBinary(selectQuery.value(1).toByteArray())));
+        }
+        selectQuery.finish();
+
+        for (const QPair< int, CacheMessage > &row : page) {
+            const CacheMessage &c = row.second;
+            updateQuery.bindValue(QStringLiteral(":id"), row.first);
+            updateQuery.bindValue(QStringLiteral(":target"), c.target());
+            updateQuery.bindValue(QStringLiteral(":interface"), interfaceFromTarget(c.target()));
+            updateQuery.bindValue(QStringLiteral(":interface_type"), static_cast<int>(c.interfaceType()));
+            updateQuery.bindValue(QStringLiteral(":reliability"), c.hasAttribute("reliability") ? QVariant(c.attribute("reliability").toInt()) : QVariant(QVariant::Int));
+            updateQuery.bindValue(QStringLiteral(":retention"), c.hasAttribute("retention") ? QVariant(c.attribute("retention").toInt()) : QVariant(QVariant::Int));
+            updateQuery.bindValue(QStringLiteral(":enqueue_time"), enqueueTime);
+            if (!updateQuery.exec()) {
+                qCWarning(transportDatabaseManagerDC) << "Could not backfill cache message" << row.first << updateQuery.lastError();
+                return false;
+            }
+        }
+    } while (page.size() == BACKFILL_PAGE_SIZE);
+
+    return true;
+}
+
+// Expects a query selecting CACHEMESSAGE_COLUMNS
+static CacheMessage cacheMessageFromQuery(const QSqlQuery &query)
+{
+    CacheMessage c;
+    if (!query.isNull(CACHEMESSAGE_VALUE)) {
+        // Rows written before the schema was normalized keep the serialized CacheMessage
+        c = CacheMessage::fromBinary(query.value(CACHEMESSAGE_VALUE).toByteArray());
+    } else {
+        c.setTarget(query.value(CACHEMESSAGE_TARGET_VALUE).toByteArray());
+        c.setInterfaceType(static_cast<Hyperdrive::Interface::Type>(query.value(CACHEMESSAGE_INTERFACE_TYPE_VALUE).toInt()));
+        if (!query.isNull(CACHEMESSAGE_ATTRIBUTES_VALUE)) {
+            c.setAttributes(Hyperspace::Util::BSONDocument(query.value(CACHEMESSAGE_ATTRIBUTES_VALUE).toByteArray()).byteArrayValuesHash());
+        }
+        if (!query.isNull(CACHEMESSAGE_RELIABILITY_VALUE)) {
+            c.addAttribute("reliability", QByteArray::number(query.value(CACHEMESSAGE_RELIABILITY_VALUE).toInt()));
+        }
+        if (!query.isNull(CACHEMESSAGE_RETENTION_VALUE)) {
+            c.addAttribute("retention", QByteArray::number(query.value(CACHEMESSAGE_RETENTION_VALUE).toInt()));
+        }
+    }
+    // Rows written before the payload column was introduced keep the payload inside the CacheMessage
+    if (!query.isNull(CACHEMESSAGE_PAYLOAD_VALUE)) {
+        if (query.value(CACHEMESSAGE_COMPRESSION_VALUE).toInt() == PAYLOAD_COMPRESSION_ZLIB) {
+            c.setPayload(qUncompress(query.value(CACHEMESSAGE_PAYLOAD_VALUE).toByteArray()));
+        } else {
+            c.setPayload(query.value(CACHEMESSAGE_PAYLOAD_VALUE).toByteArray());
+        }
+    }
+    c.addAttribute("dbId", QByteArray::number(query.value(ID_VALUE).toInt()));
+    return c;
+}
+
+// Runs a write query, or statement if given, and accounts it in the statistics
+static bool execWrite(QSqlQuery &query, WriteKind kind, quint64 bytes, const QString &statement = QString())
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = statement.isEmpty() ? query.exec() : query.exec(statement);
+
+    Statistics statistics;
+    statistics.nanosecondsSpent = timer.nsecsElapsed();
+    if (ok) {
+        quint64 rows = qMax(0, query.numRowsAffected());
+        switch (kind) {
+            case WriteKind::Insert:
+                statistics.rowsInserted = rows;
+                break;
+            case WriteKind::Update:
+                statistics.rowsUpdated = rows;
+                break;
+            case WriteKind::Delete:
+                statistics.rowsDeleted = rows;
+                break;
+        }
+        statistics.bytesWritten = bytes;
+    }
+    addStatistics(statistics);
+
+    return ok;
+}
+
+// Runs a read query, accounting the time spent
+static bool execRead(QSqlQuery &query)
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = query.exec();
+
+    Statistics statistics;
+    statistics.nanosecondsSpent = timer.nsecsElapsed();
+    addStatistics(statistics);
+
+    return ok;
+}
+
+Statistics::Statistics()
+    : bytesWritten(0)
+    , rowsInserted(0)
+    , rowsUpdated(0)
+    , rowsDeleted(0)
+    , transactions(0)
+    , syncs(0)
+    , nanosecondsSpent(0)
+{
+}
+
+Statistics &Statistics::operator+=(const Statistics &other)
 {
-    if (QSqlDatabase::database().isValid()) {
+    bytesWritten += other.bytesWritten;
+    rowsInserted += other.rowsInserted;
+    rowsUpdated += other.rowsUpdated;
+    rowsDeleted += other.rowsDeleted;
+    transactions += other.transactions;
+    syncs += other.syncs;
+    nanosecondsSpent += other.nanosecondsSpent;
+    return *this;
+}
+
+Statistics statistics()
+{
+    QMutexLocker locker(&s_statisticsMutex);
+    return s_statistics;
+}
+
+void addStatistics(const Statistics &statistics)
+{
+    QMutexLocker locker(&s_statisticsMutex);
+    s_statistics += statistics;
+}
+
+void setSynchronousMode(SynchronousMode mode)
+{
+    s_synchronousMode = mode;
+}
+
+void setPayloadCompressionLevel(int level)
+{
+    s_payloadCompressionLevel = qBound(0, level, 9);
+}
+
+SynchronousMode synchronousMode()
+{
+    return s_synchronousMode;
+}
+
+bool applySynchronousMode(SynchronousMode mode, const QString &connectionName)
+{
+    QSqlDatabase db = databaseConnection(connectionName);
+    if (!db.isOpen()) {
+        return false;
+    }
+
+    QSqlQuery pragmaQuery(db);
+    if (!pragmaQuery.exec(QStringLiteral("PRAGMA synchronous=%1").arg(static_cast<int>(mode)))) {
+        qCWarning(transportDatabaseManagerDC) << "Could not set synchronous mode" << pragmaQuery.lastError();
+        return false;
+    }
+
+    connectionState(connectionName).synchronousMode = mode;
+    return true;
+}
+
+void setIntegrityRecovery(IntegrityRecovery recovery)
+{
+    s_integrityRecovery = recovery;
+}
+
+// Left next to the database by checkIntegrity, recovery happens at the next ensureDatabase
+static QString corruptionFlagPath(const QString &dbPath)
+{
+    return dbPath + QStringLiteral(".corrupted");
+}
+
+// Checks only the first bytes of the file, instead of reading the whole database
+static bool hasValidHeader(const QString &dbPath)
+{
+    QFile dbFile(dbPath);
+    if (!dbFile.exists() || dbFile.size() == 0) {
+        // SQLite creates it
+        return true;
+    }
+
+    if (!dbFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QByteArray header = dbFile.read(SQLITE_HEADER_SIZE);
+    if (header.size() < SQLITE_HEADER_SIZE || memcmp(header.constData(), SQLITE_HEADER_MAGIC, sizeof(SQLITE_HEADER_MAGIC)) != 0) {
+        return false;
+    }
+
+    // A power of two between 512 and 65536, the latter stored as 1
+    quint32 pageSize = qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(header.constData()) + SQLITE_HEADER_PAGE_SIZE_OFFSET);
+    if (pageSize == 1) {
+        pageSize = 65536;
+    }
+    if (pageSize < 512 || pageSize > 65536 || (pageSize & (pageSize - 1)) != 0) {
+        return false;
+    }
+
+    return dbFile.size() % pageSize == 0;
+}
+
+static void removeDatabaseFiles(const QString &dbPath)
+{
+    QFile::remove(dbPath);
+    QFile::remove(dbPath + QStringLiteral("-wal"));
+    QFile::remove(dbPath + QStringLiteral("-shm"));
+}
+
+// Copies the schema and every readable row of the damaged database to a new one, which then replaces it
+static bool rebuildDatabase(const QString &dbPath)
+{
+    QString recoveryPath = dbPath + QStringLiteral(".recovery");
+    QString recoveryConnectionName = QStringLiteral("%1-recovery").arg(dbPath);
+    removeDatabaseFiles(recoveryPath);
+
+    bool ok = false;
+    int copiedRows = 0;
+    int lostPages = 0;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), recoveryConnectionName);
+        db.setDatabaseName(recoveryPath);
+        if (db.open()) {
+            QSqlQuery query(db);
+            if (!query.exec(QStringLiteral("ATTACH DATABASE '%1' AS damaged").arg(QString(dbPath).replace(QLatin1Char('\''), QStringLiteral("''"))))) {
+                qCWarning(transportDatabaseManagerDC) << "Could not attach damaged database" << query.lastError();
+            } else if (!query.exec(QStringLiteral("SELECT type, name, sql FROM damaged.sqlite_master "
+                                                  "WHERE sql IS NOT NULL AND name NOT LIKE 'sqlite_%' ORDER BY type = 'table' DESC"))) {
+                qCWarning(transportDatabaseManagerDC) << "Could not read the schema of the damaged database" << query.lastError();
+            } else {
+                QStringList tables;
+                QStringList statements;
+                while (query.next()) {
+                    if (query.value(0).toString() == QStringLiteral("table")) {
+                        tables.append(query.value(1).toString());
+                    }
+                    statements.append(query.value(2).toString());
+                }
+                query.finish();
+
+                ok = true;
+                db.transaction();
+                for (const QString &statement : statements) {
+                    if (!query.exec(statement)) {
+                        qCWarning(transportDatabaseManagerDC) << "Could not recreate" << statement << query.lastError();
+                        ok = false;
+                    }
+                }
+
+                // Rows are copied a page at a time, keyset paged by rowid. A page which cannot be read is skipped:
+                // the cursor moves past its rowid range.
+                for (const QString &table : tables) {
+                    qint64 maxRowId = -1;
+                    if (query.exec(QStringLiteral("SELECT max(rowid) FROM damaged.\"%1\"").arg(table)) && query.next()) {
+                        maxRowId = query.value(0).toLongLong();
+                    }
+                    query.finish();
+
+                    if (maxRowId < 0) {
+                        // The rightmost page is unreadable, try the whole table at once
+                        if (query.exec(QStringLiteral("INSERT OR IGNORE INTO main.\"%1\" SELECT * FROM damaged.\"%1\"").arg(table))) {
+                            copiedRows += query.numRowsAffected();
+                        } else {
+                            ++lostPages;
+                        }
+                        continue;
+                    }
+
+                    qint64 cursor = -1;
+                    while (cursor < maxRowId) {
+                        qint64 pageEnd = -1;
+                        if (query.exec(QStringLiteral("SELECT max(rowid) FROM (SELECT rowid FROM damaged.\"%1\" WHERE rowid > %2 ORDER BY rowid LIMIT %3)")
+                                       .arg(table).arg(cursor).arg(INTEGRITY_PAGE_SIZE)) && query.next()) {
+                            pageEnd = query.value(0).isNull() ? maxRowId : query.value(0).toLongLong();
+                        }
+                        query.finish();
+
+                        if (pageEnd < 0) {
+                            // The rowids of this page cannot be read either, skip a page worth of them
+                            ++lostPages;
+                            cursor += INTEGRITY_PAGE_SIZE;
+                            continue;
+                        }
+
+                        if (query.exec(QStringLiteral("INSERT OR IGNORE INTO main.\"%1\" SELECT * FROM damaged.\"%1\" WHERE rowid > %2 AND rowid <= %3")
+                                       .arg(table).arg(cursor).arg(pageEnd))) {
+                            copiedRows += query.numRowsAffected();
+                        } else {
+                            ++lostPages;
+                        }
+                        cursor = pageEnd;
+                    }
+                }
+                ok = db.commit() && ok;
+            }
+            query.exec(QStringLiteral("DETACH DATABASE damaged"));
+            db.close();
+        } else {
+            qCWarning(transportDatabaseManagerDC) << "Could not create recovery database" << recoveryPath << db.lastError().text();
+        }
+    }
+    QSqlDatabase::removeDatabase(recoveryConnectionName);
+
+    if (!ok) {
+        removeDatabaseFiles(recoveryPath);
+        return false;
+    }
+
+    qCWarning(transportDatabaseManagerDC) << "Rebuilt database" << dbPath << "copying" << copiedRows << "rows," << lostPages << "ranges could not be read";
+
+    removeDatabaseFiles(dbPath);
+    return QFile::rename(recoveryPath, dbPath);
+}
+
+static bool recoverDatabase(const QString &dbPath)
+{
+    if (s_integrityRecovery == IntegrityRecovery::Rebuild && hasValidHeader(dbPath) && rebuildDatabase(dbPath)) {
+        return true;
+    }
+
+    qCWarning(transportDatabaseManagerDC) << "Deleting damaged database" << dbPath << "and starting from a new one";
+    removeDatabaseFiles(dbPath);
+    return !QFile::exists(dbPath);
+}
+
+static bool checkIntegrityInBackground(const QString &dbPath)
+{
+    QString checkConnectionName = QStringLiteral("%1-integrity-check").arg(dbPath);
+    bool healthy = true;
+    QString failure;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), checkConnectionName);
+        db.setDatabaseName(dbPath);
+        db.setConnectOptions(QStringLiteral("QSQLITE_OPEN_READONLY"));
+        if (!db.open()) {
+            healthy = false;
+            failure = db.lastError().text();
+        } else {
+            // quick_check walks every b-tree, tables and indexes, and the freelist: it does not compare indexes
+            // with their tables, as integrity_check does. In WAL mode the transport keeps writing meanwhile.
+            QSqlQuery query(db);
+            if (!query.exec(QStringLiteral("PRAGMA quick_check(%1)").arg(INTEGRITY_MAX_ERRORS))) {
+                healthy = false;
+                failure = query.lastError().text();
+            } else {
+                QStringList errors;
+                while (query.next()) {
+                    errors.append(query.value(0).toString());
+                }
+                if (query.lastError().isValid()) {
+                    errors.append(query.lastError().text());
+                }
+                if (errors != QStringList(QStringLiteral("ok"))) {
+                    healthy = false;
+                    failure = errors.join(QStringLiteral("; "));
+                }
+            }
+            query.finish();
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(checkConnectionName);
+
+    if (healthy) {
+        qCDebug(transportDatabaseManagerDC) << "Database" << dbPath << "passed the integrity check";
+        return true;
+    }
+
+    qCWarning(transportDatabaseManagerDC) << "Database" << dbPath << "is damaged, it will be recovered when it is opened again:" << failure;
+    QFile flag(corruptionFlagPath(dbPath));
+    if (!flag.open(QIODevice::WriteOnly)) {
+        qCWarning(transportDatabaseManagerDC) << "Could not flag damaged database" << flag.fileName() << flag.errorString();
+    }
+    return false;
+}
+
+QFuture<bool> checkIntegrity(const QString &dbPath)
+{
+    return QtConcurrent::run(checkIntegrityInBackground, dbPath);
+}
+
+bool ensureDatabase(const QString &dbPath, const QString &migrationsDirPath, const QString &connectionName)
+{
+    if (QSqlDatabase::database(effectiveConnectionName(connectionName), false).isOpen()) {
         return true;
     }
 
@@ -54,7 +583,7 @@ bool ensureDatabase(const QString &dbPath, const QString &migrationsDirPath)
     }
 
     // Let's create our connection.
-    QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"));
+    QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), effectiveConnectionName(connectionName));
 
     // Does the directory exist? We have to create, or SQLITE will complain.
     QDir dbDir(QFileInfo(dbPath).dir());
@@ -64,16 +593,29 @@ bool ensureDatabase(const QString &dbPath, const QString &migrationsDirPath)
 
     db.setDatabaseName(dbPath);
 
+    // A full check would read the whole database here: only the header is checked, checkIntegrity does the rest
+    if (QFile::exists(corruptionFlagPath(dbPath)) || !hasValidHeader(dbPath)) {
+        qCWarning(transportDatabaseManagerDC) << "Database" << dbPath << "is damaged, recovering it";
+        if (!recoverDatabase(dbPath)) {
+            qCWarning(transportDatabaseManagerDC) << "Can't recover database " << dbPath << ", giving up ";
+            return false;
+        }
+        QFile::remove(corruptionFlagPath(dbPath));
+    }
+
     if (!db.open()) {
         qCWarning(transportDatabaseManagerDC) << "Could not open database!" << dbPath << db.lastError().text();
         return false;
     }
 
-    QSqlQuery checkQuery(QStringLiteral("pragma quick_check"));
-    if (!checkQuery.exec()) {
+    // Reads the first page only
+    QSqlQuery checkQuery(db);
+    if (!checkQuery.exec(QStringLiteral("PRAGMA schema_version"))) {
         qCWarning(transportDatabaseManagerDC) << "Database" << dbPath << " is corrupted, deleting it and starting from a new one " << checkQuery.lastError();
+        checkQuery.finish();
         db.close();
-        if (!QFile::remove(dbPath)) {
+        removeDatabaseFiles(dbPath);
+        if (QFile::exists(dbPath)) {
             qCWarning(transportDatabaseManagerDC) << "Can't remove database " << dbPath << ", giving up ";
             return false;
         }
@@ -83,7 +625,18 @@ bool ensureDatabase(const QString &dbPath, const QString &migrationsDirPath)
         }
     }
 
-    QSqlQuery migrationQuery;
+    // WAL mode appends to the log instead of syncing a rollback journal on every commit
+    QSqlQuery pragmaQuery(db);
+    if (!pragmaQuery.exec(QStringLiteral("PRAGMA journal_mode=WAL"))) {
+        qCWarning(transportDatabaseManagerDC) << "Could not enable WAL mode" << pragmaQuery.lastError();
+    }
+    if (!pragmaQuery.exec(QStringLiteral("PRAGMA synchronous=%1").arg(static_cast<int>(s_synchronousMode)))) {
+        qCWarning(transportDatabaseManagerDC) << "Could not set synchronous mode" << pragmaQuery.lastError();
+    } else {
+        connectionState(connectionName).synchronousMode = s_synchronousMode;
+    }
+
+    QSqlQuery migrationQuery(db);
 
     // Ok. Let's query our migrations.
     QDir migrationsDir(migrationsDirPath);
@@ -97,7 +650,7 @@ bool ensureDatabase(const QString &dbPath, const QString &migrationsDirPath)
     }
 
     // Query our schema table
-    QSqlQuery schemaQuery(QStringLiteral("SELECT version from schema_version"));
+    QSqlQuery schemaQuery(QStringLiteral("SELECT version from schema_version"), db);
     int currentSchemaVersion = -1;
     while (schemaQuery.next()) {
         if (schemaQuery.value(VERSION_VALUE).toInt() == latestSchemaVersion) {
@@ -137,21 +690,36 @@ bool ensureDatabase(const QString &dbPath, const QString &migrationsDirPath)
             continue;
         }
 
-        // Apply migration
+        // Apply migration. The driver runs a single statement per exec, so statements are split on ';'
+        // and applied together with the schema version update, in a single transaction.
+        db.transaction();
         QFile migrationFile(migrations.value(currentSchemaVersion));
         if (migrationFile.open(QIODevice::ReadOnly)) {
-            QString queryString = QTextStream(&migrationFile).readAll();
-            if (!migrationQuery.exec(queryString)) {
-                qCWarning(transportDatabaseManagerDC) << "Could not execute migration" << currentSchemaVersion << migrationQuery.lastError();
-                return false;
+            QStringList statements = QTextStream(&migrationFile).readAll().split(QLatin1Char(';'), QString::SkipEmptyParts);
+            for (const QString &statement : statements) {
+                if (statement.trimmed().isEmpty()) {
+                    continue;
+                }
+                if (!migrationQuery.exec(statement)) {
+                    qCWarning(transportDatabaseManagerDC) << "Could not execute migration" << currentSchemaVersion << migrationQuery.lastError();
+                    db.rollback();
+                    return false;
+                }
             }
         }
+        if (currentSchemaVersion == BACKFILL_SCHEMA_VERSION && !backfillCacheMessages(db)) {
+            db.rollback();
+            return false;
+        }
 
         // Update schema version
         if (!migrationQuery.exec(QStringLiteral("UPDATE schema_version SET version=%1").arg(currentSchemaVersion))) {
             qCWarning(transportDatabaseManagerDC) << "Could not update schema_version!! This error is critical, your database is compromised!!" << migrationQuery.lastError();
+            db.rollback();
             return false;
         }
+        migrationQuery.finish();
+        db.commit();
 
         qCDebug(transportDatabaseManagerDC) << "Migration performed" << currentSchemaVersion;
     }
@@ -160,19 +728,159 @@ bool ensureDatabase(const QString &dbPath, const QString &migrationsDirPath)
     return true;
 }
 
-bool Transactions::insertPersistentEntry(const QByteArray &target, const QByteArray &payload)
+bool openDatabaseReadOnly(const QString &dbPath, const QString &migrationsDirPath, const QString &connectionName, bool *outdated)
+{
+    if (outdated) {
+        *outdated = false;
+    }
+
+    if (!QFile::exists(dbPath)) {
+        qCWarning(transportDatabaseManagerDC) << "Database" << dbPath << "does not exist";
+        return false;
+    }
+
+    int latestSchemaVersion = 0;
+    QDir migrationsDir(migrationsDirPath);
+    migrationsDir.setFilter(QDir::Files | QDir::NoSymLinks);
+    for (const QFileInfo &migration : migrationsDir.entryInfoList()) {
+        latestSchemaVersion = qMax(latestSchemaVersion, migration.baseName().split(QLatin1Char('_')).first().toInt());
+    }
+
+    QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), effectiveConnectionName(connectionName));
+    db.setDatabaseName(dbPath);
+    db.setConnectOptions(QStringLiteral("QSQLITE_OPEN_READONLY"));
+    if (!db.open()) {
+        qCWarning(transportDatabaseManagerDC) << "Could not open database" << dbPath << "read only" << db.lastError().text();
+        db = QSqlDatabase();
+        closeDatabase(connectionName);
+        return false;
+    }
+
+    int currentSchemaVersion = -1;
+    {
+        QSqlQuery schemaQuery(QStringLiteral("SELECT version from schema_version"), db);
+        if (schemaQuery.next()) {
+            currentSchemaVersion = schemaQuery.value(VERSION_VALUE).toInt();
+        }
+    }
+
+    if (currentSchemaVersion < latestSchemaVersion) {
+        qCWarning(transportDatabaseManagerDC) << "Database" << dbPath << "has schema version" << currentSchemaVersion
+                                              << ", the latest is" << latestSchemaVersion;
+        if (outdated) {
+            *outdated = true;
+        }
+        db = QSqlDatabase();
+        closeDatabase(connectionName);
+        return false;
+    }
+
+    return true;
+}
+
+void closeDatabase(const QString &connectionName)
 {
-    if (!ensureDatabase()) {
+    // Prepared queries have to go away before the connection is removed
+    s_connectionStates->localData().remove(effectiveConnectionName(connectionName));
+
+    {
+        QSqlDatabase db = QSqlDatabase::database(effectiveConnectionName(connectionName), false);
+        if (db.isOpen()) {
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(effectiveConnectionName(connectionName));
+}
+
+bool vacuum(const QString &connectionName)
+{
+    QSqlDatabase db = databaseConnection(connectionName);
+    if (!db.isOpen()) {
+        return false;
+    }
+
+    if (connectionState(connectionName).transactionDepth > 0) {
+        qCWarning(transportDatabaseManagerDC) << "Cannot vacuum the database inside a transaction";
+        return false;
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec(QStringLiteral("PRAGMA wal_checkpoint(TRUNCATE)"))) {
+        qCWarning(transportDatabaseManagerDC) << "Could not checkpoint the database" << query.lastError();
         return false;
     }
 
-    QSqlQuery query;
-    query.prepare(QStringLiteral("INSERT INTO persistent_entries (target, payload) "
-                                 "VALUES (:target, :payload)"));
+    if (!execWrite(query, WriteKind::Update, 0, QStringLiteral("VACUUM"))) {
+        qCWarning(transportDatabaseManagerDC) << "Could not vacuum the database" << query.lastError();
+        return false;
+    }
+
+    // VACUUM goes through the WAL too
+    if (!query.exec(QStringLiteral("PRAGMA wal_checkpoint(TRUNCATE)"))) {
+        qCWarning(transportDatabaseManagerDC) << "Could not checkpoint the database" << query.lastError();
+        return false;
+    }
+
+    return true;
+}
+
+ScopedTransaction::ScopedTransaction(const QString &connectionName)
+    : m_connectionName(connectionName)
+    , m_active(false)
+{
+    QSqlDatabase db = databaseConnection(m_connectionName);
+    if (!db.isOpen()) {
+        return;
+    }
+
+    ConnectionState &state = connectionState(m_connectionName);
+    if (state.transactionDepth == 0 && !db.transaction()) {
+        qCWarning(transportDatabaseManagerDC) << "Could not begin transaction" << db.lastError();
+        return;
+    }
+
+    ++state.transactionDepth;
+    m_active = true;
+}
+
+ScopedTransaction::~ScopedTransaction()
+{
+    if (!m_active) {
+        return;
+    }
+
+    ConnectionState &state = connectionState(m_connectionName);
+    if (--state.transactionDepth == 0) {
+        QSqlDatabase db = QSqlDatabase::database(effectiveConnectionName(m_connectionName), false);
+        QElapsedTimer timer;
+        timer.start();
+        if (!db.commit()) {
+            qCWarning(transportDatabaseManagerDC) << "Could not commit transaction" << db.lastError();
+            db.rollback();
+            return;
+        }
+
+        Statistics statistics;
+        statistics.transactions = 1;
+        // In WAL mode only FULL and EXTRA sync the log on every commit
+        statistics.syncs = state.synchronousMode >= SynchronousMode::Full ? 1 : 0;
+        statistics.nanosecondsSpent = timer.nsecsElapsed();
+        addStatistics(statistics);
+    }
+}
+
+bool Transactions::insertPersistentEntry(const QByteArray &target, const QByteArray &payload, const QString &connectionName)
+{
+    if (!databaseConnection(connectionName).isOpen()) {
+        return false;
+    }
+
+    QSqlQuery query = preparedQuery(QStringLiteral("INSERT INTO persistent_entries (target, payload) "
+                                                   "VALUES (:target, :payload)"), connectionName);
     query.bindValue(QStringLiteral(":target"), QLatin1String(target));
     query.bindValue(QStringLiteral(":payload"), payload);
 
-    if (!query.exec()) {
+    if (!execWrite(query, WriteKind::Insert, target.size() + payload.size())) {
         qCWarning(transportDatabaseManagerDC) << "Insert persistent entry query failed!" << query.lastError();
         return false;
     }
@@ -180,19 +888,18 @@ bool Transactions::insertPersistentEntry(const QByteArray &target, const QByteAr
     return true;
 }
 
-bool Transactions::updatePersistentEntry(const QByteArray &target, const QByteArray &payload)
+bool Transactions::updatePersistentEntry(const QByteArray &target, const QByteArray &payload, const QString &connectionName)
 {
-    if (!ensureDatabase()) {
+    if (!databaseConnection(connectionName).isOpen()) {
         return false;
     }
 
-    QSqlQuery query;
-    query.prepare(QStringLiteral("UPDATE persistent_entries SET payload=:payload "
-                                 "WHERE target=:target"));
+    QSqlQuery query = preparedQuery(QStringLiteral("UPDATE persistent_entries SET payload=:payload "
+                                                   "WHERE target=:target"), connectionName);
     query.bindValue(QStringLiteral(":target"), QLatin1String(target));
     query.bindValue(QStringLiteral(":payload"), payload);
 
-    if (!query.exec()) {
+    if (!execWrite(query, WriteKind::Update, target.size() + payload.size())) {
         qCWarning(transportDatabaseManagerDC) << "Update persistent entry query failed!" << query.lastError();
         return false;
     }
@@ -200,17 +907,16 @@ bool Transactions::updatePersistentEntry(const QByteArray &target, const QByteAr
     return true;
 }
 
-bool Transactions::deletePersistentEntry(const QByteArray &target)
+bool Transactions::deletePersistentEntry(const QByteArray &target, const QString &connectionName)
 {
-    if (!ensureDatabase()) {
+    if (!databaseConnection(connectionName).isOpen()) {
         return false;
     }
 
-    QSqlQuery query;
-    query.prepare(QStringLiteral("DELETE FROM persistent_entries WHERE target=:target"));
+    QSqlQuery query = preparedQuery(QStringLiteral("DELETE FROM persistent_entries WHERE target=:target"), connectionName);
     query.bindValue(QStringLiteral(":target"), QLatin1String(target));
 
-    if (!query.exec()) {
+    if (!execWrite(query, WriteKind::Delete, 0)) {
         qCWarning(transportDatabaseManagerDC) << "Delete persistent entry " << target << " query failed!" << query.lastError();
         return false;
     }
@@ -218,18 +924,17 @@ bool Transactions::deletePersistentEntry(const QByteArray &target)
     return true;
 }
 
-QHash<QByteArray, QByteArray> Transactions::allPersistentEntries()
+QHash<QByteArray, QByteArray> Transactions::allPersistentEntries(const QString &connectionName)
 {
     QHash<QByteArray, QByteArray> ret;
 
-    if (!ensureDatabase()) {
+    if (!databaseConnection(connectionName).isOpen()) {
         return ret;
     }
 
-    QSqlQuery query;
-    query.prepare(QStringLiteral("SELECT target, payload FROM persistent_entries"));
+    QSqlQuery query = preparedQuery(QStringLiteral("SELECT target, payload FROM persistent_entries"), connectionName);
 
-    if (!query.exec()) {
+    if (!execRead(query)) {
         qCWarning(transportDatabaseManagerDC) << "All persistent entries query failed!" << query.lastError();
         return ret;
     }
@@ -237,41 +942,129 @@ QHash<QByteArray, QByteArray> Transactions::allPersistentEntries()
     while (query.next()) {
         ret.insert(query.value(TARGET_VALUE).toByteArray(), query.value(PAYLOAD_VALUE).toByteArray());
     }
+    query.finish();
 
     return ret;
 }
 
-int Transactions::insertCacheMessage(const CacheMessage &cacheMessage, const QDateTime &expiry)
+QByteArray Transactions::persistentEntry(const QByteArray &target, const QString &connectionName)
 {
-    if (!ensureDatabase()) {
-        return -1;
+    if (!databaseConnection(connectionName).isOpen()) {
+        return QByteArray();
+    }
+
+    QSqlQuery query = preparedQuery(QStringLiteral("SELECT target, payload FROM persistent_entries WHERE target = :target"), connectionName);
+    query.bindValue(QStringLiteral(":target"), QLatin1String(target));
+
+    if (!execRead(query)) {
+        qCWarning(transportDatabaseManagerDC) << "Persistent entry query failed!" << query.lastError();
+        return QByteArray();
+    }
+
+    QByteArray ret;
+    if (query.next()) {
+        ret = query.value(PAYLOAD_VALUE).toByteArray();
+        if (ret.isNull()) {
+            // Present, but empty
+            ret = QByteArray("");
+        }
+    }
+    query.finish();
+
+    return ret;
+}
+
+QList<QPair<QByteArray, QByteArray> > Transactions::persistentEntriesPage(const QByteArray &afterTarget, int limit, const QString &connectionName)
+{
+    QList<QPair<QByteArray, QByteArray> > ret;
+
+    if (!databaseConnection(connectionName).isOpen()) {
+        return ret;
     }
 
-    QSqlQuery query;
-    query.prepare(QStringLiteral("INSERT INTO cachemessages (cachemessage, expiry) "
-                                 "VALUES (:cachemessage, :expiry)"));
-    query.bindValue(QStringLiteral(":cachemessage"), cacheMessage.serialize());
+    QSqlQuery query = preparedQuery(QStringLiteral("SELECT target, payload FROM persistent_entries "
+                                                   "WHERE target > :after ORDER BY target LIMIT :limit"), connectionName);
+    query.bindValue(QStringLiteral(":after"), QLatin1String(afterTarget));
+    query.bindValue(QStringLiteral(":limit"), limit);
+
+    if (!execRead(query)) {
+        qCWarning(transportDatabaseManagerDC) << "Persistent entries page query failed!" << query.lastError();
+        return ret;
+    }
+
+    while (query.next()) {
+        ret.append(qMakePair(query.value(TARGET_VALUE).toByteArray(), query.value(PAYLOAD_VALUE).toByteArray()));
+    }
+    query.finish();
+
+    return ret;
+}
+
+bool Transactions::insertCacheMessage(int id, const CacheMessage &cacheMessage, const QDateTime &expiry, const QString &connectionName)
+{
+    if (!databaseConnection(connectionName).isOpen()) {
+        return false;
+    }
+
+    // Fields are stored in their own columns, so that they can be indexed and read back without decoding the whole message.
+    // The payload is stored as it is, so that it doesn't get copied again.
+    QHash<QByteArray, QByteArray> attributes = cacheMessage.attributes();
+    QVariant reliability = attributes.contains("reliability") ? QVariant(attributes.take("reliability").toInt()) : QVariant(QVariant::Int);
+    QVariant retention = attributes.contains("retention") ? QVariant(attributes.take("retention").toInt()) : QVariant(QVariant::Int);
+
+    QByteArray serializedAttributes;
+    if (!attributes.isEmpty()) {
+        Hyperspace::Util::BSONSerializer s;
+        for (QHash<QByteArray, QByteArray>::const_iterator i = attributes.constBegin(); i != attributes.constEnd(); ++i) {
+            s.appendASCIIString(i.key().constData(), i.value());
+        }
+        s.appendEndOfDocument();
+        serializedAttributes = s.document();
+    }
+
+    QSqlQuery query = preparedQuery(QStringLiteral("INSERT INTO cachemessages (id, target, interface, interface_type, reliability, retention, "
+                                                   "enqueue_time, expiry, payload, attributes, compression) "
+                                                   "VALUES (:id, :target, :interface, :interface_type, :reliability, :retention, "
+                                                   ":enqueue_time, :expiry, :payload, :attributes, :compression)"), connectionName);
+    query.bindValue(QStringLiteral(":id"), id);
+    query.bindValue(QStringLiteral(":target"), cacheMessage.target());
+    query.bindValue(QStringLiteral(":interface"), interfaceFromTarget(cacheMessage.target()));
+    query.bindValue(QStringLiteral(":interface_type"), static_cast<int>(cacheMessage.interfaceType()));
+    query.bindValue(QStringLiteral(":reliability"), reliability);
+    query.bindValue(QStringLiteral(":retention"), retention);
+    query.bindValue(QStringLiteral(":enqueue_time"), QDateTime::currentMSecsSinceEpoch());
     query.bindValue(QStringLiteral(":expiry"), expiry);
+    QByteArray payload = cacheMessage.payload();
+    int compression = PAYLOAD_COMPRESSION_NONE;
+    if (s_payloadCompressionLevel > 0 && payload.size() >= PAYLOAD_COMPRESSION_MIN_SIZE) {
+        QByteArray compressedPayload = qCompress(payload, s_payloadCompressionLevel);
+        if (compressedPayload.size() < payload.size()) {
+            payload = compressedPayload;
+            compression = PAYLOAD_COMPRESSION_ZLIB;
+        }
+    }
+    query.bindValue(QStringLiteral(":payload"), payload);
+    query.bindValue(QStringLiteral(":compression"), compression);
+    query.bindValue(QStringLiteral(":attributes"), serializedAttributes.isEmpty() ? QVariant(QVariant::ByteArray) : QVariant(serializedAttributes));
 
-    if (!query.exec()) {
+    if (!execWrite(query, WriteKind::Insert, cacheMessage.target().size() + payload.size() + serializedAttributes.size())) {
         qCWarning(transportDatabaseManagerDC) << "Insert CacheMessage query failed!" << query.lastError();
-        return -1;
+        return false;
     }
 
-    return query.lastInsertId().toInt();
+    return true;
 }
 
-bool Transactions::deleteCacheMessage(int id)
+bool Transactions::deleteCacheMessage(int id, const QString &connectionName)
 {
-    if (!ensureDatabase()) {
+    if (!databaseConnection(connectionName).isOpen()) {
         return false;
     }
 
-    QSqlQuery query;
-    query.prepare(QStringLiteral("DELETE FROM cachemessages WHERE id=:id"));
+    QSqlQuery query = preparedQuery(QStringLiteral("DELETE FROM cachemessages WHERE id=:id"), connectionName);
     query.bindValue(QStringLiteral(":id"), id);
 
-    if (!query.exec()) {
+    if (!execWrite(query, WriteKind::Delete, 0)) {
         qCWarning(transportDatabaseManagerDC) << "Delete CacheMessage query failed!" << query.lastError();
         return false;
     }
@@ -279,40 +1072,119 @@ bool Transactions::deleteCacheMessage(int id)
     return true;
 }
 
-QList<CacheMessage> Transactions::allCacheMessages()
+bool Transactions::deleteCacheMessages(const QVector<int> &ids, const QString &connectionName)
+{
+    QSqlDatabase db = databaseConnection(connectionName);
+    if (!db.isOpen()) {
+        return false;
+    }
+
+    // Ids are inlined in a single statement per chunk, since the number of ids varies from call to call
+    for (int first = 0; first < ids.count(); first += DELETE_CHUNK_SIZE) {
+        QStringList chunk;
+        for (int i = first; i < qMin(first + DELETE_CHUNK_SIZE, ids.count()); ++i) {
+            chunk.append(QString::number(ids.at(i)));
+        }
+
+        QSqlQuery query(db);
+        if (!execWrite(query, WriteKind::Delete, 0, QStringLiteral("DELETE FROM cachemessages WHERE id IN (%1)").arg(chunk.join(QLatin1Char(','))))) {
+            qCWarning(transportDatabaseManagerDC) << "Delete CacheMessages query failed!" << query.lastError();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int Transactions::maxCacheMessageId(const QString &connectionName)
+{
+    if (!databaseConnection(connectionName).isOpen()) {
+        return -1;
+    }
+
+    QSqlQuery query = preparedQuery(QStringLiteral("SELECT MAX(id) FROM cachemessages"), connectionName);
+
+    if (!execRead(query)) {
+        qCWarning(transportDatabaseManagerDC) << "Max CacheMessage id query failed!" << query.lastError();
+        return -1;
+    }
+
+    // MAX(id) is NULL, hence 0, when the table is empty
+    int ret = query.next() ? query.value(MAX_ID_VALUE).toInt() : 0;
+    query.finish();
+
+    return ret;
+}
+
+QList<CacheMessage> Transactions::allCacheMessages(const QString &connectionName)
 {
     QList<CacheMessage> ret;
 
-    if (!ensureDatabase()) {
+    // Housekeeping: delete expired CacheMessages
+    if (!deleteExpiredCacheMessages(connectionName)) {
         return ret;
     }
 
-    // Housekeeping: delete expired CacheMessages
-    QSqlQuery query;
-    query.prepare(QStringLiteral("DELETE FROM cachemessages WHERE expiry < :now"));
-    query.bindValue(QStringLiteral(":now"), QDateTime::currentDateTime());
+    QSqlQuery query = preparedQuery(QStringLiteral("SELECT " CACHEMESSAGE_COLUMNS " FROM cachemessages"), connectionName);
 
-    if (!query.exec()) {
-        qCWarning(transportDatabaseManagerDC) << "Delete expired CacheMessages query failed!" << query.lastError();
+    if (!execRead(query)) {
+        qCWarning(transportDatabaseManagerDC) << "All CacheMessages query failed!" << query.lastError();
         return ret;
     }
 
-    query.prepare(QStringLiteral("SELECT id, cachemessage FROM cachemessages"));
+    while (query.next()) {
+        ret.append(cacheMessageFromQuery(query));
+    }
+    query.finish();
+
+    return ret;
+}
 
-    if (!query.exec()) {
-        qCWarning(transportDatabaseManagerDC) << "All CacheMessages query failed!" << query.lastError();
+QList<CacheMessage> Transactions::cacheMessagesPage(int afterId, int maxId, int limit, const QString &connectionName)
+{
+    QList<CacheMessage> ret;
+
+    if (!databaseConnection(connectionName).isOpen()) {
+        return ret;
+    }
+
+    // Seeks on the primary key, so every page costs the same however deep the cursor is
+    QSqlQuery query = preparedQuery(QStringLiteral("SELECT " CACHEMESSAGE_COLUMNS " FROM cachemessages "
+                                                   "WHERE id > :after AND id <= :max ORDER BY id LIMIT :limit"), connectionName);
+    query.bindValue(QStringLiteral(":after"), afterId);
+    query.bindValue(QStringLiteral(":max"), maxId);
+    query.bindValue(QStringLiteral(":limit"), limit);
+
+    if (!execRead(query)) {
+        qCWarning(transportDatabaseManagerDC) << "CacheMessages page query failed!" << query.lastError();
         return ret;
     }
 
     while (query.next()) {
-        CacheMessage c = CacheMessage::fromBinary(query.value(CACHEMESSAGE_VALUE).toByteArray());
-        c.addAttribute("dbId", QByteArray::number(query.value(ID_VALUE).toInt()));
-        ret.append(c);
+        ret.append(cacheMessageFromQuery(query));
     }
+    query.finish();
 
     return ret;
 }
 
+bool Transactions::deleteExpiredCacheMessages(const QString &connectionName)
+{
+    if (!databaseConnection(connectionName).isOpen()) {
+        return false;
+    }
+
+    QSqlQuery query = preparedQuery(QStringLiteral("DELETE FROM cachemessages WHERE expiry < :now"), connectionName);
+    query.bindValue(QStringLiteral(":now"), QDateTime::currentDateTime());
+
+    if (!execWrite(query, WriteKind::Delete, 0)) {
+        qCWarning(transportDatabaseManagerDC) << "Delete expired CacheMessages query failed!" << query.lastError();
+        return false;
+    }
+
+    return true;
+}
+
 }
 
 }
@@ -22,26 +22,125 @@
 #include <cachemessage.h>
 
 #include <QtCore/QDateTime>
+#include <QtCore/QFuture>
 #include <QtCore/QHash>
+#include <QtCore/QPair>
 #include <QtCore/QString>
+#include <QtCore/QVector>
 
 namespace Hyperdrive
 {
 
+/**
+ * Every function accepts the name of the connection to operate on, the default connection is used when
+ * it is empty. A connection can be used only from the thread which opened it.
+ */
 namespace TransportDatabaseManager
 {
-    bool ensureDatabase(const QString &dbPath = QString(), const QString &migrationsDirPath = QString());
+    enum class SynchronousMode {
+        Off = 0,
+        Normal = 1,
+        Full = 2,
+        Extra = 3
+    };
+
+    // Has to be called before the first call to ensureDatabase
+    void setSynchronousMode(SynchronousMode mode);
+    SynchronousMode synchronousMode();
+    // Changes the mode of an open connection, outside of any transaction
+    bool applySynchronousMode(SynchronousMode mode, const QString &connectionName = QString());
+
+    // zlib level used for CacheMessage payloads from now on, 0 disables compression
+    void setPayloadCompressionLevel(int level);
+
+    enum class IntegrityRecovery {
+        // Copy the rows which can still be read to a new database
+        Rebuild,
+        // Start from an empty database
+        Delete
+    };
+
+    // How ensureDatabase recovers a damaged database
+    void setIntegrityRecovery(IntegrityRecovery recovery);
+
+    /**
+     * Reads every table of the database a page at a time from a background thread, using its own read only
+     * connection. A damaged database is flagged and recovered the next time ensureDatabase opens it.
+     * The future reports whether the database is healthy.
+     */
+    QFuture<bool> checkIntegrity(const QString &dbPath);
+
+    /**
+     * Storage counters, accumulated over every connection since the process started. bytesWritten counts the bytes
+     * handed over to the storage, not what the storage itself writes to the device.
+     */
+    struct Statistics {
+        Statistics();
+        Statistics &operator+=(const Statistics &other);
+
+        quint64 bytesWritten;
+        quint64 rowsInserted;
+        quint64 rowsUpdated;
+        quint64 rowsDeleted;
+        quint64 transactions;
+        quint64 syncs;
+        quint64 nanosecondsSpent;
+    };
+
+    Statistics statistics();
+    // For storages which write outside of the database, such as the cache log
+    void addStatistics(const Statistics &statistics);
+
+    bool ensureDatabase(const QString &dbPath = QString(), const QString &migrationsDirPath = QString(),
+                        const QString &connectionName = QString());
+    /**
+     * Opens an existing database for inspection: it is neither recovered nor migrated, and nothing is written to it.
+     * Queries expect the latest schema, so this fails and sets outdated when the database has an older one.
+     */
+    bool openDatabaseReadOnly(const QString &dbPath, const QString &migrationsDirPath, const QString &connectionName,
+                              bool *outdated = nullptr);
+    void closeDatabase(const QString &connectionName = QString());
+    // Checkpoints the WAL and rebuilds the database file, outside of any transaction
+    bool vacuum(const QString &connectionName = QString());
+
+    /**
+     * Groups all the queries executed during its lifetime in a single transaction, which is committed when
+     * the outermost ScopedTransaction on the same connection goes out of scope. ScopedTransactions can be nested.
+     */
+    class ScopedTransaction
+    {
+        Q_DISABLE_COPY(ScopedTransaction)
+
+    public:
+        explicit ScopedTransaction(const QString &connectionName = QString());
+        ~ScopedTransaction();
+
+    private:
+        QString m_connectionName;
+        bool m_active;
+    };
 
 namespace Transactions
 {
-    bool insertPersistentEntry(const QByteArray &target, const QByteArray &payload);
-    bool updatePersistentEntry(const QByteArray &target, const QByteArray &payload);
-    bool deletePersistentEntry(const QByteArray &target);
-    QHash<QByteArray, QByteArray> allPersistentEntries();
-
-    int insertCacheMessage(const CacheMessage &cacheMessage, const QDateTime &expiry = QDateTime());
-    bool deleteCacheMessage(int id);
-    QList<CacheMessage> allCacheMessages();
+    bool insertPersistentEntry(const QByteArray &target, const QByteArray &payload, const QString &connectionName = QString());
+    bool updatePersistentEntry(const QByteArray &target, const QByteArray &payload, const QString &connectionName = QString());
+    bool deletePersistentEntry(const QByteArray &target, const QString &connectionName = QString());
+    QHash<QByteArray, QByteArray> allPersistentEntries(const QString &connectionName = QString());
+    // A null QByteArray if there is no entry for target
+    QByteArray persistentEntry(const QByteArray &target, const QString &connectionName = QString());
+    // Up to limit (target, payload) pairs with target > afterTarget, in target order
+    QList<QPair<QByteArray, QByteArray> > persistentEntriesPage(const QByteArray &afterTarget, int limit,
+                                                               const QString &connectionName = QString());
+
+    bool insertCacheMessage(int id, const CacheMessage &cacheMessage, const QDateTime &expiry = QDateTime(),
+                            const QString &connectionName = QString());
+    bool deleteCacheMessage(int id, const QString &connectionName = QString());
+    bool deleteCacheMessages(const QVector<int> &ids, const QString &connectionName = QString());
+    int maxCacheMessageId(const QString &connectionName = QString());
+    QList<CacheMessage> allCacheMessages(const QString &connectionName = QString());
+    // Up to limit CacheMessages with afterId < id <= maxId, in id order
+    QList<CacheMessage> cacheMessagesPage(int afterId, int maxId, int limit, const QString &connectionName = QString());
+    bool deleteExpiredCacheMessages(const QString &connectionName = QString());
 }
 
 }